@@ -17,108 +17,500 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <windows.h>
 #include <detours.h>
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
-static std::wstring dll_path;
-static std::string res;
+enum patch_status
+{
+    PATCH_PATCHED,
+    PATCH_SKIPPED,
+    PATCH_FAILED,
+};
+
+typedef struct patch_job
+{
+    std::wstring exe_path_old;
+    std::wstring exe_path_new;
+    patch_status status;
+    // the step that failed and its GetLastError code, only set for PATCH_FAILED
+    const char* failed_step;
+    DWORD error;
+} patch_job_t;
+
+typedef struct import_ctx
+{
+    const char* dll_name;
+    bool added_dll;
+} import_ctx_t;
+
+static std::string wstr_to_utf8(const std::wstring& wstr)
+{
+    std::string res;
+    const int size = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.size()), nullptr, 0, nullptr, nullptr);
+    res.resize(size, 0);
+    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.size()), res.data(), size, nullptr, nullptr);
+    return res;
+}
 
 static BOOL CALLBACK cb(PVOID pContext, LPCSTR pszFile, LPCSTR* ppszOutFile)
 {
-    auto added_dll = static_cast<bool*>(pContext);
+    auto ctx = static_cast<import_ctx_t*>(pContext);
 
-    if (!pszFile && !*added_dll)
+    if (!pszFile && !ctx->added_dll)
     {
-        if (res.empty())
-        {
-            const int size = WideCharToMultiByte(CP_UTF8, 0, dll_path.c_str(), static_cast<int>(dll_path.size()), nullptr, 0, nullptr, nullptr);
-            res.resize(size, 0);
-            WideCharToMultiByte(CP_UTF8, 0, dll_path.c_str(), static_cast<int>(dll_path.size()), res.data(), size, nullptr, nullptr);
-        }
-
-        *ppszOutFile = res.c_str();
-        *added_dll = true;
+        *ppszOutFile = ctx->dll_name;
+        ctx->added_dll = true;
     }
 
     return TRUE;
 }
 
-int wmain(int argc, wchar_t* argv[])
+static bool fail(patch_job_t& job, const char* step)
 {
-    if (argv == nullptr)
+    job.status = PATCH_FAILED;
+    job.failed_step = step;
+    job.error = GetLastError();
+    return false;
+}
+
+/**
+ * Maps a relative virtual address to its offset in the file
+ * @param sections The section headers of the image
+ * @param count The number of section headers
+ * @param rva The relative virtual address
+ * @param file_size The size of the file
+ * @return The file offset, std::nullopt if the address isn't backed by raw data of a section
+ */
+static std::optional<size_t> rva_to_offset(const IMAGE_SECTION_HEADER* sections, const WORD count, const DWORD rva, const size_t file_size)
+{
+    for (WORD i = 0; i < count; ++i)
     {
-        MessageBoxW(nullptr, L"Failed to parse command line", L"Error", MB_OK);
-        return 1;
+        const auto& section = sections[i];
+
+        if (rva < section.VirtualAddress || rva - section.VirtualAddress >= section.SizeOfRawData)
+            continue;
+
+        const size_t offset = static_cast<size_t>(section.PointerToRawData) + (rva - section.VirtualAddress);
+
+        if (offset >= file_size)
+            return std::nullopt;
+
+        return offset;
     }
 
-    if (argc != 4)
+    return std::nullopt;
+}
+
+/**
+ * Walks the import directory of a 32bit or 64bit PE file without loading it
+ * @param base The read-only view of the file
+ * @param size The size of the file
+ * @param dll_name The DLL to look for, compared case insensitive
+ * @return True if the DLL is imported, std::nullopt if the file isn't a valid PE file
+ */
+static std::optional<bool> imports_dll(const uint8_t* base, const size_t size, const char* dll_name)
+{
+    if (size < sizeof(IMAGE_DOS_HEADER))
+        return std::nullopt;
+
+    const auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    const size_t nt_offset = dos_header->e_lfanew;
+    const size_t optional_offset = nt_offset + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER);
+
+    if (dos_header->e_magic != IMAGE_DOS_SIGNATURE || dos_header->e_lfanew < 0 || optional_offset + sizeof(WORD) > size)
+        return std::nullopt;
+
+    if (*reinterpret_cast<const DWORD*>(base + nt_offset) != IMAGE_NT_SIGNATURE)
+        return std::nullopt;
+
+    const auto file_header = reinterpret_cast<const IMAGE_FILE_HEADER*>(base + nt_offset + sizeof(DWORD));
+    const size_t sections_offset = optional_offset + file_header->SizeOfOptionalHeader;
+
+    if (sections_offset + static_cast<size_t>(file_header->NumberOfSections) * sizeof(IMAGE_SECTION_HEADER) > size)
+        return std::nullopt;
+
+    const auto magic = *reinterpret_cast<const WORD*>(base + optional_offset);
+    const IMAGE_DATA_DIRECTORY* import_dir;
+
+    // the image can be of either bitness, independent of the bitness of this tool
+    if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC && file_header->SizeOfOptionalHeader >= sizeof(IMAGE_OPTIONAL_HEADER32))
     {
-        MessageBoxW(nullptr, L"wrong number of args", L"Error", MB_OK);
-        return 1;
+        const auto optional_header = reinterpret_cast<const IMAGE_OPTIONAL_HEADER32*>(base + optional_offset);
+
+        if (optional_header->NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_IMPORT)
+            return false;
+
+        import_dir = &optional_header->DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
     }
+    else if (magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC && file_header->SizeOfOptionalHeader >= sizeof(IMAGE_OPTIONAL_HEADER64))
+    {
+        const auto optional_header = reinterpret_cast<const IMAGE_OPTIONAL_HEADER64*>(base + optional_offset);
 
-    dll_path = argv[1];
-    wprintf(L"adding %s\n", dll_path.c_str());
+        if (optional_header->NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_IMPORT)
+            return false;
 
-    const std::wstring exe_path_old = argv[2];
-    const std::wstring exe_path_new = argv[3];
+        import_dir = &optional_header->DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    }
+    else
+    {
+        return std::nullopt;
+    }
 
-    const auto handle_exe_old = CreateFileW(exe_path_old.c_str(),
-                                    GENERIC_READ,
-                                    FILE_SHARE_READ,
-                                    nullptr,
-                                    OPEN_EXISTING,
-                                    FILE_ATTRIBUTE_NORMAL,
-                                    nullptr);
+    if (import_dir->VirtualAddress == 0)
+        return false;
 
-    if (handle_exe_old == INVALID_HANDLE_VALUE)
+    const auto sections = reinterpret_cast<const IMAGE_SECTION_HEADER*>(base + sections_offset);
+    const auto count = file_header->NumberOfSections;
+    auto descriptor_offset = rva_to_offset(sections, count, import_dir->VirtualAddress, size);
+
+    if (!descriptor_offset)
+        return std::nullopt;
+
+    for (size_t offset = *descriptor_offset; offset + sizeof(IMAGE_IMPORT_DESCRIPTOR) <= size; offset += sizeof(IMAGE_IMPORT_DESCRIPTOR))
+    {
+        const auto descriptor = reinterpret_cast<const IMAGE_IMPORT_DESCRIPTOR*>(base + offset);
+
+        // the directory is terminated by a zeroed descriptor
+        if (descriptor->Name == 0)
+            return false;
+
+        const auto name_offset = rva_to_offset(sections, count, descriptor->Name, size);
+
+        if (!name_offset)
+            return std::nullopt;
+
+        const auto name = reinterpret_cast<const char*>(base + *name_offset);
+
+        if (memchr(name, 0, size - *name_offset) == nullptr)
+            return std::nullopt;
+
+        if (_stricmp(name, dll_name) == 0)
+            return true;
+    }
+
+    return std::nullopt;
+}
+
+/**
+ * Checks the import table of an executable through a read-only mapping of the file
+ * @param job The job, set to failed if the file can't be read
+ * @param dll_name The DLL to look for
+ * @return True if the DLL is already imported, std::nullopt on failure
+ */
+static std::optional<bool> is_patched(patch_job_t& job, const char* dll_name)
+{
+    const auto handle_exe = CreateFileW(job.exe_path_old.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (handle_exe == INVALID_HANDLE_VALUE)
+    {
+        fail(job, "CreateFile");
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(handle_exe, &size))
+    {
+        fail(job, "GetFileSizeEx");
+        CloseHandle(handle_exe);
+        return std::nullopt;
+    }
+
+    const auto mapping = CreateFileMappingW(handle_exe, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle_exe);
+
+    if (mapping == nullptr)
+    {
+        fail(job, "CreateFileMapping");
+        return std::nullopt;
+    }
+
+    const auto view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+
+    if (view == nullptr)
+    {
+        fail(job, "MapViewOfFile");
+        return std::nullopt;
+    }
+
+    const auto res = imports_dll(view, static_cast<size_t>(size.QuadPart), dll_name);
+    UnmapViewOfFile(view);
+
+    if (!res)
     {
-        wprintf(L"action failed: %s, error: %d\n", exe_path_old.c_str(), GetLastError());
-        exit(1);
+        SetLastError(ERROR_BAD_EXE_FORMAT);
+        fail(job, "ImportDirectory");
+        return std::nullopt;
     }
 
+    return res;
+}
+
+/**
+ * Writes a copy of exe_path_old with an import of the DLL added to exe_path_new
+ * Both paths may be the same, the binary is read into memory before the output is written
+ * @param job The job, status and error are set on return
+ * @param dll_name The DLL to add to the import table
+ * @return True on success
+ */
+static bool patch_binary(patch_job_t& job, const char* dll_name)
+{
+    const auto handle_exe_old = CreateFileW(job.exe_path_old.c_str(),
+                                            GENERIC_READ,
+                                            FILE_SHARE_READ,
+                                            nullptr,
+                                            OPEN_EXISTING,
+                                            FILE_ATTRIBUTE_NORMAL,
+                                            nullptr);
+
+    if (handle_exe_old == INVALID_HANDLE_VALUE)
+        return fail(job, "CreateFile");
+
     const auto binary = DetourBinaryOpen(handle_exe_old);
     CloseHandle(handle_exe_old);
 
     if (!binary)
+        return fail(job, "DetourBinaryOpen");
+
+    import_ctx_t ctx{dll_name, false};
+
+    if (!DetourBinaryEditImports(binary, &ctx, cb, nullptr, nullptr, nullptr))
     {
-        wprintf(L"action failed: %d\n", GetLastError());
-        exit(1);
+        fail(job, "DetourBinaryEditImports");
+        DetourBinaryClose(binary);
+        return false;
     }
 
-    bool added_dll = false;
+    // write next to the target and move it into place, an interrupted write never leaves a truncated executable behind
+    const auto temp_path = job.exe_path_new + L".tmp";
+    const auto handle_exe_new = CreateFileW(temp_path.c_str(),
+                                            GENERIC_READ | GENERIC_WRITE,
+                                            0,
+                                            nullptr,
+                                            CREATE_ALWAYS,
+                                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                            nullptr);
 
-    if (!DetourBinaryEditImports(binary, &added_dll, cb, nullptr, nullptr, nullptr))
+    if (handle_exe_new == INVALID_HANDLE_VALUE)
     {
-        wprintf(L"action failed: %d\n", GetLastError());
+        fail(job, "CreateFile");
         DetourBinaryClose(binary);
-        exit(1);
+        return false;
     }
 
-    const auto handle_exe_new = CreateFileW(exe_path_new.c_str(),
-                             GENERIC_READ | GENERIC_WRITE,
-                             0,
-                             nullptr,
-                             CREATE_ALWAYS,
-                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-                             nullptr);
+    const bool written = DetourBinaryWrite(binary, handle_exe_new);
 
-    if (handle_exe_new == INVALID_HANDLE_VALUE)
+    if (!written)
+        fail(job, "DetourBinaryWrite");
+
+    DetourBinaryClose(binary);
+    CloseHandle(handle_exe_new);
+
+    if (!written)
     {
-        wprintf(L"action failed: %s, error: %d\n", exe_path_new.c_str(), GetLastError());
-        exit(1);
+        DeleteFileW(temp_path.c_str());
+        return false;
     }
 
-    if (!DetourBinaryWrite(binary, handle_exe_new))
+    if (!MoveFileExW(temp_path.c_str(), job.exe_path_new.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
     {
-        wprintf(L"action failed: %d\n", GetLastError());
-        DetourBinaryClose(binary);
-        CloseHandle(handle_exe_new);
-        exit(1);
+        fail(job, "MoveFileEx");
+        DeleteFileW(temp_path.c_str());
+        return false;
     }
 
-    DetourBinaryClose(binary);
-    CloseHandle(handle_exe_new);
-    wprintf(L"success: %s\n", exe_path_new.c_str());
+    job.status = PATCH_PATCHED;
+    return true;
+}
+
+static std::string json_escape(const std::string& str)
+{
+    std::string res;
+    res.reserve(str.size());
+
+    for (const char c : str)
+    {
+        switch (c)
+        {
+        case '"':
+            res += "\\\"";
+            break;
+        case '\\':
+            res += "\\\\";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char buf[8];
+                sprintf_s(buf, "\\u%04x", c);
+                res += buf;
+            }
+            else
+            {
+                res += c;
+            }
+        }
+    }
+
+    return res;
+}
+
+/**
+ * @param path A path as given on the command line
+ * @return The absolute path, std::nullopt on failure
+ */
+static std::optional<std::wstring> get_full_path(const std::wstring& path)
+{
+    const auto size = GetFullPathNameW(path.c_str(), 0, nullptr, nullptr);
+
+    if (size == 0)
+        return std::nullopt;
+
+    std::wstring full_path(size, L'\0');
+    const auto len = GetFullPathNameW(path.c_str(), size, full_path.data(), nullptr);
+
+    if (len == 0 || len >= size)
+        return std::nullopt;
+
+    full_path.resize(len);
+    return full_path;
+}
+
+/**
+ * Patches every executable in place on a pool of threads, executables that already import the DLL are skipped
+ * Paths are made absolute first, an executable listed more than once is only patched once and reported as skipped otherwise
+ * Prints a single JSON object with one result per executable to stdout
+ * @param dll_name The DLL to add to the import tables
+ * @param exe_paths The executables
+ * @return 0 if no executable failed, 1 otherwise
+ */
+static int run_batch(const std::string& dll_name, const std::vector<std::wstring>& exe_paths)
+{
+    std::vector<patch_job_t> jobs;
+    // indices of the jobs the threads work on, duplicates are only reported
+    std::vector<size_t> dispatched;
+    jobs.reserve(exe_paths.size());
+
+    for (const auto& exe_path : exe_paths)
+    {
+        patch_job_t job{exe_path, exe_path, PATCH_SKIPPED, nullptr, 0};
+
+        if (const auto full_path = get_full_path(exe_path))
+        {
+            job.exe_path_old = job.exe_path_new = *full_path;
+
+            // two threads patching the same file would race on the temporary file, or add the import twice
+            const bool duplicate = std::any_of(dispatched.begin(), dispatched.end(), [&](const size_t i) { return _wcsicmp(jobs[i].exe_path_old.c_str(), full_path->c_str()) == 0; });
+
+            if (!duplicate)
+                dispatched.push_back(jobs.size());
+        }
+        else
+        {
+            fail(job, "GetFullPathName");
+        }
+
+        jobs.push_back(std::move(job));
+    }
+
+    std::atomic<size_t> next_job = 0;
+    const size_t thread_count = (std::min)(dispatched.size(), static_cast<size_t>((std::max)(std::thread::hardware_concurrency(), 1u)));
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        threads.emplace_back([&]
+        {
+            for (size_t j = next_job++; j < dispatched.size(); j = next_job++)
+            {
+                auto& job = jobs[dispatched[j]];
+                const auto patched = is_patched(job, dll_name.c_str());
+
+                if (patched && !*patched)
+                    patch_binary(job, dll_name.c_str());
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    bool failed = false;
+    std::string out = "{\"dll\":\"" + json_escape(dll_name) + "\",\"results\":[";
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const auto& job = jobs[i];
+
+        if (i > 0)
+            out += ',';
+
+        out += "{\"path\":\"" + json_escape(wstr_to_utf8(job.exe_path_old)) + "\",\"status\":\"";
+
+        switch (job.status)
+        {
+        case PATCH_PATCHED:
+            out += "patched\"}";
+            break;
+        case PATCH_SKIPPED:
+            out += "skipped\"}";
+            break;
+        case PATCH_FAILED:
+            out += "failed\",\"step\":\"" + std::string(job.failed_step) + "\",\"error\":" + std::to_string(job.error) + "}";
+            failed = true;
+            break;
+        }
+    }
+
+    out += "]}\n";
+    fwrite(out.data(), 1, out.size(), stdout);
+
+    return failed ? 1 : 0;
+}
+
+static void print_usage()
+{
+    fwprintf(stderr, L"usage: addimport <dll> <exe_in> <exe_out>\n");
+    fwprintf(stderr, L"       addimport --batch <dll> <exe>...\n");
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argv == nullptr)
+    {
+        fwprintf(stderr, L"Failed to parse command line\n");
+        return 1;
+    }
+
+    if (argc >= 4 && wcscmp(argv[1], L"--batch") == 0)
+        return run_batch(wstr_to_utf8(argv[2]), std::vector<std::wstring>(argv + 3, argv + argc));
+
+    if (argc != 4)
+    {
+        print_usage();
+        return 1;
+    }
+
+    const std::wstring dll_path = argv[1];
+    wprintf(L"adding %s\n", dll_path.c_str());
+
+    const auto dll_name = wstr_to_utf8(dll_path);
+    patch_job_t job{argv[2], argv[3], PATCH_FAILED, nullptr, 0};
+
+    if (!patch_binary(job, dll_name.c_str()))
+    {
+        wprintf(L"action failed: %S, error: %d\n", job.failed_step, job.error);
+        return 1;
+    }
+
+    wprintf(L"success: %s\n", job.exe_path_new.c_str());
 
     return 0;
 }
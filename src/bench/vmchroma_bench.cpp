@@ -0,0 +1,402 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <windows.h>
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "app_identity_cache.hpp"
+#include "config_manager.hpp"
+#include "utils.hpp"
+#include "window_manager.hpp"
+
+// the benchmarks run outside of Voicemeeter, the inputs are taken from the environment
+static constexpr wchar_t ENV_FLAVOR[] = L"VMCHROMA_BENCH_FLAVOR";
+static constexpr wchar_t ENV_IMAGE[] = L"VMCHROMA_BENCH_IMAGE";
+static constexpr wchar_t BENCH_WND_CLASS[] = L"vmchroma_bench";
+static constexpr DWORD FRAME_WAIT_MS = 100;
+
+typedef struct bench_flavor
+{
+    const char* name;
+    flavor_id id;
+    // size of the main window at 100% scaling
+    int32_t width;
+    int32_t height;
+} bench_flavor_t;
+
+static constexpr bench_flavor_t BENCH_FLAVORS[] = {
+    {"default", FLAVOR_DEFAULT, 1024, 552},
+    {"banana", FLAVOR_BANANA, 1024, 550},
+    {"potato", FLAVOR_POTATO, 1645, 835},
+};
+
+static std::wstring get_env(const wchar_t* name)
+{
+    std::wstring value(MAX_PATH, L'\0');
+    const auto len = GetEnvironmentVariableW(name, value.data(), static_cast<DWORD>(value.size()));
+
+    if (len == 0 || len >= value.size())
+        return {};
+
+    value.resize(len);
+    return value;
+}
+
+/**
+ * Loads vmchroma.yaml and the theme of the flavor in VMCHROMA_BENCH_FLAVOR (banana if unset) once for all benchmarks
+ * @return The config, nullptr if it can't be loaded
+ */
+static config_manager* get_config()
+{
+    static config_manager cm;
+    static const bool loaded = []
+    {
+        const auto flavor_name = utils::wstr_to_str_or_default(get_env(ENV_FLAVOR), "");
+        auto flavor = FLAVOR_BANANA;
+
+        for (const auto& f : BENCH_FLAVORS)
+        {
+            if (flavor_name == f.name)
+                flavor = f.id;
+        }
+
+        cm.set_current_flavor_id(flavor);
+
+        return cm.load_config() && cm.init_theme();
+    }();
+
+    return loaded ? &cm : nullptr;
+}
+
+/**
+ * Mouse over and redraws look up the same few colors over and over, every color of the table is probed together with a miss next to it
+ * @param state state.range(0) is the color_category
+ */
+static void BM_cfg_get_color(benchmark::State& state)
+{
+    const auto cm = get_config();
+
+    if (cm == nullptr)
+    {
+        state.SkipWithError("config or theme not loaded");
+        return;
+    }
+
+    const auto category = static_cast<color_category>(state.range(0));
+    const auto& table = cm->get_color_table(category);
+
+    if (table.empty())
+    {
+        state.SkipWithError("theme has no colors for this category");
+        return;
+    }
+
+    std::vector<COLORREF> probes;
+
+    for (const auto& mapping : table)
+    {
+        probes.push_back(mapping.from);
+        probes.push_back(mapping.from ^ 0x000001);
+    }
+
+    size_t i = 0;
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cm->cfg_get_color(probes[i], category));
+        i = i + 1 == probes.size() ? 0 : i + 1;
+    }
+
+    state.counters["table_size"] = static_cast<double>(table.size());
+}
+BENCHMARK(BM_cfg_get_color)->Arg(CATEGORY_SHAPES)->Arg(CATEGORY_TEXT);
+
+static void BM_colorref_to_hex(benchmark::State& state)
+{
+    COLORREF color = 0;
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(utils::colorref_to_hex(color));
+        color = (color + 0x010305) & 0x00FFFFFF;
+    }
+}
+BENCHMARK(BM_colorref_to_hex);
+
+static void BM_hex_to_colorref(benchmark::State& state)
+{
+    std::vector<std::string> hex_values;
+
+    for (COLORREF color = 0; color < 0x01000000; color += 0x0F0D0B)
+        hex_values.push_back(utils::colorref_to_hex(color));
+
+    size_t i = 0;
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(utils::hex_to_colorref(hex_values[i]));
+        i = i + 1 == hex_values.size() ? 0 : i + 1;
+    }
+}
+BENCHMARK(BM_hex_to_colorref);
+
+/**
+ * Scans a captured Voicemeeter executable from VMCHROMA_BENCH_IMAGE for the scroll patch sites
+ * The image is mapped with its sections at their virtual addresses like the loader does, without running any of its code
+ */
+static void BM_find_signatures(benchmark::State& state)
+{
+    const auto path = get_env(ENV_IMAGE);
+
+    if (path.empty())
+    {
+        state.SkipWithError("VMCHROMA_BENCH_IMAGE not set");
+        return;
+    }
+
+    const auto module = LoadLibraryExW(path.c_str(), nullptr, LOAD_LIBRARY_AS_IMAGE_RESOURCE);
+
+    if (module == nullptr)
+    {
+        state.SkipWithError("failed to map the image");
+        return;
+    }
+
+    // the low bits of the handle flag a resource mapping
+    const auto base_handle = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(module) & ~static_cast<uintptr_t>(3));
+    const auto nt_headers = reinterpret_cast<PIMAGE_NT_HEADERS>(base_handle + reinterpret_cast<PIMAGE_DOS_HEADER>(base_handle)->e_lfanew);
+    const auto section_header = IMAGE_FIRST_SECTION(nt_headers);
+    const auto sigs = nt_headers->FileHeader.Machine == IMAGE_FILE_MACHINE_AMD64 ? utils::get_scroll_signatures64() : utils::get_scroll_signatures32();
+
+    int64_t code_size = 0;
+
+    for (int k = 0; k < nt_headers->FileHeader.NumberOfSections; ++k)
+    {
+        if (section_header[k].Characteristics & IMAGE_SCN_MEM_EXECUTE)
+            code_size += section_header[k].Misc.VirtualSize;
+    }
+
+    size_t matches = 0;
+
+    for (auto _ : state)
+    {
+        const auto occurrences = utils::find_signatures(base_handle, sigs);
+
+        matches = 0;
+
+        for (const auto& o : occurrences)
+            matches += o.size();
+
+        benchmark::DoNotOptimize(matches);
+    }
+
+    // the scroll patch needs exactly one site per signature
+    state.counters["matches"] = static_cast<double>(matches);
+    state.SetBytesProcessed(state.iterations() * code_size);
+
+    FreeLibrary(module);
+}
+BENCHMARK(BM_find_signatures)->Unit(benchmark::kMillisecond);
+
+/**
+ * Writes a 24 bit bitmap with the size of a main window background to the temp directory
+ * @param flavor The flavor the bitmap is sized for
+ * @return The path of the bitmap, empty on failure
+ */
+static std::wstring write_bench_bitmap(const bench_flavor_t& flavor)
+{
+    std::error_code ec;
+    const auto path = std::filesystem::temp_directory_path(ec) / (std::wstring(L"vmchroma_bench_") + utils::str_to_wstr_or_default(flavor.name) + L".bmp");
+
+    if (ec)
+        return {};
+
+    const uint32_t stride = (static_cast<uint32_t>(flavor.width) * 24 + 31) / 32 * 4;
+    const uint32_t pixel_size = stride * flavor.height;
+
+    BITMAPFILEHEADER file_header = {};
+    file_header.bfType = 0x4D42;
+    file_header.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    file_header.bfSize = file_header.bfOffBits + pixel_size;
+
+    BITMAPINFOHEADER info_header = {};
+    info_header.biSize = sizeof(BITMAPINFOHEADER);
+    info_header.biWidth = flavor.width;
+    info_header.biHeight = flavor.height;
+    info_header.biPlanes = 1;
+    info_header.biBitCount = 24;
+    info_header.biCompression = BI_RGB;
+    info_header.biSizeImage = pixel_size;
+
+    std::vector<char> pixels(pixel_size, 0x40);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+    file.write(reinterpret_cast<const char*>(&info_header), sizeof(info_header));
+    file.write(pixels.data(), static_cast<std::streamsize>(pixels.size()));
+
+    return file ? path.wstring() : std::wstring();
+}
+
+/**
+ * @param state state.range(0) is the index into BENCH_FLAVORS
+ */
+static void BM_load_bitmap(benchmark::State& state)
+{
+    const auto& flavor = BENCH_FLAVORS[state.range(0)];
+    const auto path = write_bench_bitmap(flavor);
+
+    if (path.empty())
+    {
+        state.SkipWithError("failed to write the bitmap");
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        utils::mapped_file file;
+        benchmark::DoNotOptimize(utils::load_bitmap(path, file));
+    }
+
+    state.SetLabel(flavor.name);
+    DeleteFileW(path.c_str());
+}
+BENCHMARK(BM_load_bitmap)->DenseRange(0, static_cast<int>(std::size(BENCH_FLAVORS)) - 1);
+
+/**
+ * The check of hk_GetProcessId for a process that was already seen in the current config generation
+ */
+static void BM_blacklist_cached(benchmark::State& state)
+{
+    const auto cm = get_config();
+
+    if (cm == nullptr)
+    {
+        state.SkipWithError("config or theme not loaded");
+        return;
+    }
+
+    app_identity_cache cache;
+    const auto pid = GetCurrentProcessId();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cache.is_blacklisted(pid, cm->get_config_generation(), [cm](const std::wstring& app_name) { return cm->is_app_blacklisted(app_name); }));
+}
+BENCHMARK(BM_blacklist_cached);
+
+/**
+ * The check of hk_GetProcessId right after a config reload, every lookup runs the blacklist against the image name
+ */
+static void BM_blacklist_new_generation(benchmark::State& state)
+{
+    const auto cm = get_config();
+
+    if (cm == nullptr)
+    {
+        state.SkipWithError("config or theme not loaded");
+        return;
+    }
+
+    app_identity_cache cache;
+    const auto pid = GetCurrentProcessId();
+    uint64_t generation = 0;
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cache.is_blacklisted(pid, ++generation, [cm](const std::wstring& app_name) { return cm->is_app_blacklisted(app_name); }));
+}
+BENCHMARK(BM_blacklist_new_generation);
+
+/**
+ * One frame of the main window at the default size of a flavor, drawn to a window that is never shown
+ * GDI draws into the memory DC before every frame like Voicemeeter does, the wait for the swap chain isn't part of the timing
+ * The swap chain is waited for through wait_for_frame, so render presents in every iteration instead of deferring the frame
+ * @param state state.range(0) is the index into BENCH_FLAVORS
+ */
+static void BM_render(benchmark::State& state)
+{
+    const auto& flavor = BENCH_FLAVORS[state.range(0)];
+
+    WNDCLASSEXW wc = {};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = DefWindowProcW;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = BENCH_WND_CLASS;
+    RegisterClassExW(&wc);
+
+    const auto hwnd = CreateWindowExW(WS_EX_TOOLWINDOW, BENCH_WND_CLASS, L"", WS_POPUP, 0, 0, flavor.width, flavor.height, nullptr, nullptr, wc.hInstance, nullptr);
+
+    if (hwnd == nullptr)
+    {
+        state.SkipWithError("failed to create the window");
+        return;
+    }
+
+    CREATESTRUCTA cs = {};
+    cs.cx = flavor.width;
+    cs.cy = flavor.height;
+
+    window_manager wm;
+    wm.set_hwnd_main(hwnd);
+
+    if (!wm.init_window(hwnd, WND_TYPE_MAIN, &cs))
+    {
+        state.SkipWithError("failed to initialize the window");
+        DestroyWindow(hwnd);
+        return;
+    }
+
+    const auto& wctx = wm.get_wctx(hwnd);
+    const RECT rc = {0, 0, flavor.width, flavor.height};
+    COLORREF color = 0;
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+
+        if (!wm.wait_for_frame(hwnd, FRAME_WAIT_MS))
+        {
+            state.SkipWithError("the swap chain didn't take a frame");
+            break;
+        }
+
+        const auto brush = CreateSolidBrush(color);
+        FillRect(wctx.mem_dc, &rc, brush);
+        DeleteObject(brush);
+        color = (color + 0x010101) & 0x00FFFFFF;
+
+        state.ResumeTiming();
+
+        wm.render(hwnd);
+    }
+
+    // every iteration has to present exactly one frame, otherwise a deferred frame was timed
+    if (!state.error_occurred() && wctx.frames_presented != static_cast<uint64_t>(state.iterations()))
+        state.SkipWithError("not every iteration presented a frame");
+
+    state.counters["presented"] = benchmark::Counter(static_cast<double>(wctx.frames_presented), benchmark::Counter::kAvgIterations);
+    state.SetLabel(std::string(flavor.name) + " " + std::to_string(flavor.width) + "x" + std::to_string(flavor.height));
+
+    wm.destroy_window(hwnd);
+    DestroyWindow(hwnd);
+}
+BENCHMARK(BM_render)->DenseRange(0, static_cast<int>(std::size(BENCH_FLAVORS)) - 1)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,356 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <windows.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "frame_trace.hpp"
+#include "perf_stats.hpp"
+#include "utils.hpp"
+#include "window_manager.hpp"
+
+enum replay_mode { REPLAY_MODE_SYNC, REPLAY_MODE_DIRTY, REPLAY_MODE_COMPOSITOR, REPLAY_MODE_COUNT };
+
+typedef struct replay_result
+{
+    size_t frames;
+    double ui_p50_us;
+    double ui_p99_us;
+    perf_summary_t draw;
+    perf_summary_t gpu;
+    perf_summary_t present;
+    uint64_t frames_presented;
+    uint64_t bitmap_allocations;
+} replay_result_t;
+
+static constexpr wchar_t REPLAY_WND_CLASS[] = L"vmchroma_replay";
+// time the swap chain and the compositor thread get for the last frames before the counters are read
+static constexpr int64_t DRAIN_MS = 200;
+
+static window_manager* active_wm = nullptr;
+
+static const wchar_t* get_mode_name(const replay_mode mode)
+{
+    switch (mode)
+    {
+    case REPLAY_MODE_SYNC:
+        return L"sync";
+    case REPLAY_MODE_DIRTY:
+        return L"dirty";
+    case REPLAY_MODE_COMPOSITOR:
+        return L"compositor";
+    default:
+        return L"unknown";
+    }
+}
+
+static const wchar_t* get_flavor_name(const uint32_t flavor)
+{
+    switch (flavor)
+    {
+    case FLAVOR_DEFAULT:
+        return L"default";
+    case FLAVOR_BANANA:
+        return L"banana";
+    case FLAVOR_POTATO:
+        return L"potato";
+    default:
+        return L"unknown";
+    }
+}
+
+/**
+ * Deferred frames are retried by their timer like in Voicemeeter
+ */
+static LRESULT CALLBACK replay_wndproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    if (msg == WM_TIMER && wParam == window_manager::FRAME_TIMER_ID && active_wm != nullptr)
+    {
+        active_wm->on_frame_timer(hwnd);
+        return 0;
+    }
+
+    return DefWindowProcW(hwnd, msg, wParam, lParam);
+}
+
+/**
+ * Handles window messages until the deadline
+ * @param deadline QPC ticks
+ */
+static void pump_until(const int64_t deadline)
+{
+    for (;;)
+    {
+        MSG msg;
+
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE))
+        {
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+
+        const auto t = perf::now();
+
+        if (t >= deadline)
+            return;
+
+        MsgWaitForMultipleObjects(0, nullptr, FALSE, static_cast<DWORD>((deadline - t) * 1000 / perf::get_frequency()), QS_ALLINPUT);
+    }
+}
+
+/**
+ * Draws the changed rectangles of a frame into the memory DC, the same way GDI would have drawn them
+ * @param dc The memory DC of the window
+ * @param frame The frame
+ */
+static void apply_frame(HDC dc, const frame_trace_entry_t& frame)
+{
+    for (const auto& delta : frame.deltas)
+    {
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = static_cast<LONG>(delta.rect.width);
+        bmi.bmiHeader.biHeight = -static_cast<LONG>(delta.rect.height);
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        SetDIBitsToDevice(dc, static_cast<int>(delta.rect.x), static_cast<int>(delta.rect.y), delta.rect.width, delta.rect.height, 0, 0, 0, delta.rect.height, delta.pixels, &bmi, DIB_RGB_COLORS);
+    }
+}
+
+/**
+ * @param ticks The samples in QPC ticks, reordered
+ * @param percentile Between 0 and 100
+ * @return The percentile in microseconds
+ */
+static double get_percentile_us(std::vector<int64_t>& ticks, const size_t percentile)
+{
+    if (ticks.empty())
+        return 0.0;
+
+    const auto nth = ticks.begin() + min(ticks.size() - 1, ticks.size() * percentile / 100);
+    std::nth_element(ticks.begin(), nth, ticks.end());
+
+    return static_cast<double>(*nth) * 1e6 / static_cast<double>(perf::get_frequency());
+}
+
+/**
+ * Replays a trace at its recorded pace on a window that is never shown
+ * @param trace The trace
+ * @param mode How the window manager renders
+ * @param result Target, filled on success
+ * @return True if the trace was replayed
+ */
+static bool run_replay(const frame_trace& trace, const replay_mode mode, replay_result_t& result)
+{
+    const auto& header = trace.get_header();
+    window_manager wm;
+
+    if (mode == REPLAY_MODE_COMPOSITOR && !wm.start_compositor())
+    {
+        wprintf(L"failed to start the compositor thread\n");
+        return false;
+    }
+
+    wm.set_dirty_rect_rendering(mode == REPLAY_MODE_DIRTY);
+
+    if (trace.get_background().size != 0 && !wm.set_background(trace.get_background()))
+        wprintf(L"failed to set the background, replaying without it\n");
+
+    const auto& shapes = trace.get_palette(CATEGORY_SHAPES);
+    const auto& text = trace.get_palette(CATEGORY_TEXT);
+
+    if ((!shapes.empty() || !text.empty()) && !wm.set_palette(shapes, text))
+        wprintf(L"failed to set the palette, replaying without it\n");
+
+    const auto instance = GetModuleHandleW(nullptr);
+    const auto hwnd = CreateWindowExW(WS_EX_TOOLWINDOW, REPLAY_WND_CLASS, L"", WS_POPUP, 0, 0, static_cast<int>(header.width), static_cast<int>(header.height), nullptr, nullptr, instance, nullptr);
+
+    if (hwnd == nullptr)
+    {
+        wprintf(L"failed to create the window, error: %lu\n", GetLastError());
+        return false;
+    }
+
+    CREATESTRUCTA cs = {};
+    cs.cx = static_cast<int>(header.width);
+    cs.cy = static_cast<int>(header.height);
+
+    if (!wm.init_window(hwnd, WND_TYPE_MAIN, &cs))
+    {
+        wprintf(L"failed to initialize the window\n");
+        DestroyWindow(hwnd);
+        return false;
+    }
+
+    wm.set_hwnd_main(hwnd);
+    active_wm = &wm;
+
+    const auto& wctx = wm.get_wctx(hwnd);
+    const auto& frames = trace.get_frames();
+    const auto frequency = perf::get_frequency();
+    const auto allocations_before = wctx.bitmap_allocations;
+
+    std::vector<int64_t> ui_ticks;
+    ui_ticks.reserve(frames.size());
+
+    perf::reset();
+
+    const auto start = perf::now();
+
+    for (const auto& frame : frames)
+    {
+        pump_until(start + static_cast<int64_t>(frame.time_us) * frequency / 1000000);
+
+        if (wctx.mem_dc == nullptr)
+            break;
+
+        apply_frame(wctx.mem_dc, frame);
+
+        const auto t = perf::now();
+        wm.render(hwnd);
+        ui_ticks.push_back(perf::now() - t);
+    }
+
+    pump_until(perf::now() + DRAIN_MS * frequency / 1000);
+
+    // the counters of the compositor thread can be read once it is gone
+    wm.stop_compositor();
+    active_wm = nullptr;
+
+    result.frames = ui_ticks.size();
+    result.ui_p50_us = get_percentile_us(ui_ticks, 50);
+    result.ui_p99_us = get_percentile_us(ui_ticks, 99);
+    result.draw = perf::summarize(PERF_DRAW);
+    result.gpu = perf::summarize(PERF_GPU_DRAW);
+    result.present = perf::summarize(PERF_PRESENT);
+    result.frames_presented = wctx.frames_presented;
+    result.bitmap_allocations = wctx.bitmap_allocations - allocations_before;
+
+    wm.destroy_window(hwnd);
+    DestroyWindow(hwnd);
+
+    return true;
+}
+
+/**
+ * Replays frame traces recorded with recordFrames and prints the frame costs of every rendering mode
+ * Usage: vmchroma_replay <trace>... [--mode sync|dirty|compositor|all]
+ * The percentiles of draw, gpu and present cover the last perf::RING_SIZE frames of a run
+ */
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argv == nullptr)
+    {
+        wprintf(L"failed to parse command line\n");
+        return 1;
+    }
+
+    std::vector<std::wstring> paths;
+    std::vector<replay_mode> modes = {REPLAY_MODE_SYNC, REPLAY_MODE_DIRTY, REPLAY_MODE_COMPOSITOR};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::wstring arg = argv[i];
+
+        if (arg != L"--mode")
+        {
+            paths.push_back(arg);
+            continue;
+        }
+
+        if (++i == argc)
+        {
+            wprintf(L"--mode needs a value\n");
+            return 1;
+        }
+
+        const std::wstring value = argv[i];
+        modes.clear();
+
+        for (int m = 0; m < REPLAY_MODE_COUNT; ++m)
+        {
+            if (value == L"all" || value == get_mode_name(static_cast<replay_mode>(m)))
+                modes.push_back(static_cast<replay_mode>(m));
+        }
+
+        if (modes.empty())
+        {
+            wprintf(L"unknown mode: %s\n", value.c_str());
+            return 1;
+        }
+    }
+
+    if (paths.empty())
+    {
+        wprintf(L"usage: vmchroma_replay <trace>... [--mode sync|dirty|compositor|all]\n");
+        return 1;
+    }
+
+    WNDCLASSEXW wc = {};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = replay_wndproc;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = REPLAY_WND_CLASS;
+
+    if (!RegisterClassExW(&wc))
+    {
+        wprintf(L"failed to register the window class, error: %lu\n", GetLastError());
+        return 1;
+    }
+
+    perf::set_enabled(true);
+
+    int failures = 0;
+
+    for (const auto& path : paths)
+    {
+        frame_trace trace;
+
+        if (!trace.open(path))
+        {
+            wprintf(L"failed to open %s\n", path.c_str());
+            ++failures;
+            continue;
+        }
+
+        const auto& header = trace.get_header();
+        wprintf(L"%s: %s %ux%u, %zu frames\n", path.c_str(), get_flavor_name(header.flavor), header.width, header.height, trace.get_frames().size());
+
+        for (const auto mode : modes)
+        {
+            replay_result_t r = {};
+
+            if (!run_replay(trace, mode, r))
+            {
+                ++failures;
+                continue;
+            }
+
+            const double frames = r.frames != 0 ? static_cast<double>(r.frames) : 1.0;
+
+            wprintf(L"  %-10s ui p50 %8.1f us p99 %8.1f us | draw p50 %8.1f us p99 %8.1f us | gpu p50 %8.1f us p99 %8.1f us | present p50 %8.1f us p99 %8.1f us | presented %llu/%zu | bitmap allocations %.2f per frame\n",
+                    get_mode_name(mode), r.ui_p50_us, r.ui_p99_us, r.draw.p50_us, r.draw.p99_us, r.gpu.p50_us, r.gpu.p99_us, r.present.p50_us, r.present.p99_us,
+                    r.frames_presented, r.frames, static_cast<double>(r.bitmap_allocations) / frames);
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
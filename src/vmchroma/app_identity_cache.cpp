@@ -0,0 +1,158 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "app_identity_cache.hpp"
+
+#include <shlwapi.h>
+#include <spdlog/spdlog.h>
+
+#include "utils.hpp"
+#include "winapi_hook_defs.hpp"
+
+app_identity_cache::~app_identity_cache()
+{
+    for (const auto& [pid, entry] : entries)
+        CloseHandle(entry.process);
+}
+
+/**
+ * Looks up the entry for a PID, a new entry is created on the first lookup
+ * Values that depend on the config are reset when the config generation changed
+ * @param pid The process id
+ * @param generation The current config generation
+ * @return The entry, nullptr if the process can't be queried
+ */
+app_identity_t* app_identity_cache::find_or_add(const DWORD pid, const uint64_t generation)
+{
+    auto it = entries.find(pid);
+
+    if (it == entries.end())
+    {
+        // only new processes can free up entries, so this is the only place where exited ones are pruned
+        prune_exited();
+
+        const auto process = o_OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, pid);
+
+        if (!process)
+        {
+            SPDLOG_ERROR("error OpenProcess for pid {}", pid);
+            return nullptr;
+        }
+
+        const auto image_path = utils::get_path_for_process(process);
+
+        if (!image_path)
+        {
+            CloseHandle(process);
+            return nullptr;
+        }
+
+        it = entries.emplace(pid, app_identity_t{process, *image_path, PathFindFileName(image_path->c_str()), generation, std::nullopt, false, std::nullopt}).first;
+    }
+
+    auto& entry = it->second;
+
+    if (entry.generation != generation)
+    {
+        entry.generation = generation;
+        entry.blacklisted.reset();
+        entry.display_name_resolved = false;
+        entry.display_name.reset();
+    }
+
+    return &entry;
+}
+
+/**
+ * Closes the handles of processes that have exited, so their PIDs can be reused
+ */
+void app_identity_cache::prune_exited()
+{
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (WaitForSingleObject(it->second.process, 0) == WAIT_OBJECT_0)
+        {
+            CloseHandle(it->second.process);
+            it = entries.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @param pid The process id of an audio session
+ * @param generation The current config generation
+ * @param blacklist_check Called with the image name on the first lookup per config generation
+ * @return True if the app is blacklisted, std::nullopt if the process can't be queried
+ */
+std::optional<bool> app_identity_cache::is_blacklisted(const DWORD pid, const uint64_t generation, const std::function<bool(const std::wstring&)>& blacklist_check)
+{
+    std::lock_guard lock(mtx);
+
+    const auto entry = find_or_add(pid, generation);
+
+    if (entry == nullptr)
+        return std::nullopt;
+
+    if (!entry->blacklisted)
+        entry->blacklisted = blacklist_check(entry->image_name);
+
+    return entry->blacklisted;
+}
+
+/**
+ * @param pid The process id
+ * @param generation The current config generation
+ * @return The product name of the executable, resolved once per config generation
+ */
+std::optional<std::wstring> app_identity_cache::get_display_name(const DWORD pid, const uint64_t generation)
+{
+    std::lock_guard lock(mtx);
+
+    const auto entry = find_or_add(pid, generation);
+
+    if (entry == nullptr)
+        return std::nullopt;
+
+    if (!entry->display_name_resolved)
+    {
+        entry->display_name = utils::get_exe_product_name(entry->image_path);
+        entry->display_name_resolved = true;
+    }
+
+    return entry->display_name;
+}
+
+/**
+ * Drops the entry of a process whose last audio session is gone
+ * @param pid The process id
+ */
+void app_identity_cache::evict(const DWORD pid)
+{
+    std::lock_guard lock(mtx);
+
+    const auto it = entries.find(pid);
+
+    if (it == entries.end())
+        return;
+
+    CloseHandle(it->second.process);
+    entries.erase(it);
+}
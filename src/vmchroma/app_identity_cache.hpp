@@ -0,0 +1,60 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+typedef struct app_identity
+{
+    HANDLE process;
+    std::wstring image_path;
+    std::wstring image_name;
+    // config generation blacklisted and display_name were resolved for
+    uint64_t generation;
+    std::optional<bool> blacklisted;
+    bool display_name_resolved;
+    // product name with the aliases of the config applied
+    std::optional<std::wstring> display_name;
+} app_identity_t;
+
+/**
+ * Caches what the audio session hooks need to know about a process, keyed by PID
+ * Every entry keeps a handle to its process open, which stops Windows from reusing the PID until the entry is pruned
+ */
+class app_identity_cache
+{
+    std::mutex mtx;
+    std::unordered_map<DWORD, app_identity_t> entries;
+
+    app_identity_t* find_or_add(DWORD pid, uint64_t generation);
+    void prune_exited();
+
+public:
+    app_identity_cache() = default;
+    ~app_identity_cache();
+    app_identity_cache(const app_identity_cache&) = delete;
+    app_identity_cache& operator=(const app_identity_cache&) = delete;
+    std::optional<bool> is_blacklisted(DWORD pid, uint64_t generation, const std::function<bool(const std::wstring&)>& blacklist_check);
+    std::optional<std::wstring> get_display_name(DWORD pid, uint64_t generation);
+    void evict(DWORD pid);
+};
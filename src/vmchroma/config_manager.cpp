@@ -17,11 +17,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "config_manager.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
+#include <memory>
 #include <fstream>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 
+#include "trace.hpp"
 #include "winapi_hook_defs.hpp"
 #include "window_manager.hpp"
 #include "yaml-cpp/yaml.h"
@@ -144,6 +148,100 @@ bool config_manager::reg_get_wnd_size(uint32_t& width, uint32_t& height)
     return true;
 }
 
+/**
+ * Saves the resolved scroll patch sites to the windows registry
+ * @param cache The patch sites and the executable they belong to
+ */
+void config_manager::reg_save_patch_cache(const patch_cache_t& cache)
+{
+    const auto sub_key = get_reg_sub_key();
+
+    if (!sub_key)
+    {
+        SPDLOG_ERROR("error getting current flavor");
+        return;
+    }
+
+    HKEY key;
+    auto result = RegCreateKeyExW(HKEY_CURRENT_USER, sub_key->c_str(), 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, nullptr, &key, nullptr);
+
+    if (result != ERROR_SUCCESS)
+    {
+        SPDLOG_ERROR("error open registry key");
+        return;
+    }
+
+    result = RegSetValueExW(key, reg_val_patch_cache.c_str(), 0, REG_BINARY, reinterpret_cast<const BYTE*>(&cache), sizeof(cache));
+
+    if (result != ERROR_SUCCESS)
+        SPDLOG_ERROR("error writing registry key");
+
+    RegCloseKey(key);
+}
+
+/**
+ * Queries the scroll patch sites of a previous start from the windows registry
+ * @param cache Target, has to be validated against the running executable
+ * @return True if a cache entry exists
+ */
+bool config_manager::reg_get_patch_cache(patch_cache_t& cache)
+{
+    const auto sub_key = get_reg_sub_key();
+
+    if (!sub_key)
+    {
+        SPDLOG_ERROR("error getting current flavor");
+        return false;
+    }
+
+    HKEY key;
+    auto result = RegOpenKeyExW(HKEY_CURRENT_USER, sub_key->c_str(), 0, KEY_READ, &key);
+
+    // key doesn't exist yet
+    if (result == ERROR_FILE_NOT_FOUND)
+        return false;
+
+    if (result != ERROR_SUCCESS)
+    {
+        SPDLOG_ERROR("Error opening registry key: {}", result);
+        return false;
+    }
+
+    DWORD data_size = sizeof(cache);
+    DWORD type;
+
+    result = RegQueryValueExW(key, reg_val_patch_cache.c_str(), nullptr, &type, reinterpret_cast<LPBYTE>(&cache), &data_size);
+    RegCloseKey(key);
+
+    // written by an older build with a different layout, a full scan replaces it
+    if (result != ERROR_SUCCESS || type != REG_BINARY || data_size != sizeof(cache))
+    {
+        cache = {};
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @return The registry key of the current flavor
+ */
+std::optional<std::wstring> config_manager::get_reg_sub_key()
+{
+    const auto cur_flavor = get_current_flavor_id();
+
+    if (cur_flavor == FLAVOR_POTATO)
+        return reg_sub_key_potato;
+
+    if (cur_flavor == FLAVOR_BANANA)
+        return reg_sub_key_banana;
+
+    if (cur_flavor == FLAVOR_DEFAULT)
+        return reg_sub_key_default;
+
+    return std::nullopt;
+}
+
 /**
  * Queries the current Voicemeeter version by reading the version info of the executable
  * @return The current Voicemeeter flavor
@@ -213,10 +311,37 @@ std::optional<flavor_id> config_manager::get_current_flavor_id()
 }
 
 /**
- * Loads the theme bitmap data from the theme directory
+ * Skips the detection from the version info, for processes that aren't Voicemeeter like the benchmarks
+ * Must be called before init_theme
+ * @param id The flavor to load the theme for
+ */
+void config_manager::set_current_flavor_id(const flavor_id id)
+{
+    current_flavor_id = id;
+}
+
+/**
+ * Loads the theme of the published state, only called on startup before the hooks are attached
  * @return True if loading was successful
  */
 bool config_manager::init_theme()
+{
+    const auto start = std::chrono::steady_clock::now();
+    const bool success = init_theme(current_state(), true);
+    const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    trace::theme_load(true, success, current_state().theme_pack_data.is_open(), duration.count());
+
+    return success;
+}
+
+/**
+ * Locates the theme bitmaps and loads the color tables from the theme directory
+ * @param s The state to load the theme into
+ * @param is_startup False on hot-reload, theme packs are only written on startup because the published state may still map them
+ * @return True if loading was successful
+ */
+bool config_manager::init_theme(config_state_t& s, const bool is_startup)
 {
     const auto flavor_id = get_current_flavor_id();
 
@@ -226,14 +351,15 @@ bool config_manager::init_theme()
         return false;
     }
 
-    active_flavor = flavor_map[*flavor_id];
+    if (is_startup)
+        active_flavor = flavor_map[*flavor_id];
 
     // no theme specified
-    const auto active_theme_name = get_value<YAML::NodeType::Scalar, std::string>("theme", active_flavor.name.c_str(), false);
+    const auto active_theme_name = get_value<YAML::NodeType::Scalar, std::string>(s.yaml_config, "theme", active_flavor.name.c_str(), false);
 
     if (!active_theme_name)
     {
-        theme_enabled = false;
+        s.theme_enabled = false;
         return true;
     }
 
@@ -256,6 +382,24 @@ bool config_manager::init_theme()
     auto userprofile_path = utils::get_userprofile_path();
 
     std::wstring theme_path = (std::filesystem::path(*userprofile_path) / L"themes" / *active_theme_name_wstr / *active_flavor_name);
+    std::wstring pack_path = (std::filesystem::path(*userprofile_path) / L"themes" / *active_theme_name_wstr / (*active_flavor_name + PACK_FILE_EXT));
+
+    s.theme_pack_data.close();
+    s.bg_main_bitmap.file.close();
+    s.bg_settings_bitmap.file.close();
+    s.bg_cassette_bitmap.file.close();
+
+    // themes can be shipped as a pack without the loose files
+    if (!std::filesystem::exists(std::filesystem::path(theme_path)) && std::filesystem::exists(std::filesystem::path(pack_path)))
+    {
+        if (!load_theme_pack(s, pack_path, std::nullopt))
+        {
+            SPDLOG_ERROR("error loading {}", utils::wstr_to_str_or_default(pack_path));
+            return false;
+        }
+
+        return true;
+    }
 
     if (!std::filesystem::exists(std::filesystem::path(theme_path)))
     {
@@ -269,35 +413,22 @@ bool config_manager::init_theme()
         return false;
     }
 
-    if (!utils::load_bitmap(std::filesystem::path(theme_path) / BM_FILE_BG, bg_main_bitmap_data))
-    {
-        SPDLOG_ERROR("error loading {}", utils::wstr_to_str_or_default(BM_FILE_BG));
-        return false;
-    }
-
     if (!std::filesystem::exists(std::filesystem::path(theme_path) / BM_FILE_BG_SETTINGS))
     {
         SPDLOG_ERROR("can't find {} in themes folder", utils::wstr_to_str_or_default(BM_FILE_BG_SETTINGS));
         return false;
     }
 
-    if (!utils::load_bitmap(std::filesystem::path(theme_path) / BM_FILE_BG_SETTINGS, bg_settings_bitmap_data))
-    {
-        SPDLOG_ERROR("error loading {}", utils::wstr_to_str_or_default(BM_FILE_BG_SETTINGS));
-        return false;
-    }
-
     if (!std::filesystem::exists(std::filesystem::path(theme_path) / BM_FILE_BG_CASSETTE))
     {
         SPDLOG_ERROR("can't find {} in themes folder", utils::wstr_to_str_or_default(BM_FILE_BG_CASSETTE));
         return false;
     }
 
-    if (!utils::load_bitmap(std::filesystem::path(theme_path) / BM_FILE_BG_CASSETTE, bg_cassette_bitmap_data))
-    {
-        SPDLOG_ERROR("error loading {}", utils::wstr_to_str_or_default(BM_FILE_BG_CASSETTE));
-        return false;
-    }
+    // the bitmaps are mapped on first use by hk_CreateDIBSection
+    s.bg_main_bitmap.path = std::filesystem::path(theme_path) / BM_FILE_BG;
+    s.bg_settings_bitmap.path = std::filesystem::path(theme_path) / BM_FILE_BG_SETTINGS;
+    s.bg_cassette_bitmap.path = std::filesystem::path(theme_path) / BM_FILE_BG_CASSETTE;
 
     if (!std::filesystem::exists(std::filesystem::path(*userprofile_path) / L"themes" / *active_theme_name_wstr / CONFIG_FILE_COLORS))
     {
@@ -305,6 +436,17 @@ bool config_manager::init_theme()
         return false;
     }
 
+    // unchanged themes are served from the pack built on a previous launch
+    const auto source_mtimes = get_source_mtimes({
+        s.bg_main_bitmap.path,
+        s.bg_settings_bitmap.path,
+        s.bg_cassette_bitmap.path,
+        std::filesystem::path(*userprofile_path) / L"themes" / *active_theme_name_wstr / CONFIG_FILE_COLORS
+    });
+
+    if (source_mtimes && std::filesystem::exists(std::filesystem::path(pack_path)) && load_theme_pack(s, pack_path, source_mtimes))
+        return true;
+
     std::ifstream colors_file(std::filesystem::path(*userprofile_path) / L"themes" / *active_theme_name_wstr / CONFIG_FILE_COLORS);
 
     if (!colors_file.is_open())
@@ -313,6 +455,8 @@ bool config_manager::init_theme()
         return false;
     }
 
+    YAML::Node yaml_colors;
+
     try
     {
         yaml_colors = YAML::Load(colors_file);
@@ -323,14 +467,200 @@ bool config_manager::init_theme()
         return false;
     }
 
+    build_color_table(yaml_colors["shapes"], s.color_table_shapes);
+    build_color_table(yaml_colors["text"], s.color_table_text);
+
+    if (source_mtimes && is_startup)
+        write_theme_pack(s, pack_path, *source_mtimes);
+
     return true;
 }
 
 /**
- * Loads the config file vmchroma.yaml
+ * Collects the modification times of the loose theme files, used as the cache key of the theme pack
+ * @param paths Source files in pack_source order
+ * @return The modification times, std::nullopt if any file can't be queried
+ */
+std::optional<theme_pack::source_mtimes_t> config_manager::get_source_mtimes(const std::array<std::wstring, PACK_SOURCE_COUNT>& paths)
+{
+    theme_pack::source_mtimes_t mtimes{};
+
+    for (uint32_t i = 0; i < PACK_SOURCE_COUNT; ++i)
+    {
+        std::error_code ec;
+        const auto mtime = std::filesystem::last_write_time(std::filesystem::path(paths[i]), ec);
+
+        if (ec)
+        {
+            SPDLOG_ERROR("can't get modification time of {}", utils::wstr_to_str_or_default(paths[i]));
+            return std::nullopt;
+        }
+
+        mtimes[i] = static_cast<uint64_t>(mtime.time_since_epoch().count());
+    }
+
+    return mtimes;
+}
+
+/**
+ * Maps a theme pack and takes the color tables from it, the bitmaps are served from the mapping
+ * @param s The state to load the pack into
+ * @param path Path to the .vmctheme file
+ * @param source_mtimes Modification times of the loose theme files, std::nullopt for standalone packs
+ * @return True if the pack was loaded
+ */
+bool config_manager::load_theme_pack(config_state_t& s, const std::wstring& path, const std::optional<theme_pack::source_mtimes_t>& source_mtimes)
+{
+    if (!s.theme_pack_data.open(path, active_flavor))
+        return false;
+
+    if (source_mtimes && !s.theme_pack_data.matches_sources(*source_mtimes))
+    {
+        SPDLOG_INFO("theme pack {} is outdated, rebuilding", utils::wstr_to_str_or_default(path));
+        s.theme_pack_data.close();
+        return false;
+    }
+
+    if (!s.theme_pack_data.get_color_table(PACK_SECTION_COLORS_SHAPES, s.color_table_shapes) ||
+        !s.theme_pack_data.get_color_table(PACK_SECTION_COLORS_TEXT, s.color_table_text))
+    {
+        s.theme_pack_data.close();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Builds the theme pack from the loose theme files loaded by init_theme, failures are not fatal
+ * @param s The state the loose theme files were loaded into
+ * @param path Path to the .vmctheme file
+ * @param source_mtimes Modification times of the loose theme files
+ */
+void config_manager::write_theme_pack(config_state_t& s, const std::wstring& path, const theme_pack::source_mtimes_t& source_mtimes)
+{
+    const std::array<byte_view_t, PACK_SECTION_COUNT> sections = {
+        map_theme_bitmap(s.bg_main_bitmap).bytes(),
+        map_theme_bitmap(s.bg_settings_bitmap).bytes(),
+        map_theme_bitmap(s.bg_cassette_bitmap).bytes(),
+        byte_view_t{reinterpret_cast<const uint8_t*>(s.color_table_shapes.data()), s.color_table_shapes.size() * sizeof(color_mapping_t)},
+        byte_view_t{reinterpret_cast<const uint8_t*>(s.color_table_text.data()), s.color_table_text.size() * sizeof(color_mapping_t)},
+    };
+
+    if (sections[PACK_SECTION_BG].data == nullptr || sections[PACK_SECTION_BG_SETTINGS].data == nullptr || sections[PACK_SECTION_BG_CASSETTE].data == nullptr)
+        SPDLOG_ERROR("can't build theme pack, loading bitmaps failed");
+    else if (theme_pack::write(path, active_flavor, source_mtimes, sections))
+        SPDLOG_INFO("wrote theme pack {}", utils::wstr_to_str_or_default(path));
+
+    // keep the lazy mapping for this session
+    s.bg_main_bitmap.file.close();
+    s.bg_settings_bitmap.file.close();
+    s.bg_cassette_bitmap.file.close();
+}
+
+/**
+ * Compiles a color category of the colors.yaml into a table sorted by the source color, so the GDI hooks can do a binary search
+ * Keys are matched on the 24-bit RGB value, entries with an empty value are skipped, the first entry wins on duplicates
+ * @param category_node Either the "shapes" or "text" node
+ * @param table Target table
+ */
+void config_manager::build_color_table(const YAML::Node& category_node, std::vector<color_mapping_t>& table) const
+{
+    table.clear();
+
+    if (!category_node.IsMap())
+        return;
+
+    for (auto it = category_node.begin(); it != category_node.end(); ++it)
+    {
+        std::string from_str, to_str;
+
+        try
+        {
+            from_str = it->first.as<std::string>();
+            to_str = it->second.IsNull() ? std::string() : it->second.as<std::string>();
+        }
+        catch (const YAML::Exception&)
+        {
+            SPDLOG_ERROR("invalid color entry in {}", utils::wstr_to_str_or_default(CONFIG_FILE_COLORS));
+            continue;
+        }
+
+        if (to_str.empty())
+            continue;
+
+        const auto from = utils::hex_to_colorref(from_str);
+        const auto to = utils::hex_to_colorref(to_str);
+
+        if (!from || !to)
+            continue;
+
+        table.push_back({*from, *to});
+    }
+
+    std::stable_sort(table.begin(), table.end(), [](const color_mapping_t& a, const color_mapping_t& b) { return a.from < b.from; });
+
+    const auto last = std::unique(table.begin(), table.end(), [](const color_mapping_t& a, const color_mapping_t& b) { return a.from == b.from; });
+    table.erase(last, table.end());
+    table.shrink_to_fit();
+}
+
+/**
+ * Converts the appBlacklist into a case-insensitive lookup table
+ * @param names The names from the config
+ * @param map Target map
+ */
+void config_manager::build_name_map(const std::optional<std::vector<std::string>>& names, utils::name_map& map)
+{
+    if (!names)
+        return;
+
+    for (const auto& name : *names)
+    {
+        if (const auto name_wstr = utils::str_to_wstr(name))
+            map.insert(*name_wstr);
+        else
+            SPDLOG_ERROR("failed to convert to wstr: {}", name);
+    }
+}
+
+/**
+ * Converts the appAliasMap into a case-insensitive lookup table
+ * @param names The names and their aliases from the config
+ * @param map Target map
+ */
+void config_manager::build_name_map(const std::optional<std::map<std::string, std::string>>& names, utils::name_map& map)
+{
+    if (!names)
+        return;
+
+    for (const auto& [k, v] : *names)
+    {
+        const auto k_wstr = utils::str_to_wstr(k);
+        const auto v_wstr = utils::str_to_wstr(v);
+
+        if (k_wstr && v_wstr)
+            map.insert(*k_wstr, *v_wstr);
+        else
+            SPDLOG_ERROR("failed to convert string to wstring: {}, {}", k, v);
+    }
+}
+
+/**
+ * Loads the config file vmchroma.yaml into the published state, only called on startup before the hooks are attached
  * @return True if loading was successful
  */
 bool config_manager::load_config()
+{
+    return load_config(current_state());
+}
+
+/**
+ * Loads the config file vmchroma.yaml
+ * @param s The state to load the config into
+ * @return True if loading was successful
+ */
+bool config_manager::load_config(config_state_t& s)
 {
     const auto userprofile_path = utils::get_userprofile_path();
 
@@ -356,7 +686,7 @@ bool config_manager::load_config()
 
     try
     {
-        yaml_config = YAML::Load(cfg_file);
+        s.yaml_config = YAML::Load(cfg_file);
     }
     catch (YAML::ParserException&)
     {
@@ -364,66 +694,265 @@ bool config_manager::load_config()
         return false;
     }
 
-    font_quality = get_value<YAML::NodeType::Scalar, uint32_t>("misc", "fontQuality", [](const uint32_t x) { return x <= 6; });
-    fader_shift_scroll_step = get_value<YAML::NodeType::Scalar, float>("misc", "faderShiftScrollStep");
-    fader_scroll_step = get_value<YAML::NodeType::Scalar, float>("misc", "faderScrollStep");
-    ui_update_interval = get_value<YAML::NodeType::Scalar, uint32_t>("misc", "updateIntervalUI", [](const uint32_t x) { return x >= 16; });
-    restore_size = get_value<YAML::NodeType::Scalar, bool>("misc", "restoreSize");
-    app_blacklist = get_value<YAML::NodeType::Sequence, std::vector<std::string>>("potato", "appBlacklist", false);
-    app_aliases = get_value<YAML::NodeType::Map, std::map<std::string, std::string>>("potato", "appAliasMap", false);
-    always_use_appname = get_value<YAML::NodeType::Scalar, bool>("potato", "alwaysUseAppName");
-    // include_system_session = get_value<YAML::NodeType::Scalar, bool>("potato", "includeSystemSoundSession");
+    s.font_quality = get_value<YAML::NodeType::Scalar, uint32_t>(s.yaml_config, "misc", "fontQuality", [](const uint32_t x) { return x <= 6; });
+    s.fader_shift_scroll_step = get_value<YAML::NodeType::Scalar, float>(s.yaml_config, "misc", "faderShiftScrollStep");
+    s.fader_scroll_step = get_value<YAML::NodeType::Scalar, float>(s.yaml_config, "misc", "faderScrollStep");
+    s.ui_update_interval = get_value<YAML::NodeType::Scalar, uint32_t>(s.yaml_config, "misc", "updateIntervalUI", [](const uint32_t x) { return x >= 16; });
+    s.adaptive_update_interval = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "adaptiveUpdateInterval", false);
+    s.restore_size = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "restoreSize");
+    s.dirty_rect_rendering = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "dirtyRectRendering", false);
+    s.gpu_background = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "gpuBackground", false);
+    s.gpu_palette = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "gpuPalette", false);
+    s.per_monitor_dpi = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "perMonitorDpi", false);
+    s.scaling_filter = get_value<YAML::NodeType::Scalar, std::string>(s.yaml_config, "misc", "scalingFilter", [](const std::string& x) { return x == "auto" || x == "nearest" || x == "linear" || x == "cubic"; }, false);
+    s.compositor_thread = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "compositorThread", false);
+    s.hot_reload = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "hotReload", false);
+    s.perf_counters = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "misc", "perfCounters", false);
+    s.record_frames = get_value<YAML::NodeType::Scalar, uint32_t>(s.yaml_config, "misc", "recordFrames", [](const uint32_t x) { return x <= 100000; }, false);
+    s.log_level = get_value<YAML::NodeType::Scalar, std::string>(s.yaml_config, "misc", "logLevel", [](const std::string& x) { return x == "off" || spdlog::level::from_str(x) != spdlog::level::off; }, false);
+    build_name_map(get_value<YAML::NodeType::Sequence, std::vector<std::string>>(s.yaml_config, "potato", "appBlacklist", false), s.app_blacklist);
+    build_name_map(get_value<YAML::NodeType::Map, std::map<std::string, std::string>>(s.yaml_config, "potato", "appAliasMap", false), s.app_aliases);
+    s.always_use_appname = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "potato", "alwaysUseAppName");
+    // s.include_system_session = get_value<YAML::NodeType::Scalar, bool>(s.yaml_config, "potato", "includeSystemSoundSession");
 
     return true;
 }
 
+config_manager::~config_manager()
+{
+    stop_watching();
+    delete pending_state.exchange(nullptr);
+}
+
 /**
- * Gets a color value from the yaml file in a case-insensitive way
- * @param arg_col The color value in upper case
- * @param category Can either be "shapes" or "text"
- * @return The mapped color value for the current theme
+ * Only for the UI thread, the state stays valid until the next publish which runs on the UI thread as well
+ * @return The published state
  */
-std::optional<std::string> config_manager::cfg_get_color(const std::string& arg_col, const color_category& category)
+config_state_t& config_manager::current_state() const
 {
-    YAML::Node category_node;
+    return *std::atomic_load_explicit(&state, std::memory_order_acquire);
+}
 
-    if (category == CATEGORY_SHAPES)
-        category_node = yaml_colors["shapes"];
+/**
+ * For readers on other threads, the state can't be freed by a publish while the reference is held
+ * @return A reference to the published state
+ */
+std::shared_ptr<const config_state_t> config_manager::load_state() const
+{
+    return std::atomic_load_explicit(&state, std::memory_order_acquire);
+}
 
-    if (category == CATEGORY_TEXT)
-        category_node = yaml_colors["text"];
+/**
+ * Starts watching vmchroma.yaml and the themes folder, changes are reloaded on the watcher thread
+ * @param notify_hwnd Window that receives WM_CONFIG_RELOADED once a new state is ready to be published
+ * @return True if the watcher is running
+ */
+bool config_manager::start_watching(HWND notify_hwnd)
+{
+    const auto userprofile_path = utils::get_userprofile_path();
 
-    for (auto it = category_node.begin(); it != category_node.end(); ++it)
+    if (!userprofile_path)
     {
-        auto current_color = it->first.as<std::string>();
+        SPDLOG_ERROR("can't get userprofile path");
+        return false;
+    }
 
-        if (lstrcmpiA(current_color.c_str(), arg_col.c_str()) == 0)
-        {
-            auto ret = it->second.as<std::string>();
+    reload_notify_hwnd = notify_hwnd;
 
-            if (ret.empty())
-                return std::nullopt;
+    return watcher.start(*userprofile_path, [this](const std::wstring& path) { return is_watched_file(path); }, [this] { reload(); });
+}
 
-            return ret;
-        }
+void config_manager::stop_watching()
+{
+    watcher.stop();
+}
+
+/**
+ * @param relative_path Path of a changed file, relative to the Voicemeeter documents folder
+ * @return True if the file is part of the config or of a theme
+ */
+bool config_manager::is_watched_file(const std::wstring& relative_path) const
+{
+    const std::filesystem::path path(relative_path);
+
+    if (lstrcmpiW(path.c_str(), CONFIG_FILE_THEME.c_str()) == 0)
+        return true;
+
+    // theme packs and their temporary files are written by vmchroma itself
+    const auto ext = path.extension().wstring();
+
+    return !path.empty() && lstrcmpiW(path.begin()->c_str(), L"themes") == 0 && (lstrcmpiW(ext.c_str(), L".yaml") == 0 || lstrcmpiW(ext.c_str(), L".bmp") == 0);
+}
+
+/**
+ * Builds a new state from the changed files, runs on the watcher thread
+ * The current state stays published if anything fails to load
+ */
+void config_manager::reload()
+{
+    auto next = std::make_unique<config_state_t>();
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool success = load_config(*next) && init_theme(*next, false);
+    const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    trace::theme_load(false, success, next->theme_pack_data.is_open(), duration.count());
+
+    if (!success)
+    {
+        SPDLOG_ERROR("reloading the config failed, keeping the current one");
+        return;
     }
 
-    return std::nullopt;
+    // the theme hooks are only attached on startup
+    if (next->theme_enabled != load_state()->theme_enabled)
+    {
+        SPDLOG_ERROR("enabling or disabling the theme requires a restart of Voicemeeter");
+        return;
+    }
+
+    // touch the bitmaps here, so the UI thread only has to copy them
+    if (next->theme_enabled && !next->theme_pack_data.is_open())
+    {
+        map_theme_bitmap(next->bg_main_bitmap);
+        map_theme_bitmap(next->bg_settings_bitmap);
+        map_theme_bitmap(next->bg_cassette_bitmap);
+    }
+
+    // a state that was never published can be freed right away
+    delete pending_state.exchange(next.release(), std::memory_order_acq_rel);
+
+    SPDLOG_INFO("config reloaded");
+    PostMessageW(reload_notify_hwnd, WM_CONFIG_RELOADED, 0, 0);
 }
 
-const std::vector<uint8_t>& config_manager::get_bm_data_main()
+/**
+ * Publishes the state built by the last reload, must be called on the UI thread
+ * @return True if a new state was published
+ */
+bool config_manager::publish_pending_state()
 {
-    return bg_main_bitmap_data;
+    const auto next = pending_state.exchange(nullptr, std::memory_order_acq_rel);
+
+    if (next == nullptr)
+        return false;
+
+    // hooks on other threads may still be reading the replaced state, the last of them frees it
+    std::atomic_store_explicit(&state, std::shared_ptr<config_state_t>(next), std::memory_order_release);
+    state_generation.fetch_add(1, std::memory_order_release);
+
+    return true;
 }
 
-const std::vector<uint8_t>& config_manager::get_bm_data_settings()
+/**
+ * @return Counter that changes with every published state, used to invalidate values derived from the config
+ */
+uint64_t config_manager::get_config_generation() const
 {
-    return bg_settings_bitmap_data;
+    return state_generation.load(std::memory_order_acquire);
 }
 
-const std::vector<uint8_t>& config_manager::get_bm_data_cassette()
+/**
+ * Looks up the theme color for a GDI color, without allocating
+ * @param color The original color
+ * @param category Either CATEGORY_SHAPES or CATEGORY_TEXT
+ * @return The mapped color value for the current theme
+ */
+std::optional<COLORREF> config_manager::cfg_get_color(const COLORREF color, const color_category category) const
 {
-    return bg_cassette_bitmap_data;
+    const auto& s = current_state();
+    const auto& table = category == CATEGORY_TEXT ? s.color_table_text : s.color_table_shapes;
+    const COLORREF key = color & 0x00FFFFFF;
+
+    const auto it = std::lower_bound(table.begin(), table.end(), key, [](const color_mapping_t& m, const COLORREF c) { return m.from < c; });
+
+    if (it == table.end() || it->from != key)
+        return std::nullopt;
+
+    return it->to;
+}
+
+/**
+ * @param category Either CATEGORY_SHAPES or CATEGORY_TEXT
+ * @return The remap table of the current theme, sorted by source color
+ */
+const std::vector<color_mapping_t>& config_manager::get_color_table(const color_category category) const
+{
+    const auto& s = current_state();
+
+    return category == CATEGORY_TEXT ? s.color_table_text : s.color_table_shapes;
+}
+
+/**
+ * Maps the theme bitmap on first use
+ * @param bitmap The theme bitmap
+ * @return The mapped bitmap file, not open if mapping failed
+ */
+const utils::mapped_file& config_manager::map_theme_bitmap(theme_bitmap_t& bitmap)
+{
+    if (!bitmap.file.is_open() && !bitmap.path.empty() && !utils::load_bitmap(bitmap.path, bitmap.file))
+    {
+        SPDLOG_ERROR("error loading {}", utils::wstr_to_str_or_default(bitmap.path));
+        // don't retry on every DIB section
+        bitmap.path.clear();
+    }
+
+    return bitmap.file;
+}
+
+byte_view_t config_manager::get_bm_data_main()
+{
+    auto& s = current_state();
+
+    if (s.theme_pack_data.is_open())
+        return s.theme_pack_data.get_section(PACK_SECTION_BG);
+
+    return map_theme_bitmap(s.bg_main_bitmap).bytes();
+}
+
+byte_view_t config_manager::get_bm_data_settings()
+{
+    auto& s = current_state();
+
+    if (s.theme_pack_data.is_open())
+        return s.theme_pack_data.get_section(PACK_SECTION_BG_SETTINGS);
+
+    return map_theme_bitmap(s.bg_settings_bitmap).bytes();
+}
+
+byte_view_t config_manager::get_bm_data_cassette()
+{
+    auto& s = current_state();
+
+    if (s.theme_pack_data.is_open())
+        return s.theme_pack_data.get_section(PACK_SECTION_BG_CASSETTE);
+
+    return map_theme_bitmap(s.bg_cassette_bitmap).bytes();
+}
+
+/**
+ * Unmaps the main background once it has been uploaded to the GPU
+ * A theme pack stays mapped as a whole, its untouched pages don't count towards the working set
+ */
+void config_manager::release_bm_data_main()
+{
+    auto& s = current_state();
+
+    s.bg_main_bitmap.file.close();
+    s.bg_main_bitmap.path.clear();
+}
+
+/**
+ * Unmaps the loose theme bitmaps once they have been copied, so image editors can replace them while Voicemeeter runs
+ * They are mapped again on the next use
+ */
+void config_manager::unmap_bitmaps()
+{
+    auto& s = current_state();
+
+    s.bg_main_bitmap.file.close();
+    s.bg_settings_bitmap.file.close();
+    s.bg_cassette_bitmap.file.close();
 }
 
 const flavor_info_t& config_manager::get_active_flavor()
@@ -433,45 +962,115 @@ const flavor_info_t& config_manager::get_active_flavor()
 
 const std::optional<uint32_t>& config_manager::get_font_quality()
 {
-    return font_quality;
+    return current_state().font_quality;
 }
 
 const std::optional<float>& config_manager::get_fader_shift_scroll_step()
 {
-    return fader_shift_scroll_step;
+    return current_state().fader_shift_scroll_step;
 }
 
 const std::optional<float>& config_manager::get_fader_scroll_step()
 {
-    return fader_scroll_step;
+    return current_state().fader_scroll_step;
 }
 
 const std::optional<uint32_t>& config_manager::get_ui_update_interval()
 {
-    return ui_update_interval;
+    return current_state().ui_update_interval;
+}
+
+const std::optional<bool>& config_manager::get_adaptive_update_interval()
+{
+    return current_state().adaptive_update_interval;
 }
 
 const std::optional<bool>& config_manager::get_restore_size()
 {
-    return restore_size;
+    return current_state().restore_size;
+}
+
+const std::optional<bool>& config_manager::get_dirty_rect_rendering()
+{
+    return current_state().dirty_rect_rendering;
+}
+
+const std::optional<bool>& config_manager::get_gpu_background()
+{
+    return current_state().gpu_background;
+}
+
+const std::optional<bool>& config_manager::get_gpu_palette()
+{
+    return current_state().gpu_palette;
+}
+
+const std::optional<bool>& config_manager::get_per_monitor_dpi()
+{
+    return current_state().per_monitor_dpi;
+}
+
+const std::optional<std::string>& config_manager::get_scaling_filter()
+{
+    return current_state().scaling_filter;
+}
+
+const std::optional<bool>& config_manager::get_compositor_thread()
+{
+    return current_state().compositor_thread;
+}
+
+const std::optional<bool>& config_manager::get_hot_reload()
+{
+    return current_state().hot_reload;
 }
 
-const std::optional<std::vector<std::string>>& config_manager::get_app_blacklist()
+const std::optional<bool>& config_manager::get_perf_counters()
 {
-    return app_blacklist;
+    return current_state().perf_counters;
 }
 
-const std::optional<std::map<std::string, std::string>>& config_manager::get_app_aliases()
+const std::optional<uint32_t>& config_manager::get_record_frames()
 {
-    return app_aliases;
+    return current_state().record_frames;
+}
+
+const std::optional<std::string>& config_manager::get_log_level()
+{
+    return current_state().log_level;
+}
+
+/**
+ * @param app_name File name of the executable, case-insensitive
+ * @return True if the app is on the appBlacklist
+ */
+bool config_manager::is_app_blacklisted(const std::wstring_view app_name) const
+{
+    return load_state()->app_blacklist.contains(app_name);
+}
+
+/**
+ * Called by the audio session hooks on any thread, so the alias is copied out of the state
+ * @param app_name File name of the executable, case-insensitive
+ * @return The alias from the appAliasMap, std::nullopt if there is none
+ */
+std::optional<std::wstring> config_manager::get_app_alias(const std::wstring_view app_name) const
+{
+    const auto s = load_state();
+    const auto alias = s->app_aliases.find(app_name);
+
+    if (alias == nullptr)
+        return std::nullopt;
+
+    return *alias;
 }
 
-const std::optional<bool>& config_manager::get_always_use_appname()
+std::optional<bool> config_manager::get_always_use_appname() const
 {
-    return always_use_appname;
+    return load_state()->always_use_appname;
 }
 
 bool config_manager::get_theme_enabled()
 {
-    return theme_enabled;
+    return current_state().theme_enabled;
 }
@@ -17,15 +17,65 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <memory>
 #include <string>
+#include "config_watcher.hpp"
+#include "theme_pack.hpp"
 #include "utils.hpp"
 #include "yaml-cpp/yaml.h"
 
+typedef struct theme_bitmap
+{
+    std::wstring path;
+    utils::mapped_file file;
+} theme_bitmap_t;
+
+/**
+ * Everything that is loaded from vmchroma.yaml and the theme folder
+ * Published as a whole, so a reload never exposes a half built state to the hooks
+ */
+typedef struct config_state
+{
+    YAML::Node yaml_config;
+    std::vector<color_mapping_t> color_table_shapes;
+    std::vector<color_mapping_t> color_table_text;
+    theme_bitmap_t bg_main_bitmap;
+    theme_bitmap_t bg_settings_bitmap;
+    theme_bitmap_t bg_cassette_bitmap;
+    theme_pack theme_pack_data;
+    bool theme_enabled = true;
+
+    std::optional<uint32_t> font_quality;
+    std::optional<float> fader_shift_scroll_step;
+    std::optional<float> fader_scroll_step;
+    std::optional<uint32_t> ui_update_interval;
+    std::optional<bool> adaptive_update_interval;
+    std::optional<bool> restore_size;
+    std::optional<bool> dirty_rect_rendering;
+    std::optional<bool> gpu_background;
+    std::optional<bool> gpu_palette;
+    std::optional<bool> per_monitor_dpi;
+    std::optional<std::string> scaling_filter;
+    std::optional<bool> compositor_thread;
+    std::optional<bool> hot_reload;
+    std::optional<bool> perf_counters;
+    std::optional<uint32_t> record_frames;
+    std::optional<std::string> log_level;
+    // built once on load, keyed by executable file name
+    utils::name_map app_blacklist;
+    utils::name_map app_aliases;
+    std::optional<bool> always_use_appname;
+    // std::optional<bool> include_system_session;
+} config_state_t;
+
 class config_manager
 {
     std::wstring BM_FILE_BG = L"bg.bmp";
     std::wstring BM_FILE_BG_SETTINGS = L"bg_settings.bmp";
     std::wstring BM_FILE_BG_CASSETTE = L"bg_cassette.bmp";
+    std::wstring PACK_FILE_EXT = L".vmctheme";
     std::wstring CONFIG_FILE_THEME = L"vmchroma.yaml";
     std::wstring CONFIG_FILE_COLORS = L"colors.yaml";
     std::wstring reg_sub_key_vmchroma = L"VB-Audio\\VMChroma";
@@ -34,6 +84,11 @@ class config_manager
     std::wstring reg_sub_key_potato = L"VB-Audio\\VMChroma\\Potato";
     std::wstring reg_val_wnd_size_width = L"window_size_width";
     std::wstring reg_val_wnd_size_height = L"window_size_height";
+#if defined(_WIN64)
+    std::wstring reg_val_patch_cache = L"patch_cache_x64";
+#else
+    std::wstring reg_val_patch_cache = L"patch_cache_x86";
+#endif
     flavor_id current_flavor_id = FLAVOR_NONE;
     flavor_info_t active_flavor = {};
     std::unordered_map<flavor_id, flavor_info_t> flavor_map =
@@ -42,26 +97,17 @@ class config_manager
         {FLAVOR_BANANA, {"banana", FLAVOR_BANANA, 1024, 550, 800, 305, 744}},
         {FLAVOR_POTATO, {"potato", FLAVOR_POTATO, 1645, 835, 1050, 340, 1045}},
     };
-    YAML::Node yaml_colors;
-    YAML::Node yaml_config;
-    std::vector<uint8_t> bg_main_bitmap_data;
-    std::vector<uint8_t> bg_settings_bitmap_data;
-    std::vector<uint8_t> bg_cassette_bitmap_data;
-    bool theme_enabled = true;
-
-    std::optional<uint32_t> font_quality;
-    std::optional<float> fader_shift_scroll_step;
-    std::optional<float> fader_scroll_step;
-    std::optional<uint32_t> ui_update_interval;
-    std::optional<bool> restore_size;
-    std::optional<std::vector<std::string>> app_blacklist;
-    std::optional<std::map<std::string, std::string>> app_aliases;
-    std::optional<bool> always_use_appname;
-    // std::optional<bool> include_system_session;
+    // read-copy-update: reloads build a new state on the watcher thread which is published on the UI thread
+    // other threads hold a reference while they read, the replaced state is freed once the last reader is done
+    std::shared_ptr<config_state_t> state = std::make_shared<config_state_t>();
+    std::atomic<config_state_t*> pending_state{nullptr};
+    std::atomic<uint64_t> state_generation{0};
+    config_watcher watcher;
+    HWND reload_notify_hwnd = nullptr;
 
 private:
     template <YAML::NodeType::value v, typename T, typename Validator>
-    std::optional<T> get_value(const char* category, const char* key, Validator validator, bool is_mandatory = true)
+    static std::optional<T> get_value(const YAML::Node& yaml_config, const char* category, const char* key, Validator validator, bool is_mandatory = true)
     {
         const auto node_val = yaml_config[category][key];
 
@@ -98,29 +144,71 @@ private:
     }
 
     template <YAML::NodeType::value v, typename T>
-    std::optional<T> get_value(const char* category, const char* key, bool is_mandatory = true)
+    static std::optional<T> get_value(const YAML::Node& yaml_config, const char* category, const char* key, bool is_mandatory = true)
     {
-        return get_value<v, T>(category, key, [](const T&) { return true; }, is_mandatory);
+        return get_value<v, T>(yaml_config, category, key, [](const T&) { return true; }, is_mandatory);
     }
 
+    config_state_t& current_state() const;
+    std::shared_ptr<const config_state_t> load_state() const;
+    bool load_config(config_state_t& s);
+    bool init_theme(config_state_t& s, bool is_startup);
+    void reload();
+    bool is_watched_file(const std::wstring& relative_path) const;
+    static const utils::mapped_file& map_theme_bitmap(theme_bitmap_t& bitmap);
+    static std::optional<theme_pack::source_mtimes_t> get_source_mtimes(const std::array<std::wstring, PACK_SOURCE_COUNT>& paths);
+    bool load_theme_pack(config_state_t& s, const std::wstring& path, const std::optional<theme_pack::source_mtimes_t>& source_mtimes);
+    void write_theme_pack(config_state_t& s, const std::wstring& path, const theme_pack::source_mtimes_t& source_mtimes);
+    void build_color_table(const YAML::Node& category_node, std::vector<color_mapping_t>& table) const;
+    static void build_name_map(const std::optional<std::vector<std::string>>& names, utils::name_map& map);
+    static void build_name_map(const std::optional<std::map<std::string, std::string>>& names, utils::name_map& map);
+    std::optional<std::wstring> get_reg_sub_key();
+
 public:
+    static constexpr UINT WM_CONFIG_RELOADED = WM_APP + 0x137;
+
+    config_manager() = default;
+    ~config_manager();
+    config_manager(const config_manager&) = delete;
+    config_manager& operator=(const config_manager&) = delete;
     bool get_theme_enabled();
     void reg_save_wnd_size(uint32_t width, uint32_t height);
     bool reg_get_wnd_size(uint32_t& width, uint32_t& height);
+    void reg_save_patch_cache(const patch_cache_t& cache);
+    bool reg_get_patch_cache(patch_cache_t& cache);
     std::optional<flavor_id> get_current_flavor_id();
+    void set_current_flavor_id(flavor_id id);
     bool init_theme();
     bool load_config();
+    bool start_watching(HWND notify_hwnd);
+    void stop_watching();
+    bool publish_pending_state();
+    uint64_t get_config_generation() const;
     const std::optional<uint32_t>& get_font_quality();
     const std::optional<float>& get_fader_shift_scroll_step();
     const std::optional<float>& get_fader_scroll_step();
     const std::optional<uint32_t>& get_ui_update_interval();
+    const std::optional<bool>& get_adaptive_update_interval();
     const std::optional<bool>& get_restore_size();
-    const std::optional<std::vector<std::string>>& get_app_blacklist();
-    const std::optional<std::map<std::string, std::string>>& get_app_aliases();
-    const std::optional<bool>& get_always_use_appname();
-    std::optional<std::string> cfg_get_color(const std::string& arg_col, const color_category& category);
-    const std::vector<uint8_t>& get_bm_data_main();
-    const std::vector<uint8_t>& get_bm_data_settings();
-    const std::vector<uint8_t>& get_bm_data_cassette();
+    const std::optional<bool>& get_dirty_rect_rendering();
+    const std::optional<bool>& get_gpu_background();
+    const std::optional<bool>& get_gpu_palette();
+    const std::optional<bool>& get_per_monitor_dpi();
+    const std::optional<std::string>& get_scaling_filter();
+    const std::optional<bool>& get_compositor_thread();
+    const std::optional<bool>& get_hot_reload();
+    const std::optional<bool>& get_perf_counters();
+    const std::optional<uint32_t>& get_record_frames();
+    const std::optional<std::string>& get_log_level();
+    bool is_app_blacklisted(std::wstring_view app_name) const;
+    std::optional<std::wstring> get_app_alias(std::wstring_view app_name) const;
+    std::optional<bool> get_always_use_appname() const;
+    std::optional<COLORREF> cfg_get_color(COLORREF color, color_category category) const;
+    const std::vector<color_mapping_t>& get_color_table(color_category category) const;
+    byte_view_t get_bm_data_main();
+    byte_view_t get_bm_data_settings();
+    byte_view_t get_bm_data_cassette();
+    void release_bm_data_main();
+    void unmap_bitmaps();
     const flavor_info_t& get_active_flavor();
 };
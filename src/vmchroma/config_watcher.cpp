@@ -0,0 +1,170 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config_watcher.hpp"
+
+#include <vector>
+#include <spdlog/spdlog.h>
+
+#include "utils.hpp"
+
+config_watcher::~config_watcher()
+{
+    stop();
+}
+
+/**
+ * Starts watching a directory and all of its subdirectories
+ * @param dir The directory to watch
+ * @param filter_fn Called with the path of every changed file relative to dir, returns true if the change is relevant
+ * @param on_change_fn Called on the watcher thread after a burst of relevant changes
+ * @return True if the watcher thread is running
+ */
+bool config_watcher::start(const std::wstring& dir, std::function<bool(const std::wstring&)> filter_fn, std::function<void()> on_change_fn)
+{
+    stop();
+
+    dir_handle = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+
+    if (dir_handle == INVALID_HANDLE_VALUE)
+    {
+        SPDLOG_ERROR("failed to open {} for watching, error {}", utils::wstr_to_str_or_default(dir), GetLastError());
+        return false;
+    }
+
+    stop_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+    if (stop_event == nullptr)
+    {
+        SPDLOG_ERROR("failed to create watcher stop event");
+        CloseHandle(dir_handle);
+        dir_handle = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    filter = std::move(filter_fn);
+    on_change = std::move(on_change_fn);
+    worker = std::thread(&config_watcher::run, this);
+
+    return true;
+}
+
+/**
+ * Stops the watcher thread and waits for a running on_change callback to finish
+ */
+void config_watcher::stop()
+{
+    if (worker.joinable())
+    {
+        SetEvent(stop_event);
+        worker.join();
+    }
+
+    if (stop_event != nullptr)
+        CloseHandle(stop_event);
+
+    if (dir_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(dir_handle);
+
+    stop_event = nullptr;
+    dir_handle = INVALID_HANDLE_VALUE;
+}
+
+void config_watcher::run()
+{
+    OVERLAPPED ov{};
+    ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+    if (ov.hEvent == nullptr)
+    {
+        SPDLOG_ERROR("failed to create watcher io event");
+        return;
+    }
+
+    // FILE_NOTIFY_INFORMATION entries are DWORD aligned
+    std::vector<DWORD> buffer(BUFFER_SIZE / sizeof(DWORD));
+    constexpr DWORD notify_filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+    bool read_pending = false;
+    bool change_pending = false;
+
+    for (;;)
+    {
+        if (!read_pending)
+        {
+            ResetEvent(ov.hEvent);
+
+            if (!ReadDirectoryChangesW(dir_handle, buffer.data(), BUFFER_SIZE, TRUE, notify_filter, nullptr, &ov, nullptr))
+            {
+                SPDLOG_ERROR("ReadDirectoryChangesW failed, error {}", GetLastError());
+                break;
+            }
+
+            read_pending = true;
+        }
+
+        const HANDLE handles[] = {stop_event, ov.hEvent};
+        const auto result = WaitForMultipleObjects(2, handles, FALSE, change_pending ? DEBOUNCE_MS : INFINITE);
+
+        if (result == WAIT_TIMEOUT)
+        {
+            change_pending = false;
+            on_change();
+            continue;
+        }
+
+        if (result != WAIT_OBJECT_0 + 1)
+            break;
+
+        DWORD bytes = 0;
+        read_pending = false;
+
+        if (!GetOverlappedResult(dir_handle, &ov, &bytes, FALSE))
+        {
+            SPDLOG_ERROR("watching the config directory failed, error {}", GetLastError());
+            break;
+        }
+
+        // the buffer overflowed, the changed files are unknown
+        if (bytes == 0)
+        {
+            change_pending = true;
+            continue;
+        }
+
+        auto entry = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(buffer.data());
+
+        for (;;)
+        {
+            if (filter(std::wstring(entry->FileName, entry->FileNameLength / sizeof(wchar_t))))
+                change_pending = true;
+
+            if (entry->NextEntryOffset == 0)
+                break;
+
+            entry = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(reinterpret_cast<const uint8_t*>(entry) + entry->NextEntryOffset);
+        }
+    }
+
+    if (read_pending)
+    {
+        DWORD bytes;
+        CancelIoEx(dir_handle, &ov);
+        GetOverlappedResult(dir_handle, &ov, &bytes, TRUE);
+    }
+
+    CloseHandle(ov.hEvent);
+}
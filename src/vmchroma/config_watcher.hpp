@@ -0,0 +1,49 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <functional>
+#include <string>
+#include <thread>
+
+/**
+ * Watches a directory tree on a background thread with ReadDirectoryChangesW
+ * Bursts of changes are debounced, on_change runs on the watcher thread once the directory has been quiet for DEBOUNCE_MS
+ */
+class config_watcher
+{
+    static constexpr DWORD DEBOUNCE_MS = 250;
+    static constexpr DWORD BUFFER_SIZE = 16 * 1024;
+
+    HANDLE dir_handle = INVALID_HANDLE_VALUE;
+    HANDLE stop_event = nullptr;
+    std::thread worker;
+    std::function<bool(const std::wstring&)> filter;
+    std::function<void()> on_change;
+
+    void run();
+
+public:
+    config_watcher() = default;
+    ~config_watcher();
+    config_watcher(const config_watcher&) = delete;
+    config_watcher& operator=(const config_watcher&) = delete;
+    bool start(const std::wstring& dir, std::function<bool(const std::wstring&)> filter_fn, std::function<void()> on_change_fn);
+    void stop();
+};
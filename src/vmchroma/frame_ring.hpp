@@ -0,0 +1,86 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Hands frames from one producer to one consumer through three slots without locking
+ * The producer always owns one slot and the consumer another, the third holds the latest finished frame
+ * Frames the consumer didn't pick up in time are replaced by newer ones, so it only ever sees the latest
+ */
+class frame_ring
+{
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    // index of the latest finished slot, FRESH until the consumer took it
+    std::atomic<uint8_t> ready{1};
+    uint8_t write = 0;
+    uint8_t read = 2;
+
+public:
+    static constexpr size_t SLOT_COUNT = 3;
+
+    /**
+     * @return The slot the producer draws into, only valid on the producer thread
+     */
+    uint8_t write_index() const
+    {
+        return write;
+    }
+
+    /**
+     * Makes the write slot the latest frame and takes back the previous one for drawing
+     */
+    void publish()
+    {
+        write = ready.exchange(write | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    /**
+     * @return True if a frame was published since the last acquire
+     */
+    bool has_fresh() const
+    {
+        return ready.load(std::memory_order_acquire) & FRESH;
+    }
+
+    /**
+     * Takes the latest frame, read_index refers to it afterwards
+     * @return True if there was a new frame
+     */
+    bool acquire()
+    {
+        if (!has_fresh())
+            return false;
+
+        read = ready.exchange(read, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    /**
+     * @return The slot the consumer reads from, only valid on the consumer thread
+     */
+    uint8_t read_index() const
+    {
+        return read;
+    }
+};
@@ -0,0 +1,419 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "frame_trace.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+
+#include "perf_stats.hpp"
+#include "winapi_hook_defs.hpp"
+
+frame_recorder::~frame_recorder()
+{
+    stop();
+}
+
+/**
+ * Opens the trace file and writes everything the frames are drawn with besides GDI
+ * @param path Path of the trace file, an existing file is replaced
+ * @param frame_count Number of frames after which the recording stops
+ * @param flavor The current flavor
+ * @param width Width of the GDI surface of the main window
+ * @param height Height of the GDI surface of the main window
+ * @param background The bitmap file of the GPU background, empty if the background is drawn by GDI
+ * @param shapes The shape colors of the GPU palette, empty if the colors are remapped by the GDI hooks
+ * @param text The text colors of the GPU palette
+ * @return True if the recording started
+ */
+bool frame_recorder::start(const std::wstring& path, const uint32_t frame_count, const flavor_id flavor, const uint32_t width, const uint32_t height, const byte_view_t& background, const std::vector<color_mapping_t>& shapes, const std::vector<color_mapping_t>& text)
+{
+    stop();
+
+    if (frame_count == 0 || width == 0 || height == 0)
+        return false;
+
+    header = {
+        FRAME_TRACE_MAGIC,
+        FRAME_TRACE_VERSION,
+        static_cast<uint32_t>(flavor),
+        width,
+        height,
+        0,
+        static_cast<uint32_t>(background.size),
+        static_cast<uint32_t>(shapes.size()),
+        static_cast<uint32_t>(text.size())
+    };
+
+    if (!init_capture())
+        return false;
+
+    file.open(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+    {
+        SPDLOG_ERROR("failed to open {} for the frame trace", utils::wstr_to_str_or_default(path));
+        release_capture();
+        return false;
+    }
+
+    constexpr uint8_t padding[3] = {};
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    if (background.size != 0)
+    {
+        file.write(reinterpret_cast<const char*>(background.data), static_cast<std::streamsize>(background.size));
+        file.write(reinterpret_cast<const char*>(padding), static_cast<std::streamsize>((4 - background.size % 4) % 4));
+    }
+
+    file.write(reinterpret_cast<const char*>(shapes.data()), static_cast<std::streamsize>(shapes.size() * sizeof(color_mapping_t)));
+    file.write(reinterpret_cast<const char*>(text.data()), static_cast<std::streamsize>(text.size() * sizeof(color_mapping_t)));
+
+    if (!file)
+    {
+        SPDLOG_ERROR("failed to write the frame trace header");
+        stop();
+        return false;
+    }
+
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    frequency = f.QuadPart;
+    frame_limit = frame_count;
+    first_frame = 0;
+
+    SPDLOG_INFO("recording {} frames of {}x{} to {}", frame_count, width, height, utils::wstr_to_str_or_default(path));
+
+    return true;
+}
+
+/**
+ * Ends the recording, the trace stays readable if this never runs but its header has no frame count then
+ */
+void frame_recorder::stop()
+{
+    if (file.is_open())
+    {
+        file.clear();
+        file.seekp(offsetof(frame_trace_header_t, frame_count));
+        file.write(reinterpret_cast<const char*>(&header.frame_count), sizeof(header.frame_count));
+        file.close();
+
+        SPDLOG_INFO("frame trace finished with {} frames", header.frame_count);
+    }
+
+    release_capture();
+    prev_pixels = {};
+    rects = {};
+}
+
+/**
+ * @return True until the requested number of frames has been recorded
+ */
+bool frame_recorder::is_recording() const
+{
+    return file.is_open();
+}
+
+/**
+ * Creates the top-down 32 bit DIB the GDI surface is copied into, the call bypasses the CreateDIBSection hook
+ * @return True on success
+ */
+bool frame_recorder::init_capture()
+{
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = static_cast<LONG>(header.width);
+    bmi.bmiHeader.biHeight = -static_cast<LONG>(header.height);
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void* bits = nullptr;
+    capture_dc = CreateCompatibleDC(nullptr);
+    capture_bitmap = capture_dc ? o_CreateDIBSection(capture_dc, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0) : nullptr;
+
+    if (capture_bitmap == nullptr || bits == nullptr)
+    {
+        SPDLOG_ERROR("failed to create the frame capture bitmap");
+        release_capture();
+        return false;
+    }
+
+    prev_bitmap = SelectObject(capture_dc, capture_bitmap);
+    capture_pixels = static_cast<const uint32_t*>(bits);
+
+    return true;
+}
+
+void frame_recorder::release_capture()
+{
+    if (capture_dc != nullptr && prev_bitmap != nullptr)
+        SelectObject(capture_dc, prev_bitmap);
+
+    if (capture_bitmap != nullptr)
+        o_DeleteObject(capture_bitmap);
+
+    if (capture_dc != nullptr)
+        DeleteDC(capture_dc);
+
+    capture_dc = nullptr;
+    capture_bitmap = nullptr;
+    prev_bitmap = nullptr;
+    capture_pixels = nullptr;
+}
+
+/**
+ * Records the current content of the GDI surface, GdiFlush must have been called before
+ * @param dc The memory DC of the main window
+ */
+void frame_recorder::capture(HDC dc)
+{
+    if (!file.is_open())
+        return;
+
+    if (!BitBlt(capture_dc, 0, 0, static_cast<int>(header.width), static_cast<int>(header.height), dc, 0, 0, SRCCOPY))
+    {
+        SPDLOG_ERROR("failed to capture a frame, recording stopped");
+        stop();
+        return;
+    }
+
+    GdiFlush();
+
+    const auto t = perf::now();
+
+    if (first_frame == 0)
+        first_frame = t;
+
+    find_changed_rects();
+    write_frame(static_cast<uint32_t>((t - first_frame) * 1000000 / frequency));
+
+    if (!file.is_open())
+        return;
+
+    prev_pixels.assign(capture_pixels, capture_pixels + static_cast<size_t>(header.width) * header.height);
+
+    if (++header.frame_count == frame_limit)
+        stop();
+}
+
+/**
+ * Groups consecutive changed rows into one rectangle each, spanning the changed columns of those rows
+ * The first frame is stored as a whole
+ */
+void frame_recorder::find_changed_rects()
+{
+    const uint32_t width = header.width;
+    const uint32_t height = header.height;
+
+    rects.clear();
+
+    if (prev_pixels.empty())
+    {
+        rects.push_back({0, 0, width, height});
+        return;
+    }
+
+    uint32_t y = 0;
+
+    while (y < height)
+    {
+        const auto row = capture_pixels + static_cast<size_t>(y) * width;
+        const auto prev_row = prev_pixels.data() + static_cast<size_t>(y) * width;
+
+        if (std::equal(row, row + width, prev_row))
+        {
+            ++y;
+            continue;
+        }
+
+        frame_trace_rect_t rect = {width, y, 0, 0};
+        uint32_t right = 0;
+
+        for (; y < height; ++y)
+        {
+            const auto cur = capture_pixels + static_cast<size_t>(y) * width;
+            const auto prev = prev_pixels.data() + static_cast<size_t>(y) * width;
+            const auto first = std::mismatch(cur, cur + width, prev).first;
+
+            if (first == cur + width)
+                break;
+
+            uint32_t last = width - 1;
+
+            while (cur[last] == prev[last])
+                --last;
+
+            rect.x = min(rect.x, static_cast<uint32_t>(first - cur));
+            right = max(right, last + 1);
+        }
+
+        rect.width = right - rect.x;
+        rect.height = y - rect.y;
+        rects.push_back(rect);
+    }
+}
+
+/**
+ * @param time_us Time since the first frame
+ */
+void frame_recorder::write_frame(const uint32_t time_us)
+{
+    const frame_trace_frame_t frame = {time_us, static_cast<uint32_t>(rects.size())};
+
+    file.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+
+    for (const auto& rect : rects)
+    {
+        file.write(reinterpret_cast<const char*>(&rect), sizeof(rect));
+
+        for (uint32_t y = rect.y; y < rect.y + rect.height; ++y)
+            file.write(reinterpret_cast<const char*>(capture_pixels + static_cast<size_t>(y) * header.width + rect.x), static_cast<std::streamsize>(rect.width * sizeof(uint32_t)));
+    }
+
+    if (!file)
+    {
+        SPDLOG_ERROR("failed to write the frame trace, recording stopped");
+        stop();
+    }
+}
+
+/**
+ * Maps a trace and indexes its frames, a frame that was cut off at the end of the file is dropped
+ * @param path Path of the trace file
+ * @return True if the trace is valid
+ */
+bool frame_trace::open(const std::wstring& path)
+{
+    if (!file.open(path))
+        return false;
+
+    const auto data = file.data();
+    const auto size = file.size();
+    size_t offset = 0;
+
+    const auto read = [&](void* out, const size_t count)
+    {
+        if (count > size - offset)
+            return false;
+
+        std::memcpy(out, data + offset, count);
+        offset += count;
+        return true;
+    };
+
+    if (!read(&header, sizeof(header)) || header.magic != FRAME_TRACE_MAGIC || header.version != FRAME_TRACE_VERSION || header.width == 0 || header.height == 0)
+    {
+        SPDLOG_ERROR("{} is not a frame trace of version {}", utils::wstr_to_str_or_default(path), FRAME_TRACE_VERSION);
+        return false;
+    }
+
+    const size_t background_padded = (static_cast<size_t>(header.background_size) + 3) & ~static_cast<size_t>(3);
+    const size_t palette_size = (static_cast<size_t>(header.palette_shapes_count) + header.palette_text_count) * sizeof(color_mapping_t);
+
+    if (background_padded + palette_size > size - offset)
+    {
+        SPDLOG_ERROR("frame trace header is truncated");
+        return false;
+    }
+
+    if (header.background_size != 0)
+        background = {data + offset, header.background_size};
+
+    offset += background_padded;
+
+    palette_shapes.resize(header.palette_shapes_count);
+    palette_text.resize(header.palette_text_count);
+    read(palette_shapes.data(), palette_shapes.size() * sizeof(color_mapping_t));
+    read(palette_text.data(), palette_text.size() * sizeof(color_mapping_t));
+
+    frames.clear();
+
+    while (offset < size)
+    {
+        frame_trace_frame_t frame;
+        frame_trace_entry_t entry;
+
+        // every rectangle covers at least one row of its own
+        if (!read(&frame, sizeof(frame)) || frame.rect_count > header.height)
+            break;
+
+        entry.time_us = frame.time_us;
+        entry.deltas.reserve(frame.rect_count);
+
+        for (uint32_t i = 0; i < frame.rect_count; ++i)
+        {
+            frame_trace_rect_t rect;
+
+            if (!read(&rect, sizeof(rect)) || rect.x > header.width || rect.width > header.width - rect.x || rect.y > header.height || rect.height > header.height - rect.y)
+                break;
+
+            const size_t pixel_size = static_cast<size_t>(rect.width) * rect.height * sizeof(uint32_t);
+
+            if (pixel_size > size - offset)
+                break;
+
+            entry.deltas.push_back({rect, reinterpret_cast<const uint32_t*>(data + offset)});
+            offset += pixel_size;
+        }
+
+        if (entry.deltas.size() != frame.rect_count)
+            break;
+
+        frames.push_back(std::move(entry));
+    }
+
+    if (offset < size || (header.frame_count != 0 && frames.size() != header.frame_count))
+        SPDLOG_WARN("frame trace is incomplete, {} frames could be read", frames.size());
+
+    return true;
+}
+
+const frame_trace_header_t& frame_trace::get_header() const
+{
+    return header;
+}
+
+/**
+ * @return The bitmap file of the GPU background, empty if the trace was recorded without gpuBackground
+ */
+const byte_view_t& frame_trace::get_background() const
+{
+    return background;
+}
+
+/**
+ * @param category Either CATEGORY_SHAPES or CATEGORY_TEXT
+ * @return The GPU palette, empty if the trace was recorded without gpuPalette
+ */
+const std::vector<color_mapping_t>& frame_trace::get_palette(const color_category category) const
+{
+    return category == CATEGORY_TEXT ? palette_text : palette_shapes;
+}
+
+/**
+ * @return The frames in the order they were recorded
+ */
+const std::vector<frame_trace_entry_t>& frame_trace::get_frames() const
+{
+    return frames;
+}
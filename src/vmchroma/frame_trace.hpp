@@ -0,0 +1,135 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+// "VMCT"
+constexpr uint32_t FRAME_TRACE_MAGIC = 0x54434D56;
+constexpr uint32_t FRAME_TRACE_VERSION = 1;
+
+/**
+ * Layout of a trace file, all fields are little endian and every block starts 4 byte aligned:
+ * header, background bitmap file padded to 4 bytes, shape colors, text colors, then per frame a frame_trace_frame_t
+ * followed by its rectangles, each a frame_trace_rect_t followed by width * height top-down BGRA pixels
+ */
+typedef struct frame_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flavor;
+    uint32_t width;
+    uint32_t height;
+    // written when the recording stops
+    uint32_t frame_count;
+    // bitmap file of the GPU background, 0 if it is drawn by GDI
+    uint32_t background_size;
+    // color_mapping_t entries of the GPU palette, 0 if the colors are remapped by the GDI hooks
+    uint32_t palette_shapes_count;
+    uint32_t palette_text_count;
+} frame_trace_header_t;
+
+typedef struct frame_trace_frame
+{
+    // since the first frame of the trace
+    uint32_t time_us;
+    uint32_t rect_count;
+} frame_trace_frame_t;
+
+typedef struct frame_trace_rect
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} frame_trace_rect_t;
+
+typedef struct frame_trace_delta
+{
+    frame_trace_rect_t rect;
+    // points into the mapped trace
+    const uint32_t* pixels;
+} frame_trace_delta_t;
+
+typedef struct frame_trace_entry
+{
+    uint32_t time_us;
+    std::vector<frame_trace_delta_t> deltas;
+} frame_trace_entry_t;
+
+/**
+ * Records what GDI drew into the main window for a number of frames, every frame only stores the rows that changed since the previous one
+ * Runs on the UI thread right before a frame is handed to Direct2D
+ */
+class frame_recorder
+{
+    std::ofstream file;
+    frame_trace_header_t header{};
+    uint32_t frame_limit = 0;
+    int64_t first_frame = 0;
+    int64_t frequency = 1;
+    HDC capture_dc = nullptr;
+    HBITMAP capture_bitmap = nullptr;
+    HGDIOBJ prev_bitmap = nullptr;
+    const uint32_t* capture_pixels = nullptr;
+    std::vector<uint32_t> prev_pixels;
+    std::vector<frame_trace_rect_t> rects;
+
+    bool init_capture();
+    void release_capture();
+    void find_changed_rects();
+    void write_frame(uint32_t time_us);
+
+public:
+    frame_recorder() = default;
+    ~frame_recorder();
+    frame_recorder(const frame_recorder&) = delete;
+    frame_recorder& operator=(const frame_recorder&) = delete;
+    bool start(const std::wstring& path, uint32_t frame_count, flavor_id flavor, uint32_t width, uint32_t height, const byte_view_t& background, const std::vector<color_mapping_t>& shapes, const std::vector<color_mapping_t>& text);
+    void stop();
+    void capture(HDC dc);
+    bool is_recording() const;
+};
+
+/**
+ * A trace written by frame_recorder, mapped read-only
+ */
+class frame_trace
+{
+    utils::mapped_file file;
+    frame_trace_header_t header{};
+    byte_view_t background{};
+    std::vector<color_mapping_t> palette_shapes;
+    std::vector<color_mapping_t> palette_text;
+    std::vector<frame_trace_entry_t> frames;
+
+public:
+    frame_trace() = default;
+    frame_trace(const frame_trace&) = delete;
+    frame_trace& operator=(const frame_trace&) = delete;
+    bool open(const std::wstring& path);
+    const frame_trace_header_t& get_header() const;
+    const byte_view_t& get_background() const;
+    const std::vector<color_mapping_t>& get_palette(color_category category) const;
+    const std::vector<frame_trace_entry_t>& get_frames() const;
+};
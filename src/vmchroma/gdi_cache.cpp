@@ -0,0 +1,166 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gdi_cache.hpp"
+
+#include <cstring>
+
+#include "perf_stats.hpp"
+#include "winapi_hook_defs.hpp"
+
+bool font_key::operator==(const font_key& other) const
+{
+    return memcmp(&lf, &other.lf, sizeof(lf)) == 0;
+}
+
+bool pen_key::operator==(const pen_key& other) const
+{
+    return style == other.style && width == other.width && color == other.color;
+}
+
+bool brush_key::operator==(const brush_key& other) const
+{
+    return style == other.style && color == other.color && hatch == other.hatch;
+}
+
+gdi_cache::~gdi_cache()
+{
+    for (const auto& [obj, count] : refs)
+        o_DeleteObject(obj);
+}
+
+/**
+ * @param lf The font with all changes of the hooks applied
+ * @return A shared font, every call adds a reference that DeleteObject releases
+ */
+HFONT gdi_cache::get_font(const LOGFONTA& lf)
+{
+    font_key_t key;
+    key.lf = lf;
+
+    const size_t face_len = strnlen(key.lf.lfFaceName, LF_FACESIZE);
+    memset(key.lf.lfFaceName + face_len, 0, LF_FACESIZE - face_len);
+
+    return get_shared(fonts, key, [&key] { return o_CreateFontIndirectA(&key.lf); });
+}
+
+/**
+ * @param style The pen style
+ * @param width The pen width
+ * @param color The remapped color
+ * @return A shared pen, every call adds a reference that DeleteObject releases
+ */
+HPEN gdi_cache::get_pen(const int style, const int width, const COLORREF color)
+{
+    return get_shared(pens, pen_key_t{style, width, color}, [=] { return o_CreatePen(style, width, color); });
+}
+
+/**
+ * Pattern brushes reference a bitmap or packed DIB that may change, only solid, hollow and hatched brushes are shared
+ * @param lb The brush with the remapped color
+ * @return A shared brush, every call adds a reference that DeleteObject releases
+ */
+HBRUSH gdi_cache::get_brush(const LOGBRUSH& lb)
+{
+    if (lb.lbStyle != BS_SOLID && lb.lbStyle != BS_HOLLOW && lb.lbStyle != BS_HATCHED)
+        return o_CreateBrushIndirect(&lb);
+
+    // hollow brushes ignore the color and solid brushes the hatch
+    const brush_key_t key = {
+        lb.lbStyle,
+        lb.lbStyle == BS_HOLLOW ? 0 : lb.lbColor,
+        lb.lbStyle == BS_HATCHED ? lb.lbHatch : 0
+    };
+
+    return get_shared(brushes, key, [&lb] { return o_CreateBrushIndirect(&lb); });
+}
+
+/**
+ * Called by the DeleteObject hook for every object
+ * @param obj The object Voicemeeter deletes
+ * @return True if the object is cached, it must not be deleted then
+ */
+bool gdi_cache::release(HGDIOBJ obj)
+{
+    std::lock_guard lock(mtx);
+
+    const auto it = refs.find(obj);
+
+    if (it == refs.end())
+        return false;
+
+    if (it->second > 0)
+        --it->second;
+
+    return true;
+}
+
+/**
+ * Looks up an equal object or creates it
+ * @param objects The cache of the kind of object
+ * @param key The values the object is created with
+ * @param create Creates the object with the original GDI function
+ * @return The shared object, an unshared one if the cache is full of referenced objects
+ */
+template <typename Key, typename Handle, typename Create>
+Handle gdi_cache::get_shared(std::unordered_map<Key, Handle, gdi_key_hash>& objects, const Key& key, Create create)
+{
+    std::lock_guard lock(mtx);
+
+    if (const auto it = objects.find(key); it != objects.end())
+    {
+        perf::count(PERF_GDI_CACHE_HIT);
+        ++refs[it->second];
+        return it->second;
+    }
+
+    perf::count(PERF_GDI_CACHE_MISS);
+
+    if (objects.size() >= MAX_OBJECTS)
+        evict_unreferenced(objects);
+
+    const Handle obj = create();
+
+    // a full cache only stops sharing, the object still belongs to the caller
+    if (obj == nullptr || objects.size() >= MAX_OBJECTS)
+        return obj;
+
+    objects.emplace(key, obj);
+    refs.emplace(obj, 1);
+
+    return obj;
+}
+
+template <typename Key, typename Handle>
+void gdi_cache::evict_unreferenced(std::unordered_map<Key, Handle, gdi_key_hash>& objects)
+{
+    for (auto it = objects.begin(); it != objects.end();)
+    {
+        const auto ref_it = refs.find(it->second);
+
+        if (ref_it != refs.end() && ref_it->second == 0)
+        {
+            o_DeleteObject(it->second);
+            refs.erase(ref_it);
+            it = objects.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+typedef struct font_key
+{
+    // the face name is zeroed after its terminator, so the whole struct can be compared and hashed
+    LOGFONTA lf;
+
+    bool operator==(const font_key& other) const;
+} font_key_t;
+
+typedef struct pen_key
+{
+    int style;
+    int width;
+    COLORREF color;
+
+    bool operator==(const pen_key& other) const;
+} pen_key_t;
+
+typedef struct brush_key
+{
+    UINT style;
+    COLORREF color;
+    ULONG_PTR hatch;
+
+    bool operator==(const brush_key& other) const;
+} brush_key_t;
+
+/**
+ * Hashes the bytes of a key, keys must not contain padding
+ */
+struct gdi_key_hash
+{
+    template <typename T>
+    size_t operator()(const T& key) const
+    {
+        return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(&key), sizeof(T)));
+    }
+};
+
+/**
+ * Shares GDI objects between the callers that create equal ones, Voicemeeter creates the same fonts, pens and brushes
+ * again whenever it redraws dialogs and strips
+ * Cached handles are reference counted, DeleteObject only releases a reference and the object lives on for the next caller
+ * Unreferenced objects are deleted once the cache of their kind is full
+ */
+class gdi_cache
+{
+    static constexpr size_t MAX_OBJECTS = 256;
+
+    std::mutex mtx;
+    std::unordered_map<font_key_t, HFONT, gdi_key_hash> fonts;
+    std::unordered_map<pen_key_t, HPEN, gdi_key_hash> pens;
+    std::unordered_map<brush_key_t, HBRUSH, gdi_key_hash> brushes;
+    // references of every cached handle
+    std::unordered_map<HGDIOBJ, uint32_t> refs;
+
+    template <typename Key, typename Handle, typename Create>
+    Handle get_shared(std::unordered_map<Key, Handle, gdi_key_hash>& objects, const Key& key, Create create);
+    template <typename Key, typename Handle>
+    void evict_unreferenced(std::unordered_map<Key, Handle, gdi_key_hash>& objects);
+
+public:
+    gdi_cache() = default;
+    ~gdi_cache();
+    gdi_cache(const gdi_cache&) = delete;
+    gdi_cache& operator=(const gdi_cache&) = delete;
+    HFONT get_font(const LOGFONTA& lf);
+    HPEN get_pen(int style, int width, COLORREF color);
+    HBRUSH get_brush(const LOGBRUSH& lb);
+    bool release(HGDIOBJ obj);
+};
@@ -0,0 +1,97 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "hook_registry.hpp"
+
+#include <detours.h>
+#include <spdlog/spdlog.h>
+
+/**
+ * Registers hooks for a phase that hasn't been installed yet
+ * @param phase The phase the hooks are needed in
+ * @param hooks Pairs of the original function pointer and the hook
+ */
+void hook_registry::add(const hook_phase phase, const std::vector<hook_entry_t>& hooks)
+{
+    std::lock_guard lock(mtx);
+    phases[phase].insert(phases[phase].end(), hooks.begin(), hooks.end());
+}
+
+/**
+ * Attaches all hooks of a phase in one transaction, only the first call per phase does anything
+ * @param phase The phase to install
+ * @param resolve_late Called under the registry lock before the transaction, returns hooks whose targets are only known now (e.g. vtable entries)
+ * @return True if the phase is installed
+ */
+bool hook_registry::install(const hook_phase phase, const std::function<std::vector<hook_entry_t>()>& resolve_late)
+{
+    std::lock_guard lock(mtx);
+
+    if (installed[phase])
+        return true;
+
+    // a failed phase isn't retried, the hooked code paths are hit far too often for that
+    installed[phase] = true;
+
+    auto& hooks = phases[phase];
+
+    if (resolve_late)
+    {
+        const auto late = resolve_late();
+        hooks.insert(hooks.end(), late.begin(), late.end());
+    }
+
+    if (DetourTransactionBegin() != NO_ERROR)
+    {
+        SPDLOG_ERROR("DetourTransactionBegin failed");
+        return false;
+    }
+
+    if (DetourUpdateThread(GetCurrentThread()) != NO_ERROR)
+    {
+        SPDLOG_ERROR("DetourUpdateThread failed");
+        DetourTransactionAbort();
+        return false;
+    }
+
+    for (const auto& [original, hook] : hooks)
+    {
+        if (*original != nullptr && DetourAttach(original, hook) != NO_ERROR)
+        {
+            SPDLOG_ERROR("unable to hook functions of phase {}", static_cast<int>(phase));
+            DetourTransactionAbort();
+            return false;
+        }
+    }
+
+    if (DetourTransactionCommit() != NO_ERROR)
+    {
+        SPDLOG_ERROR("DetourTransactionCommit failed");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @param phase The phase to check
+ * @return True once the phase was attempted, lock free so it can be checked from the hooks
+ */
+bool hook_registry::is_installed(const hook_phase phase) const
+{
+    return installed[phase];
+}
@@ -0,0 +1,58 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+enum hook_phase
+{
+    // attached from hk_CreateMutexA, early in WinMain
+    HOOK_PHASE_STARTUP,
+    // attached when the main window class is registered
+    HOOK_PHASE_FIRST_WINDOW,
+    // attached on the first session Voicemeeter enumerates
+    HOOK_PHASE_FIRST_SESSION,
+    HOOK_PHASE_COUNT
+};
+
+typedef struct hook_entry
+{
+    PVOID* original;
+    PVOID hook;
+} hook_entry_t;
+
+/**
+ * Collects the Detours hooks by the phase they are needed in, every phase is attached in a single transaction
+ * Hooks are only attached once the code they change can actually run, which keeps the startup transaction small
+ */
+class hook_registry
+{
+    std::mutex mtx;
+    std::array<std::vector<hook_entry_t>, HOOK_PHASE_COUNT> phases;
+    std::array<std::atomic<bool>, HOOK_PHASE_COUNT> installed{};
+
+public:
+    void add(hook_phase phase, const std::vector<hook_entry_t>& hooks);
+    bool install(hook_phase phase, const std::function<std::vector<hook_entry_t>()>& resolve_late = nullptr);
+    bool is_installed(hook_phase phase) const;
+};
@@ -0,0 +1,327 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "palette_effect.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <d3dcompiler.h>
+#include <spdlog/spdlog.h>
+
+// {4a71a3b7-236c-430c-b873-0da68074bda1}
+static constexpr GUID GUID_PaletteShader = {0x4a71a3b7, 0x236c, 0x430c, {0xb8, 0x73, 0x0d, 0xa6, 0x80, 0x74, 0xbd, 0xa1}};
+
+typedef struct palette_constants
+{
+    uint32_t count;
+    uint32_t padding[3];
+    // pairs of source and target color, sorted by source color
+    uint32_t entries[palette_effect::MAX_ENTRIES * 2];
+} palette_constants_t;
+
+// the mapping is searched with a binary search, colors are compared in the COLORREF layout
+static constexpr char PALETTE_SHADER[] = R"(
+Texture2D InputTexture : register(t0);
+SamplerState InputSampler : register(s0);
+
+cbuffer constants : register(b0)
+{
+    uint count;
+    uint3 padding;
+    uint4 table[256];
+};
+
+uint2 get_entry(uint i)
+{
+    const uint4 v = table[i >> 1];
+    return (i & 1) ? v.zw : v.xy;
+}
+
+float4 main(float4 pos : SV_POSITION, float4 scene_pos : SCENE_POSITION, float4 uv : TEXCOORD0) : SV_Target
+{
+    const float4 color = InputTexture.Sample(InputSampler, uv.xy);
+    const uint3 c = (uint3)round(saturate(color.rgb) * 255.0f);
+    const uint key = c.r | (c.g << 8) | (c.b << 16);
+
+    uint lo = 0;
+    uint hi = count;
+
+    [loop]
+    while (lo < hi)
+    {
+        const uint mid = (lo + hi) >> 1;
+
+        if (get_entry(mid).x < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < count)
+    {
+        const uint2 entry = get_entry(lo);
+
+        if (entry.x == key)
+            return float4((entry.y & 0xFF) / 255.0f, ((entry.y >> 8) & 0xFF) / 255.0f, ((entry.y >> 16) & 0xFF) / 255.0f, color.a);
+    }
+
+    return color;
+}
+)";
+
+static constexpr wchar_t PALETTE_EFFECT_XML[] = LR"(<?xml version='1.0'?>
+<Effect>
+    <Property name='DisplayName' type='string' value='VMChroma Palette'/>
+    <Property name='Author' type='string' value='vmchroma'/>
+    <Property name='Category' type='string' value='Color'/>
+    <Property name='Description' type='string' value='Replaces exact colors with the colors of a palette'/>
+    <Inputs>
+        <Input name='Source'/>
+    </Inputs>
+    <Property name='Table' type='blob'>
+        <Property name='DisplayName' type='string' value='Table'/>
+    </Property>
+</Effect>
+)";
+
+// compiled once on registration, loaded into every effect context
+static winrt::com_ptr<ID3DBlob> shader_blob;
+
+palette_effect::palette_effect() : table(sizeof(palette_constants_t))
+{
+}
+
+/**
+ * Compiles the pixel shader and registers the effect with the factory, the effect can be created with CLSID_VMChromaPalette afterwards
+ * @param factory The factory the device contexts are created from
+ * @return True on success
+ */
+bool palette_effect::register_effect(ID2D1Factory1* factory)
+{
+    if (!shader_blob)
+    {
+        winrt::com_ptr<ID3DBlob> errors;
+        const auto hr = D3DCompile(PALETTE_SHADER, sizeof(PALETTE_SHADER) - 1, "palette", nullptr, nullptr, "main", "ps_4_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, shader_blob.put(), errors.put());
+
+        if (FAILED(hr))
+        {
+            SPDLOG_ERROR("failed to compile palette shader: {}, {}", static_cast<uint32_t>(hr), errors ? static_cast<const char*>(errors->GetBufferPointer()) : "");
+            shader_blob = nullptr;
+            return false;
+        }
+    }
+
+    const D2D1_PROPERTY_BINDING bindings[] = {
+        {L"Table", set_table, get_table},
+    };
+
+    const auto hr = factory->RegisterEffectFromString(CLSID_VMChromaPalette, PALETTE_EFFECT_XML, bindings, ARRAYSIZE(bindings), create);
+
+    if (FAILED(hr))
+    {
+        SPDLOG_ERROR("failed to register palette effect: {}", static_cast<uint32_t>(hr));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Merges the color tables into the constant buffer of the pixel shader
+ * The GPU can't tell shapes from text, if a color is mapped in both tables the shapes mapping wins
+ * @param shapes The shapes table, sorted by source color
+ * @param text The text table, sorted by source color
+ * @param reserved A color that must not be remapped, e.g. the background key
+ * @return The value for PALETTE_PROP_TABLE
+ */
+std::vector<uint8_t> palette_effect::build_table(const std::vector<color_mapping_t>& shapes, const std::vector<color_mapping_t>& text, const COLORREF reserved)
+{
+    std::vector<color_mapping_t> merged;
+    merged.reserve(shapes.size() + text.size());
+
+    std::set_union(shapes.begin(), shapes.end(), text.begin(), text.end(), std::back_inserter(merged), [](const color_mapping_t& a, const color_mapping_t& b) { return a.from < b.from; });
+
+    merged.erase(std::remove_if(merged.begin(), merged.end(), [reserved](const color_mapping_t& m) { return m.from == reserved; }), merged.end());
+
+    if (merged.size() > MAX_ENTRIES)
+    {
+        SPDLOG_ERROR("palette has {} colors, only the first {} are remapped on the GPU", merged.size(), MAX_ENTRIES);
+        merged.resize(MAX_ENTRIES);
+    }
+
+    std::vector<uint8_t> result(sizeof(palette_constants_t));
+    const auto constants = reinterpret_cast<palette_constants_t*>(result.data());
+    constants->count = static_cast<uint32_t>(merged.size());
+
+    for (size_t i = 0; i < merged.size(); ++i)
+    {
+        constants->entries[i * 2] = merged[i].from & 0x00FFFFFF;
+        constants->entries[i * 2 + 1] = merged[i].to & 0x00FFFFFF;
+    }
+
+    return result;
+}
+
+HRESULT CALLBACK palette_effect::create(IUnknown** effect)
+{
+    *effect = static_cast<ID2D1EffectImpl*>(new (std::nothrow) palette_effect());
+
+    return *effect != nullptr ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT CALLBACK palette_effect::set_table(IUnknown* effect, const BYTE* data, const UINT32 data_size)
+{
+    const auto self = static_cast<palette_effect*>(reinterpret_cast<ID2D1EffectImpl*>(effect));
+
+    if (data_size != self->table.size())
+        return E_INVALIDARG;
+
+    memcpy(self->table.data(), data, data_size);
+    self->table_dirty = true;
+
+    return S_OK;
+}
+
+HRESULT CALLBACK palette_effect::get_table(const IUnknown* effect, BYTE* data, const UINT32 data_size, UINT32* actual_size)
+{
+    const auto self = static_cast<const palette_effect*>(reinterpret_cast<const ID2D1EffectImpl*>(effect));
+
+    if (actual_size != nullptr)
+        *actual_size = static_cast<UINT32>(self->table.size());
+
+    if (data == nullptr)
+        return S_OK;
+
+    if (data_size < self->table.size())
+        return E_NOT_SUFFICIENT_BUFFER;
+
+    memcpy(data, self->table.data(), self->table.size());
+
+    return S_OK;
+}
+
+IFACEMETHODIMP palette_effect::Initialize(ID2D1EffectContext* context, ID2D1TransformGraph* graph)
+{
+    if (!shader_blob)
+        return E_FAIL;
+
+    const auto hr = context->LoadPixelShader(GUID_PaletteShader, static_cast<const BYTE*>(shader_blob->GetBufferPointer()), static_cast<UINT32>(shader_blob->GetBufferSize()));
+
+    if (FAILED(hr))
+        return hr;
+
+    return graph->SetSingleTransformNode(static_cast<ID2D1DrawTransform*>(this));
+}
+
+IFACEMETHODIMP palette_effect::PrepareForRender(D2D1_CHANGE_TYPE)
+{
+    if (!table_dirty)
+        return S_OK;
+
+    table_dirty = false;
+
+    return draw_info->SetPixelShaderConstantBuffer(table.data(), static_cast<UINT32>(table.size()));
+}
+
+IFACEMETHODIMP palette_effect::SetGraph(ID2D1TransformGraph*)
+{
+    return E_NOTIMPL;
+}
+
+IFACEMETHODIMP palette_effect::SetDrawInfo(ID2D1DrawInfo* info)
+{
+    draw_info.copy_from(info);
+    table_dirty = true;
+
+    // one output pixel per source pixel, the colors must not be filtered before the lookup
+    const auto hr = draw_info->SetInputDescription(0, {D2D1_FILTER_MIN_MAG_MIP_POINT, 0});
+
+    if (FAILED(hr))
+        return hr;
+
+    return draw_info->SetPixelShader(GUID_PaletteShader);
+}
+
+IFACEMETHODIMP palette_effect::MapOutputRectToInputRects(const D2D1_RECT_L* output_rect, D2D1_RECT_L* input_rects, const UINT32 input_rects_count) const
+{
+    if (input_rects_count != 1)
+        return E_INVALIDARG;
+
+    input_rects[0] = *output_rect;
+
+    return S_OK;
+}
+
+IFACEMETHODIMP palette_effect::MapInputRectsToOutputRect(const D2D1_RECT_L* input_rects, const D2D1_RECT_L* input_opaque_sub_rects, const UINT32 input_rect_count, D2D1_RECT_L* output_rect, D2D1_RECT_L* output_opaque_sub_rect)
+{
+    if (input_rect_count != 1)
+        return E_INVALIDARG;
+
+    // alpha is passed through, so is the opaque area
+    *output_rect = input_rects[0];
+    *output_opaque_sub_rect = input_opaque_sub_rects[0];
+
+    return S_OK;
+}
+
+IFACEMETHODIMP palette_effect::MapInvalidRect(UINT32, const D2D1_RECT_L invalid_input_rect, D2D1_RECT_L* invalid_output_rect) const
+{
+    *invalid_output_rect = invalid_input_rect;
+
+    return S_OK;
+}
+
+IFACEMETHODIMP_(UINT32) palette_effect::GetInputCount() const
+{
+    return 1;
+}
+
+IFACEMETHODIMP palette_effect::QueryInterface(REFIID riid, void** object)
+{
+    if (object == nullptr)
+        return E_POINTER;
+
+    if (riid == __uuidof(ID2D1EffectImpl) || riid == __uuidof(IUnknown))
+        *object = static_cast<ID2D1EffectImpl*>(this);
+    else if (riid == __uuidof(ID2D1DrawTransform) || riid == __uuidof(ID2D1Transform) || riid == __uuidof(ID2D1TransformNode))
+        *object = static_cast<ID2D1DrawTransform*>(this);
+    else
+    {
+        *object = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    AddRef();
+
+    return S_OK;
+}
+
+IFACEMETHODIMP_(ULONG) palette_effect::AddRef()
+{
+    return ++ref_count;
+}
+
+IFACEMETHODIMP_(ULONG) palette_effect::Release()
+{
+    const auto count = --ref_count;
+
+    if (count == 0)
+        delete this;
+
+    return count;
+}
@@ -0,0 +1,83 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+#include <vector>
+#include <d2d1_1.h>
+#include <d2d1effectauthor.h>
+#include <winrt/base.h>
+
+#include "utils.hpp"
+
+// {8d98422f-599d-43be-a841-cf5c16130da5}
+constexpr GUID CLSID_VMChromaPalette = {0x8d98422f, 0x599d, 0x43be, {0xa8, 0x41, 0xcf, 0x5c, 0x16, 0x13, 0x0d, 0xa5}};
+
+enum palette_prop
+{
+    // blob holding the constant buffer of the pixel shader, built with palette_effect::build_table
+    PALETTE_PROP_TABLE,
+};
+
+/**
+ * Direct2D effect that replaces exact source colors with the colors of a palette, the lookup runs in a pixel shader
+ * It sits between the GDI surface and the scaling, so every pixel Voicemeeter draws is remapped, including bitmaps
+ * it blits and pixels drawn with a color that was never passed through a hooked GDI call
+ */
+class palette_effect final : public ID2D1EffectImpl, public ID2D1DrawTransform
+{
+    std::atomic<ULONG> ref_count = 1;
+    winrt::com_ptr<ID2D1DrawInfo> draw_info;
+    std::vector<uint8_t> table;
+    bool table_dirty = true;
+
+    palette_effect();
+    static HRESULT CALLBACK create(IUnknown** effect);
+    static HRESULT CALLBACK set_table(IUnknown* effect, const BYTE* data, UINT32 data_size);
+    static HRESULT CALLBACK get_table(const IUnknown* effect, BYTE* data, UINT32 data_size, UINT32* actual_size);
+
+public:
+    // each vector of the constant buffer holds two mappings, so the table takes 256 of the 4096 vectors a constant buffer can have
+    // 512 leaves plenty of room for the colors of a theme and keeps the buffer at 4 KB and the binary search at 9 steps, must match table[] of the shader
+    static constexpr uint32_t MAX_ENTRIES = 512;
+
+    static bool register_effect(ID2D1Factory1* factory);
+    static std::vector<uint8_t> build_table(const std::vector<color_mapping_t>& shapes, const std::vector<color_mapping_t>& text, COLORREF reserved);
+
+    // ID2D1EffectImpl
+    IFACEMETHODIMP Initialize(ID2D1EffectContext* context, ID2D1TransformGraph* graph) override;
+    IFACEMETHODIMP PrepareForRender(D2D1_CHANGE_TYPE change_type) override;
+    IFACEMETHODIMP SetGraph(ID2D1TransformGraph* graph) override;
+
+    // ID2D1DrawTransform
+    IFACEMETHODIMP SetDrawInfo(ID2D1DrawInfo* info) override;
+
+    // ID2D1Transform
+    IFACEMETHODIMP MapOutputRectToInputRects(const D2D1_RECT_L* output_rect, D2D1_RECT_L* input_rects, UINT32 input_rects_count) const override;
+    IFACEMETHODIMP MapInputRectsToOutputRect(const D2D1_RECT_L* input_rects, const D2D1_RECT_L* input_opaque_sub_rects, UINT32 input_rect_count, D2D1_RECT_L* output_rect, D2D1_RECT_L* output_opaque_sub_rect) override;
+    IFACEMETHODIMP MapInvalidRect(UINT32 input_index, D2D1_RECT_L invalid_input_rect, D2D1_RECT_L* invalid_output_rect) const override;
+
+    // ID2D1TransformNode
+    IFACEMETHODIMP_(UINT32) GetInputCount() const override;
+
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** object) override;
+    IFACEMETHODIMP_(ULONG) AddRef() override;
+    IFACEMETHODIMP_(ULONG) Release() override;
+};
@@ -0,0 +1,204 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "perf_stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cwchar>
+#include <spdlog/spdlog.h>
+
+namespace perf
+{
+typedef struct ring
+{
+    std::atomic<uint32_t> head;
+    std::array<std::atomic<uint32_t>, RING_SIZE> samples;
+} ring_t;
+
+std::atomic<bool> enabled{false};
+
+static std::array<ring_t, PERF_COUNTER_COUNT> rings{};
+static std::array<std::atomic<uint64_t>, PERF_EVENT_COUNT> events{};
+static int64_t frequency = 1;
+static int64_t last_log = 0;
+
+void set_enabled(const bool value)
+{
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    frequency = f.QuadPart;
+    last_log = now();
+
+    enabled.store(value, std::memory_order_relaxed);
+}
+
+/**
+ * Drops all samples and event counts, must not run concurrently with record or count
+ */
+void reset()
+{
+    for (auto& r : rings)
+        r.head.store(0, std::memory_order_relaxed);
+
+    for (auto& e : events)
+        e.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @return QPC ticks per second, samples from other clocks have to be converted before they are recorded
+ */
+int64_t get_frequency()
+{
+    return frequency;
+}
+
+/**
+ * Adds a sample, safe to call from any thread
+ * @param counter The counter
+ * @param ticks Duration in QPC ticks
+ */
+void record(const perf_counter counter, const int64_t ticks)
+{
+    auto& r = rings[counter];
+    const auto index = r.head.fetch_add(1, std::memory_order_relaxed) % RING_SIZE;
+    r.samples[index].store(static_cast<uint32_t>(std::clamp<int64_t>(ticks, 0, UINT32_MAX)), std::memory_order_relaxed);
+}
+
+/**
+ * Counts an event, does nothing but a relaxed load while disabled
+ * @param event The event
+ */
+void count(const perf_event event)
+{
+    if (is_enabled())
+        events[event].fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @param event The event
+ * @return How often the event happened since the process started or the last reset
+ */
+uint64_t get_count(const perf_event event)
+{
+    return events[event].load(std::memory_order_relaxed);
+}
+
+/**
+ * Computes the percentiles of the samples currently in the ring, a sample written concurrently may be from either lap
+ * @param counter The counter
+ * @return Number of samples and percentiles in microseconds
+ */
+perf_summary_t summarize(const perf_counter counter)
+{
+    const auto& r = rings[counter];
+    const auto count = min(r.head.load(std::memory_order_relaxed), RING_SIZE);
+
+    if (count == 0)
+        return {0, 0.0, 0.0};
+
+    std::array<uint32_t, RING_SIZE> sorted;
+
+    for (uint32_t i = 0; i < count; ++i)
+        sorted[i] = r.samples[i].load(std::memory_order_relaxed);
+
+    const auto end = sorted.begin() + count;
+    const auto p50 = sorted.begin() + count / 2;
+    const auto p99 = sorted.begin() + min(count - 1, count * 99 / 100);
+
+    std::nth_element(sorted.begin(), p50, end);
+    const double p50_ticks = *p50;
+    std::nth_element(p50, p99, end);
+    const double p99_ticks = *p99;
+
+    const double us_per_tick = 1e6 / static_cast<double>(frequency);
+    return {count, p50_ticks * us_per_tick, p99_ticks * us_per_tick};
+}
+
+const char* get_name(const perf_counter counter)
+{
+    switch (counter)
+    {
+    case PERF_GDI_FLUSH:
+        return "GdiFlush";
+    case PERF_DRAW:
+        return "BeginDraw/EndDraw";
+    case PERF_GPU_DRAW:
+        return "GPU draw";
+    case PERF_PRESENT:
+        return "Present";
+    case PERF_CREATE_DIB:
+        return "CreateDIBSection";
+    case PERF_COLOR_HOOKS:
+        return "color hooks";
+    case PERF_SESSION_HOOKS:
+        return "session hooks";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @return One line per counter with p50 and p99, drawn by the overlay
+ */
+std::wstring format_overlay()
+{
+    std::wstring text;
+    wchar_t line[128];
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        const auto counter = static_cast<perf_counter>(i);
+        const auto s = summarize(counter);
+        swprintf_s(line, L"%-18S p50 %8.1f us  p99 %8.1f us\n", get_name(counter), s.p50_us, s.p99_us);
+        text += line;
+    }
+
+    swprintf_s(line, L"GDI cache hits %llu  misses %llu  GDI objects %lu\n", get_count(PERF_GDI_CACHE_HIT), get_count(PERF_GDI_CACHE_MISS), GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS));
+    text += line;
+
+    return text;
+}
+
+/**
+ * Logs the percentiles of all counters every LOG_INTERVAL_MS, called from the UI update timer
+ * The messages are info level, the log level is lowered to info while the counters are enabled
+ */
+void log_if_due()
+{
+    if (!is_enabled())
+        return;
+
+    const auto t = now();
+
+    if ((t - last_log) * 1000 / frequency < LOG_INTERVAL_MS)
+        return;
+
+    last_log = t;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        const auto counter = static_cast<perf_counter>(i);
+        const auto s = summarize(counter);
+
+        if (s.samples != 0)
+            SPDLOG_INFO("perf {}: {} samples, p50 {:.1f} us, p99 {:.1f} us", get_name(counter), s.samples, s.p50_us, s.p99_us);
+    }
+
+    SPDLOG_INFO("perf GDI cache: {} hits, {} misses, {} GDI objects", get_count(PERF_GDI_CACHE_HIT), get_count(PERF_GDI_CACHE_MISS), GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS));
+}
+}
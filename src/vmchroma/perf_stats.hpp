@@ -0,0 +1,108 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum perf_counter
+{
+    PERF_GDI_FLUSH,
+    PERF_DRAW,
+    // GPU time of the BeginDraw/EndDraw batch, measured with timestamp queries a few frames late
+    PERF_GPU_DRAW,
+    PERF_PRESENT,
+    PERF_CREATE_DIB,
+    PERF_COLOR_HOOKS,
+    PERF_SESSION_HOOKS,
+    PERF_COUNTER_COUNT
+};
+
+enum perf_event
+{
+    PERF_GDI_CACHE_HIT,
+    PERF_GDI_CACHE_MISS,
+    PERF_EVENT_COUNT
+};
+
+typedef struct perf_summary
+{
+    uint32_t samples;
+    double p50_us;
+    double p99_us;
+} perf_summary_t;
+
+/**
+ * Opt-in timing of the render path and the hot hooks
+ * Every counter keeps the last RING_SIZE samples in a lock-free ring buffer, writers never block and never allocate
+ */
+namespace perf
+{
+constexpr uint32_t RING_SIZE = 1024;
+constexpr int64_t LOG_INTERVAL_MS = 10000;
+
+extern std::atomic<bool> enabled;
+
+inline bool is_enabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t now()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+void set_enabled(bool value);
+void reset();
+int64_t get_frequency();
+void record(perf_counter counter, int64_t ticks);
+void count(perf_event event);
+uint64_t get_count(perf_event event);
+perf_summary_t summarize(perf_counter counter);
+const char* get_name(perf_counter counter);
+std::wstring format_overlay();
+void log_if_due();
+
+/**
+ * Records the time between construction and destruction, does nothing but a relaxed load while disabled
+ */
+class scope
+{
+    perf_counter counter;
+    int64_t start;
+
+public:
+    explicit scope(const perf_counter counter) : counter(counter), start(is_enabled() ? now() : 0)
+    {
+    }
+
+    ~scope()
+    {
+        if (start != 0)
+            record(counter, now() - start);
+    }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+};
+}
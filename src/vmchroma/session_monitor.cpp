@@ -0,0 +1,318 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "session_monitor.hpp"
+
+#include <mmdeviceapi.h>
+#include <spdlog/spdlog.h>
+
+#include "winapi_hook_defs.hpp"
+
+/**
+ * Receives new sessions of the session manager, runs on a thread of the audio service RPC pool
+ */
+struct session_notification : winrt::implements<session_notification, IAudioSessionNotification>
+{
+    session_monitor* monitor;
+
+    explicit session_notification(session_monitor* monitor) : monitor(monitor)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE OnSessionCreated(IAudioSessionControl* NewSession) override
+    {
+        winrt::com_ptr<IAudioSessionControl2> control;
+
+        if (NewSession == nullptr || FAILED(NewSession->QueryInterface(__uuidof(IAudioSessionControl2), control.put_void())))
+            return S_OK;
+
+        monitor->enqueue(SESSION_WORK_ADDED, std::move(control));
+        return S_OK;
+    }
+};
+
+/**
+ * Receives the state changes of a single session, only the end of a session is of interest
+ */
+struct session_events : winrt::implements<session_events, IAudioSessionEvents>
+{
+    session_monitor* monitor;
+    winrt::com_ptr<IAudioSessionControl2> control;
+
+    session_events(session_monitor* monitor, winrt::com_ptr<IAudioSessionControl2> control) : monitor(monitor), control(std::move(control))
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDisplayNameChanged(LPCWSTR, LPCGUID) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnIconPathChanged(LPCWSTR, LPCGUID) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnSimpleVolumeChanged(float, BOOL, LPCGUID) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnChannelVolumeChanged(DWORD, float[], DWORD, LPCGUID) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnGroupingParamChanged(LPCGUID, LPCGUID) override { return S_OK; }
+
+    HRESULT STDMETHODCALLTYPE OnStateChanged(const AudioSessionState NewState) override
+    {
+        if (NewState == AudioSessionStateExpired)
+            monitor->enqueue(SESSION_WORK_EXPIRED, control);
+
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnSessionDisconnected(AudioSessionDisconnectReason) override
+    {
+        monitor->enqueue(SESSION_WORK_EXPIRED, control);
+        return S_OK;
+    }
+};
+
+session_monitor::~session_monitor()
+{
+    stop();
+}
+
+/**
+ * Starts the monitor thread
+ * @param get_pid_fn Resolves the process id of a session, must bypass the GetProcessId hook
+ * @param on_added_fn Called on the monitor thread when the first session of a process shows up
+ * @param on_removed_fn Called on the monitor thread when the last session of a process is gone
+ * @return True if the monitor thread is running
+ */
+bool session_monitor::start(std::function<HRESULT(IAudioSessionControl2*, DWORD*)> get_pid_fn, std::function<void(DWORD)> on_added_fn, std::function<void(DWORD)> on_removed_fn)
+{
+    stop();
+
+    stop_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    work_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    if (stop_event == nullptr || work_event == nullptr)
+    {
+        SPDLOG_ERROR("failed to create session monitor events");
+        stop();
+        return false;
+    }
+
+    get_pid = std::move(get_pid_fn);
+    on_added = std::move(on_added_fn);
+    on_removed = std::move(on_removed_fn);
+    worker = std::thread(&session_monitor::run, this);
+
+    return true;
+}
+
+/**
+ * Stops the monitor thread, all notifications are unregistered before it exits
+ */
+void session_monitor::stop()
+{
+    if (worker.joinable())
+    {
+        SetEvent(stop_event);
+        worker.join();
+    }
+
+    if (stop_event != nullptr)
+        CloseHandle(stop_event);
+
+    if (work_event != nullptr)
+        CloseHandle(work_event);
+
+    stop_event = nullptr;
+    work_event = nullptr;
+
+    std::lock_guard lock(queue_mtx);
+    queue.clear();
+}
+
+/**
+ * Queues work for the monitor thread, safe to call from COM callbacks
+ * @param type The kind of work
+ * @param control The session, unused for SESSION_WORK_REFRESH
+ */
+void session_monitor::enqueue(const session_work_type type, winrt::com_ptr<IAudioSessionControl2> control)
+{
+    {
+        std::lock_guard lock(queue_mtx);
+        queue.push_back({type, std::move(control)});
+    }
+
+    SetEvent(work_event);
+}
+
+/**
+ * Runs on_added again for every process with a live session, used after the config changed
+ */
+void session_monitor::refresh()
+{
+    if (worker.joinable())
+        enqueue(SESSION_WORK_REFRESH, nullptr);
+}
+
+void session_monitor::run()
+{
+    if (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
+    {
+        SPDLOG_ERROR("session monitor failed to initialize COM");
+        return;
+    }
+
+    {
+        winrt::com_ptr<IMMDeviceEnumerator> device_enumerator;
+        winrt::com_ptr<IMMDevice> device;
+        winrt::com_ptr<IAudioSessionManager2> session_manager;
+        winrt::com_ptr<IAudioSessionEnumerator> session_enumerator;
+        const auto notification = winrt::make<session_notification>(this);
+        bool registered = false;
+
+        try
+        {
+            winrt::check_hresult(o_CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), device_enumerator.put_void()));
+            winrt::check_hresult(device_enumerator->GetDefaultAudioEndpoint(eRender, eConsole, device.put()));
+            winrt::check_hresult(device->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL, nullptr, session_manager.put_void()));
+            winrt::check_hresult(session_manager->RegisterSessionNotification(notification.get()));
+            registered = true;
+
+            // notifications only start after the first enumeration, sessions created in between are reported twice which is harmless
+            winrt::check_hresult(session_manager->GetSessionEnumerator(session_enumerator.put()));
+
+            int count = 0;
+            winrt::check_hresult(session_enumerator->GetCount(&count));
+
+            for (int i = 0; i < count; ++i)
+            {
+                winrt::com_ptr<IAudioSessionControl> control;
+                winrt::com_ptr<IAudioSessionControl2> control2;
+
+                if (FAILED(session_enumerator->GetSession(i, control.put())) || FAILED(control->QueryInterface(__uuidof(IAudioSessionControl2), control2.put_void())))
+                    continue;
+
+                add_session(control2);
+            }
+        }
+        catch (const winrt::hresult_error& ex)
+        {
+            SPDLOG_ERROR("session monitor failed to create COM interface: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+        }
+
+        if (registered)
+        {
+            const HANDLE handles[] = {stop_event, work_event};
+
+            while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+                process_queue();
+
+            session_manager->UnregisterSessionNotification(notification.get());
+        }
+
+        unregister_all();
+    }
+
+    CoUninitialize();
+}
+
+void session_monitor::process_queue()
+{
+    std::deque<session_work_t> work;
+
+    {
+        std::lock_guard lock(queue_mtx);
+        work.swap(queue);
+    }
+
+    for (const auto& item : work)
+    {
+        switch (item.type)
+        {
+        case SESSION_WORK_ADDED:
+            add_session(item.control);
+            break;
+        case SESSION_WORK_EXPIRED:
+            remove_session(item.control.get());
+            break;
+        case SESSION_WORK_REFRESH:
+            for (const auto& [pid, count] : session_count_per_pid)
+                on_added(pid);
+            break;
+        }
+    }
+}
+
+/**
+ * Adds a session to the snapshot and subscribes to its events
+ * @param control The session
+ */
+void session_monitor::add_session(const winrt::com_ptr<IAudioSessionControl2>& control)
+{
+    if (sessions.find(control.get()) != sessions.end())
+        return;
+
+    DWORD pid = 0;
+
+    // S_FALSE is returned for sessions spanning multiple processes, those have no single app to match
+    if (get_pid(control.get(), &pid) != S_OK || pid == 0)
+        return;
+
+    AudioSessionState state;
+
+    if (FAILED(control->GetState(&state)) || state == AudioSessionStateExpired)
+        return;
+
+    winrt::com_ptr<IAudioSessionEvents> events = winrt::make<session_events>(this, control);
+
+    if (FAILED(control->RegisterAudioSessionNotification(events.get())))
+    {
+        SPDLOG_ERROR("failed to register session events for pid {}", pid);
+        return;
+    }
+
+    sessions.emplace(control.get(), session_entry_t{control, std::move(events), pid});
+
+    if (++session_count_per_pid[pid] == 1)
+        on_added(pid);
+}
+
+/**
+ * Removes a session from the snapshot, never called from inside a COM callback
+ * @param control The session
+ */
+void session_monitor::remove_session(IAudioSessionControl2* control)
+{
+    const auto it = sessions.find(control);
+
+    if (it == sessions.end())
+        return;
+
+    const DWORD pid = it->second.pid;
+
+    it->second.control->UnregisterAudioSessionNotification(it->second.events.get());
+    sessions.erase(it);
+
+    const auto count_it = session_count_per_pid.find(pid);
+
+    if (count_it != session_count_per_pid.end() && --count_it->second == 0)
+    {
+        session_count_per_pid.erase(count_it);
+        on_removed(pid);
+    }
+}
+
+void session_monitor::unregister_all()
+{
+    for (const auto& [key, entry] : sessions)
+        entry.control->UnregisterAudioSessionNotification(entry.events.get());
+
+    sessions.clear();
+    session_count_per_pid.clear();
+}
@@ -0,0 +1,86 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <unknwn.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <audiopolicy.h>
+#include <winrt/base.h>
+
+enum session_work_type
+{
+    SESSION_WORK_ADDED,
+    SESSION_WORK_EXPIRED,
+    SESSION_WORK_REFRESH,
+};
+
+typedef struct session_work
+{
+    session_work_type type;
+    winrt::com_ptr<IAudioSessionControl2> control;
+} session_work_t;
+
+typedef struct session_entry
+{
+    winrt::com_ptr<IAudioSessionControl2> control;
+    winrt::com_ptr<IAudioSessionEvents> events;
+    DWORD pid;
+} session_entry_t;
+
+/**
+ * Keeps a snapshot of the audio sessions on the default render endpoint, driven by IAudioSessionNotification and IAudioSessionEvents
+ * The COM callbacks only queue work, the snapshot is maintained on an own MTA thread which also runs on_added and on_removed
+ */
+class session_monitor
+{
+    std::thread worker;
+    HANDLE stop_event = nullptr;
+    HANDLE work_event = nullptr;
+
+    std::mutex queue_mtx;
+    std::deque<session_work_t> queue;
+
+    // only touched by the worker thread
+    std::unordered_map<IAudioSessionControl2*, session_entry_t> sessions;
+    std::unordered_map<DWORD, uint32_t> session_count_per_pid;
+
+    std::function<HRESULT(IAudioSessionControl2*, DWORD*)> get_pid;
+    std::function<void(DWORD)> on_added;
+    std::function<void(DWORD)> on_removed;
+
+    void run();
+    void process_queue();
+    void add_session(const winrt::com_ptr<IAudioSessionControl2>& control);
+    void remove_session(IAudioSessionControl2* control);
+    void unregister_all();
+
+public:
+    session_monitor() = default;
+    ~session_monitor();
+    session_monitor(const session_monitor&) = delete;
+    session_monitor& operator=(const session_monitor&) = delete;
+    bool start(std::function<HRESULT(IAudioSessionControl2*, DWORD*)> get_pid_fn, std::function<void(DWORD)> on_added_fn, std::function<void(DWORD)> on_removed_fn);
+    void stop();
+    void enqueue(session_work_type type, winrt::com_ptr<IAudioSessionControl2> control);
+    void refresh();
+};
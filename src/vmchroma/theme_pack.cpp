@@ -0,0 +1,225 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "theme_pack.hpp"
+
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+/**
+ * Maps a theme pack and checks that it belongs to the running Voicemeeter flavor
+ * @param path Path to the .vmctheme file
+ * @param flavor The active flavor
+ * @return True if the pack is usable
+ */
+bool theme_pack::open(const std::wstring& path, const flavor_info_t& flavor)
+{
+    close();
+
+    if (!file.open(path))
+        return false;
+
+    header = reinterpret_cast<const theme_pack_header_t*>(file.data());
+
+    if (!validate(flavor))
+    {
+        SPDLOG_ERROR("{} is not a valid theme pack for {}", utils::wstr_to_str_or_default(path), flavor.name);
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void theme_pack::close()
+{
+    file.close();
+    header = nullptr;
+}
+
+bool theme_pack::is_open() const
+{
+    return header != nullptr;
+}
+
+/**
+ * Checks the header and the bounds of every section
+ * @param flavor The active flavor
+ * @return True if the pack can be used without further checks
+ */
+bool theme_pack::validate(const flavor_info_t& flavor) const
+{
+    if (file.size() < sizeof(theme_pack_header_t) || header->magic != PACK_MAGIC || header->version != PACK_VERSION || header->section_count != PACK_SECTION_COUNT)
+        return false;
+
+    if (header->flavor != flavor.id ||
+        header->bitmap_width_main != flavor.bitmap_width_main ||
+        header->bitmap_width_settings != flavor.bitmap_width_settings ||
+        header->bitmap_width_cassette != flavor.bitmap_width_cassette)
+        return false;
+
+    for (uint32_t i = 0; i < PACK_SECTION_COUNT; ++i)
+    {
+        const auto& section = header->sections[i];
+
+        // compressed sections would need a private copy, which is what mapping the pack avoids
+        if (section.compression != PACK_COMPRESSION_NONE)
+            return false;
+
+        if (section.offset < sizeof(theme_pack_header_t) || section.offset > file.size() || section.size > file.size() - section.offset)
+            return false;
+
+        if (i >= PACK_SECTION_COLORS_SHAPES && section.size % sizeof(color_mapping_t) != 0)
+            return false;
+
+        if (i < PACK_SECTION_COLORS_SHAPES && (section.size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) ||
+            reinterpret_cast<const BITMAPFILEHEADER*>(file.data() + section.offset)->bfType != 0x4D42))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Compares the modification times of the loose theme files with the ones the pack was built from
+ * @param mtimes Current modification times of the source files
+ * @return True if the pack is up to date
+ */
+bool theme_pack::matches_sources(const source_mtimes_t& mtimes) const
+{
+    if (!is_open())
+        return false;
+
+    for (uint32_t i = 0; i < PACK_SOURCE_COUNT; ++i)
+    {
+        if (header->source_mtime[i] != mtimes[i])
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @param section The section to look up
+ * @return View into the mapped pack, empty if the pack isn't open
+ */
+byte_view_t theme_pack::get_section(const pack_section section) const
+{
+    if (!is_open() || section >= PACK_SECTION_COUNT)
+        return {nullptr, 0};
+
+    return {file.data() + header->sections[section].offset, static_cast<size_t>(header->sections[section].size)};
+}
+
+/**
+ * Copies a precompiled color table out of the pack
+ * @param section Either PACK_SECTION_COLORS_SHAPES or PACK_SECTION_COLORS_TEXT
+ * @param table Target table
+ * @return True on success
+ */
+bool theme_pack::get_color_table(const pack_section section, std::vector<color_mapping_t>& table) const
+{
+    if (section != PACK_SECTION_COLORS_SHAPES && section != PACK_SECTION_COLORS_TEXT)
+        return false;
+
+    const auto bytes = get_section(section);
+
+    if (bytes.data == nullptr)
+        return false;
+
+    const auto entries = reinterpret_cast<const color_mapping_t*>(bytes.data);
+    table.assign(entries, entries + bytes.size / sizeof(color_mapping_t));
+
+    return true;
+}
+
+/**
+ * Writes a theme pack, the file is written next to the target and moved into place so readers never see a partial pack
+ * @param path Path to the .vmctheme file
+ * @param flavor The flavor the pack is built for
+ * @param mtimes Modification times of the source files
+ * @param sections Content of every section
+ * @return True on success
+ */
+bool theme_pack::write(const std::wstring& path, const flavor_info_t& flavor, const source_mtimes_t& mtimes, const std::array<byte_view_t, PACK_SECTION_COUNT>& sections)
+{
+    theme_pack_header_t pack_header{};
+    pack_header.magic = PACK_MAGIC;
+    pack_header.version = PACK_VERSION;
+    pack_header.section_count = PACK_SECTION_COUNT;
+    pack_header.flavor = flavor.id;
+    pack_header.bitmap_width_main = flavor.bitmap_width_main;
+    pack_header.bitmap_width_settings = flavor.bitmap_width_settings;
+    pack_header.bitmap_width_cassette = flavor.bitmap_width_cassette;
+
+    for (uint32_t i = 0; i < PACK_SOURCE_COUNT; ++i)
+        pack_header.source_mtime[i] = mtimes[i];
+
+    uint64_t offset = (sizeof(theme_pack_header_t) + PACK_SECTION_ALIGN - 1) & ~(PACK_SECTION_ALIGN - 1);
+
+    for (uint32_t i = 0; i < PACK_SECTION_COUNT; ++i)
+    {
+        pack_header.sections[i].offset = offset;
+        pack_header.sections[i].size = sections[i].size;
+        pack_header.sections[i].compression = PACK_COMPRESSION_NONE;
+        offset = (offset + sections[i].size + PACK_SECTION_ALIGN - 1) & ~(PACK_SECTION_ALIGN - 1);
+    }
+
+    const std::wstring tmp_path = path + L".tmp";
+
+    {
+        std::ofstream f(tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+
+        if (!f.is_open())
+        {
+            SPDLOG_ERROR("failed to create {}", utils::wstr_to_str_or_default(tmp_path));
+            return false;
+        }
+
+        const char padding[PACK_SECTION_ALIGN] = {};
+        f.write(reinterpret_cast<const char*>(&pack_header), sizeof(pack_header));
+        f.write(padding, static_cast<std::streamsize>(pack_header.sections[0].offset - sizeof(pack_header)));
+
+        for (uint32_t i = 0; i < PACK_SECTION_COUNT; ++i)
+        {
+            const uint64_t end = pack_header.sections[i].offset + pack_header.sections[i].size;
+            const uint64_t next = i + 1 < PACK_SECTION_COUNT ? pack_header.sections[i + 1].offset : end;
+
+            if (sections[i].size != 0)
+                f.write(reinterpret_cast<const char*>(sections[i].data), static_cast<std::streamsize>(sections[i].size));
+
+            f.write(padding, static_cast<std::streamsize>(next - end));
+        }
+
+        if (!f)
+        {
+            SPDLOG_ERROR("failed to write {}", utils::wstr_to_str_or_default(tmp_path));
+            f.close();
+            DeleteFileW(tmp_path.c_str());
+            return false;
+        }
+    }
+
+    if (!MoveFileExW(tmp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        SPDLOG_ERROR("failed to replace {}, error {}", utils::wstr_to_str_or_default(path), GetLastError());
+        DeleteFileW(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+/**
+ * Layout of a .vmctheme file:
+ * theme_pack_header_t, followed by the sections it points to, each aligned to PACK_SECTION_ALIGN
+ * Bitmap sections hold the complete .bmp file so they can be handed to hk_CreateDIBSection as-is,
+ * color table sections hold color_mapping_t entries already sorted by their source color
+ */
+enum pack_section { PACK_SECTION_BG, PACK_SECTION_BG_SETTINGS, PACK_SECTION_BG_CASSETTE, PACK_SECTION_COLORS_SHAPES, PACK_SECTION_COLORS_TEXT, PACK_SECTION_COUNT };
+
+enum pack_source { PACK_SOURCE_BG, PACK_SOURCE_BG_SETTINGS, PACK_SOURCE_BG_CASSETTE, PACK_SOURCE_COLORS, PACK_SOURCE_COUNT };
+
+enum pack_compression : uint32_t { PACK_COMPRESSION_NONE };
+
+typedef struct theme_pack_section
+{
+    uint64_t offset;
+    uint64_t size;
+    uint32_t compression;
+    uint32_t reserved;
+} theme_pack_section_t;
+
+typedef struct theme_pack_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t section_count;
+    uint32_t flavor;
+    uint32_t bitmap_width_main;
+    uint32_t bitmap_width_settings;
+    uint32_t bitmap_width_cassette;
+    uint64_t source_mtime[PACK_SOURCE_COUNT];
+    theme_pack_section_t sections[PACK_SECTION_COUNT];
+} theme_pack_header_t;
+
+class theme_pack
+{
+    static constexpr uint32_t PACK_MAGIC = 0x54434D56; // "VMCT"
+    static constexpr uint16_t PACK_VERSION = 1;
+    static constexpr uint64_t PACK_SECTION_ALIGN = 16;
+
+    utils::mapped_file file;
+    const theme_pack_header_t* header = nullptr;
+
+    bool validate(const flavor_info_t& flavor) const;
+
+public:
+    typedef std::array<uint64_t, PACK_SOURCE_COUNT> source_mtimes_t;
+
+    bool open(const std::wstring& path, const flavor_info_t& flavor);
+    void close();
+    bool is_open() const;
+    bool matches_sources(const source_mtimes_t& mtimes) const;
+    byte_view_t get_section(pack_section section) const;
+    bool get_color_table(pack_section section, std::vector<color_mapping_t>& table) const;
+
+    static bool write(const std::wstring& path, const flavor_info_t& flavor, const source_mtimes_t& mtimes, const std::array<byte_view_t, PACK_SECTION_COUNT>& sections);
+};
@@ -0,0 +1,49 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "trace.hpp"
+
+// {aa35785a-eca0-54c2-13d3-2b6a2c6387a6}
+TRACELOGGING_DEFINE_PROVIDER(
+    vmchroma_trace_provider,
+    "VMChroma",
+    (0xaa35785a, 0xeca0, 0x54c2, 0x13, 0xd3, 0x2b, 0x6a, 0x2c, 0x63, 0x87, 0xa6));
+
+namespace trace
+{
+static bool registered = false;
+
+/**
+ * Registers the provider, events written before are dropped
+ */
+void register_provider()
+{
+    if (!registered)
+        registered = SUCCEEDED(TraceLoggingRegister(vmchroma_trace_provider));
+}
+
+/**
+ * Must be called before the DLL is unloaded
+ */
+void unregister_provider()
+{
+    if (registered)
+        TraceLoggingUnregister(vmchroma_trace_provider);
+
+    registered = false;
+}
+}
@@ -0,0 +1,113 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <TraceLoggingProvider.h>
+
+// ETW provider "VMChroma", the GUID is the name hash, so "*VMChroma" can be used in WPR and tracelog
+TRACELOGGING_DECLARE_PROVIDER(vmchroma_trace_provider);
+
+/**
+ * TraceLogging events for correlating UI stalls with other ETW traces
+ * Every event is a single enabled check while no session listens, so they can stay in the hot paths
+ */
+namespace trace
+{
+constexpr ULONGLONG KEYWORD_RENDER = 0x1;
+constexpr ULONGLONG KEYWORD_RESIZE = 0x2;
+constexpr ULONGLONG KEYWORD_THEME = 0x4;
+constexpr ULONGLONG KEYWORD_SESSION = 0x8;
+
+void register_provider();
+void unregister_provider();
+
+inline void frame_begin(const uint32_t window_count)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "FrameBegin",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(KEYWORD_RENDER),
+        TraceLoggingUInt32(window_count, "WindowCount"));
+}
+
+inline void frame_end(const HRESULT hr)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "FrameEnd",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(KEYWORD_RENDER),
+        TraceLoggingHResult(hr, "Result"));
+}
+
+inline void present(const HWND hwnd, const uint32_t dirty_rect_count, const HRESULT hr)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "Present",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(KEYWORD_RENDER),
+        TraceLoggingPointer(hwnd, "Window"),
+        TraceLoggingUInt32(dirty_rect_count, "DirtyRectCount"),
+        TraceLoggingHResult(hr, "Result"));
+}
+
+inline void resize(const HWND hwnd, const uint32_t width, const uint32_t height)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "Resize",
+        TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+        TraceLoggingKeyword(KEYWORD_RESIZE),
+        TraceLoggingPointer(hwnd, "Window"),
+        TraceLoggingUInt32(width, "Width"),
+        TraceLoggingUInt32(height, "Height"));
+}
+
+inline void resize_child_windows(const uint32_t window_count)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "ResizeChildWindows",
+        TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+        TraceLoggingKeyword(KEYWORD_RESIZE),
+        TraceLoggingUInt32(window_count, "WindowCount"));
+}
+
+inline void theme_load(const bool is_startup, const bool success, const bool from_pack, const int64_t duration_us)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "ThemeLoad",
+        TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+        TraceLoggingKeyword(KEYWORD_THEME),
+        TraceLoggingBool(is_startup, "IsStartup"),
+        TraceLoggingBool(success, "Success"),
+        TraceLoggingBool(from_pack, "FromPack"),
+        TraceLoggingInt64(duration_us, "DurationUs"));
+}
+
+inline void session_filtered(const DWORD pid, const bool blacklisted)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "SessionFiltered",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(KEYWORD_SESSION),
+        TraceLoggingUInt32(pid, "ProcessId"),
+        TraceLoggingBool(blacklisted, "Blacklisted"));
+}
+
+inline void session_changed(const DWORD pid, const bool added)
+{
+    TraceLoggingWrite(vmchroma_trace_provider, "SessionChanged",
+        TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+        TraceLoggingKeyword(KEYWORD_SESSION),
+        TraceLoggingUInt32(pid, "ProcessId"),
+        TraceLoggingBool(added, "Added"));
+}
+}
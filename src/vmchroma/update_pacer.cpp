@@ -0,0 +1,147 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "update_pacer.hpp"
+
+#include "winapi_hook_defs.hpp"
+
+void update_pacer::set_enabled(const bool enable)
+{
+    enabled = enable;
+}
+
+bool update_pacer::is_enabled() const
+{
+    return enabled;
+}
+
+/**
+ * Takes over the UI update timer when Voicemeeter creates it
+ * @param timer_hwnd The window the timer belongs to
+ * @param id The timer id
+ * @param proc The timer procedure Voicemeeter passed, usually nullptr
+ * @param fixed_interval The interval outside of the adaptive mode
+ * @return The interval the timer has to be created with
+ */
+UINT update_pacer::on_set_timer(const HWND timer_hwnd, const UINT_PTR id, const TIMERPROC proc, const UINT fixed_interval)
+{
+    hwnd = timer_hwnd;
+    timer_id = id;
+    timer_proc = proc;
+    active_interval = enabled ? get_refresh_interval() : fixed_interval;
+    current_interval = suspended ? SUSPENDED_INTERVAL : active_interval;
+    last_activity = GetTickCount64();
+
+    return current_interval;
+}
+
+/**
+ * Stretches the timer while nothing is rendered and restores the full rate afterwards
+ * @param suspend True while the main window can't be seen
+ */
+void update_pacer::set_suspended(const bool suspend)
+{
+    suspended = suspend;
+    last_activity = GetTickCount64();
+
+    if (hwnd != nullptr)
+        apply(suspended ? SUSPENDED_INTERVAL : active_interval);
+}
+
+/**
+ * Matches the full rate to the monitor the window is on, called after the window moved or the display mode changed
+ */
+void update_pacer::update_refresh_rate()
+{
+    if (!enabled || hwnd == nullptr)
+        return;
+
+    const auto previous = active_interval;
+    active_interval = get_refresh_interval();
+
+    if (current_interval == previous)
+        apply(active_interval);
+}
+
+/**
+ * Called after every UI update
+ * @param activity True if any window drew something since the last update
+ * @param occluded True if the main window can't be seen
+ */
+void update_pacer::on_tick(const bool activity, const bool occluded)
+{
+    if (!enabled || suspended || hwnd == nullptr)
+        return;
+
+    const auto now = GetTickCount64();
+
+    if (activity)
+        last_activity = now;
+
+    if (occluded)
+        apply(OCCLUDED_INTERVAL);
+    else if (now - last_activity < IDLE_DELAY_MS)
+        apply(active_interval);
+    else
+        apply(IDLE_INTERVAL);
+}
+
+/**
+ * Called for user input on the main window, switches to the full rate without waiting for the next update
+ */
+void update_pacer::on_input()
+{
+    if (!enabled || suspended || hwnd == nullptr)
+        return;
+
+    last_activity = GetTickCount64();
+    apply(active_interval);
+}
+
+/**
+ * Changes the interval of the running timer, SetTimer with the same id replaces the timer
+ * @param interval The new interval in milliseconds
+ */
+void update_pacer::apply(const UINT interval)
+{
+    if (interval == current_interval)
+        return;
+
+    current_interval = interval;
+    o_SetTimer(hwnd, timer_id, interval, timer_proc);
+}
+
+/**
+ * @return One frame of the monitor the window is on in milliseconds, rounded down so the timer never falls behind the display
+ */
+UINT update_pacer::get_refresh_interval() const
+{
+    MONITORINFOEXW monitor_info = {};
+    monitor_info.cbSize = sizeof(monitor_info);
+
+    DEVMODEW dev_mode = {};
+    dev_mode.dmSize = sizeof(dev_mode);
+
+    if (!GetMonitorInfoW(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST), &monitor_info) || !EnumDisplaySettingsW(monitor_info.szDevice, ENUM_CURRENT_SETTINGS, &dev_mode))
+        return DEFAULT_INTERVAL;
+
+    // 0 and 1 stand for the default rate of the hardware
+    if (dev_mode.dmDisplayFrequency <= 1)
+        return DEFAULT_INTERVAL;
+
+    return max(static_cast<UINT>(USER_TIMER_MINIMUM), 1000u / dev_mode.dmDisplayFrequency);
+}
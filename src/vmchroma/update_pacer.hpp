@@ -0,0 +1,58 @@
+/**
+Copyright (C) 2025 Klaus Hahnenkamp
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <windows.h>
+
+/**
+ * Owns the interval of the UI update timer of the main window
+ * In the adaptive update mode the timer runs at the refresh rate of the monitor while something changes, slows down when the meters
+ * are static and slows down further while the window can't be seen. Input or a changed frame switches back to the full rate right away
+ * Independent of the mode, the timer is stretched while rendering is suspended
+ */
+class update_pacer
+{
+    HWND hwnd = nullptr;
+    UINT_PTR timer_id = 0;
+    TIMERPROC timer_proc = nullptr;
+    bool enabled = false;
+    bool suspended = false;
+    UINT active_interval = DEFAULT_INTERVAL;
+    UINT current_interval = 0;
+    ULONGLONG last_activity = 0;
+
+    static constexpr UINT DEFAULT_INTERVAL = 16;
+    static constexpr UINT IDLE_INTERVAL = 100;
+    static constexpr UINT OCCLUDED_INTERVAL = 250;
+    // Voicemeeter still updates its state in the timer, it only has to keep up well enough for the catch-up frame
+    static constexpr UINT SUSPENDED_INTERVAL = 1000;
+    // time without a changed frame until the meters count as static
+    static constexpr ULONGLONG IDLE_DELAY_MS = 1000;
+
+    void apply(UINT interval);
+    UINT get_refresh_interval() const;
+
+public:
+    void set_enabled(bool enable);
+    bool is_enabled() const;
+    UINT on_set_timer(HWND timer_hwnd, UINT_PTR id, TIMERPROC proc, UINT fixed_interval);
+    void set_suspended(bool suspend);
+    void update_refresh_rate();
+    void on_tick(bool activity, bool occluded);
+    void on_input();
+};
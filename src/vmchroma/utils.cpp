@@ -27,13 +27,17 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <shlobj.h>
 #include "utils.hpp"
 
-#include <fstream>
+#include <algorithm>
 #include <sstream>
 
 #include "spdlog/spdlog.h"
+#include "spdlog/async.h"
+#include "spdlog/sinks/dup_filter_sink.h"
 #include "spdlog/sinks/rotating_file_sink.h"
 
 #include <winrt/base.h>
+#include <emmintrin.h>
+#include <intrin.h>
 
 #include "detours.h"
 #include "winapi_hook_defs.hpp"
@@ -178,81 +182,385 @@ std::optional<COLORREF> hex_to_colorref(const std::string& hex)
 }
 
 /**
- * @brief Scans the main module's memory for all occurrences of a given signature.
- * @param sig A struct containing the byte pattern and a mask ('?' for wildcards).
- * @return A std::vector<uint8_t*> containing the address of every match. The vector will be empty if no matches are found or if an error occurs.
+ * @param sig The signature
+ * @param ptr Candidate address, at least sig.pattern.size() bytes must be readable
+ * @return True if every byte that isn't a wildcard matches
  */
-std::vector<uint8_t*> find_signatures(const signature_t& sig)
+static bool matches_signature(const signature_t& sig, const uint8_t* ptr)
 {
-    std::vector<uint8_t*> occurrences;
+    for (size_t j = 0; j < sig.pattern.size(); j++)
+    {
+        if (sig.mask[j] != '?' && sig.pattern[j] != ptr[j])
+            return false;
+    }
 
-    const auto handle = GetModuleHandle(nullptr);
-    MODULEINFO mod_info;
+    return true;
+}
 
-    if (!handle)
+/**
+ * @brief Scans the executable sections of a mapped image for several signatures in a single sweep.
+ * Candidates are filtered 16 positions at a time with SSE2 by comparing the first and the last byte of a signature that aren't wildcards,
+ * only those positions get the full masked compare.
+ * @param base_handle Base address of the image, the sections must be mapped at their virtual addresses.
+ * @param sigs The signatures, each with a byte pattern and a mask ('?' for wildcards).
+ * @return The address of every match, one vector per signature in the order of sigs. The vectors are empty if no matches are found or if an error occurs.
+ */
+std::vector<std::vector<uint8_t*>> find_signatures(uint8_t* base_handle, const std::vector<signature_t>& sigs)
+{
+    constexpr size_t block_size = sizeof(__m128i);
+
+    typedef struct anchor
     {
-        SPDLOG_ERROR("failed to get module handle");
-        return occurrences;
+        size_t first;
+        size_t last;
+        __m128i first_byte;
+        __m128i last_byte;
+    } anchor_t;
+
+    std::vector<std::vector<uint8_t*>> occurrences(sigs.size());
+    std::vector<std::optional<anchor_t>> anchors(sigs.size());
+
+    for (size_t s = 0; s < sigs.size(); ++s)
+    {
+        const auto& sig = sigs[s];
+        const auto first = sig.mask.find_first_not_of('?');
+
+        if (sig.pattern.empty() || sig.mask.size() != sig.pattern.size() || first == std::string::npos)
+        {
+            SPDLOG_ERROR("invalid signature {}", s);
+            continue;
+        }
+
+        const auto last = sig.mask.find_last_not_of('?');
+        anchors[s] = anchor_t{first, last, _mm_set1_epi8(static_cast<char>(sig.pattern[first])), _mm_set1_epi8(static_cast<char>(sig.pattern[last]))};
     }
 
-    if (!GetModuleInformation(GetCurrentProcess(), handle, &mod_info, sizeof(mod_info)))
+    if (!base_handle)
     {
-        SPDLOG_ERROR("failed to get module information");
+        SPDLOG_ERROR("no image to scan");
         return occurrences;
     }
 
-    const auto start = static_cast<uint8_t*>(mod_info.lpBaseOfDll);
-    const size_t end = mod_info.SizeOfImage;
-    const size_t pattern_size = sig.pattern.size();
-    const uint8_t* pattern = sig.pattern.data();
-    const char* mask = sig.mask.data();
+    const auto dos_header = reinterpret_cast<PIMAGE_DOS_HEADER>(base_handle);
+    const auto nt_headers = reinterpret_cast<PIMAGE_NT_HEADERS>(base_handle + dos_header->e_lfanew);
+    const auto section_header = IMAGE_FIRST_SECTION(nt_headers);
+
+    // end of the positions per signature that can be checked with full blocks, the rest is checked one by one
+    std::vector<size_t> vector_end(sigs.size());
 
-    for (size_t i = 0; i <= end - pattern_size; i++)
+    for (int k = 0; k < nt_headers->FileHeader.NumberOfSections; ++k)
     {
-        bool found = true;
+        if (!(section_header[k].Characteristics & IMAGE_SCN_MEM_EXECUTE))
+            continue;
+
+        const auto start = base_handle + section_header[k].VirtualAddress;
+        const size_t size = section_header[k].Misc.VirtualSize;
+        size_t sweep_end = 0;
+
+        for (size_t s = 0; s < sigs.size(); ++s)
+        {
+            const auto pattern_size = sigs[s].pattern.size();
+            vector_end[s] = anchors[s] && size >= pattern_size + block_size - 1 ? size - pattern_size - block_size + 2 : 0;
+            sweep_end = max(sweep_end, vector_end[s]);
+        }
 
-        for (size_t j = 0; j < pattern_size; j++)
+        for (size_t i = 0; i < sweep_end; i += block_size)
         {
-            if (mask[j] != '?' && pattern[j] != start[i + j])
+            for (size_t s = 0; s < sigs.size(); ++s)
             {
-                found = false;
-                break;
+                if (i >= vector_end[s])
+                    continue;
+
+                const auto& anchor = *anchors[s];
+                const auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(start + i + anchor.first));
+                const auto block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(start + i + anchor.last));
+                auto candidates = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, anchor.first_byte), _mm_cmpeq_epi8(block_last, anchor.last_byte))));
+
+                while (candidates)
+                {
+                    unsigned long bit;
+                    _BitScanForward(&bit, candidates);
+                    candidates &= candidates - 1;
+
+                    if (matches_signature(sigs[s], start + i + bit))
+                        occurrences[s].push_back(start + i + bit);
+                }
             }
         }
 
-        if (found)
-            occurrences.push_back(start + i);
+        for (size_t s = 0; s < sigs.size(); ++s)
+        {
+            const auto pattern_size = sigs[s].pattern.size();
+
+            if (!anchors[s] || size < pattern_size)
+                continue;
+
+            // first position not covered by a block
+            for (size_t i = (vector_end[s] + block_size - 1) & ~(block_size - 1); i <= size - pattern_size; i++)
+            {
+                if (matches_signature(sigs[s], start + i))
+                    occurrences[s].push_back(start + i);
+            }
+        }
     }
 
     return occurrences;
 }
 
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept : view(other.view), view_size(other.view_size)
+{
+    other.view = nullptr;
+    other.view_size = 0;
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        view = other.view;
+        view_size = other.view_size;
+        other.view = nullptr;
+        other.view_size = 0;
+    }
+
+    return *this;
+}
+
 /**
- * Loads the bitmap file from the specified path
+ * Maps the whole file read-only, the view keeps the file alive so both handles are closed right away
+ * @param path Path to the file
+ * @return True on success
+ */
+bool mapped_file::open(const std::wstring& path)
+{
+    close();
+
+    const auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        SPDLOG_ERROR("failed to open file {}, error {}", wstr_to_str_or_default(path), GetLastError());
+        return false;
+    }
+
+    LARGE_INTEGER file_size{};
+
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        SPDLOG_ERROR("failed to get size of file {}", wstr_to_str_or_default(path));
+        CloseHandle(file);
+        return false;
+    }
+
+    const auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+
+    if (mapping == nullptr)
+    {
+        SPDLOG_ERROR("failed to create file mapping for {}, error {}", wstr_to_str_or_default(path), GetLastError());
+        return false;
+    }
+
+    view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+
+    if (view == nullptr)
+    {
+        SPDLOG_ERROR("failed to map view of {}, error {}", wstr_to_str_or_default(path), GetLastError());
+        return false;
+    }
+
+    view_size = static_cast<size_t>(file_size.QuadPart);
+
+    return true;
+}
+
+void mapped_file::close()
+{
+    if (view != nullptr)
+        UnmapViewOfFile(view);
+
+    view = nullptr;
+    view_size = 0;
+}
+
+/**
+ * Folds a name to upper case, the same way for inserts and lookups
+ * @param name The name
+ * @param out Buffer of MAX_NAME_LEN characters
+ * @return Length of the folded name, 0 if the name is empty or too long
+ */
+size_t name_map::fold(const std::wstring_view name, wchar_t* out)
+{
+    if (name.empty() || name.size() > MAX_NAME_LEN)
+        return 0;
+
+    const auto len = LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, name.data(), static_cast<int>(name.size()), out, static_cast<int>(MAX_NAME_LEN), nullptr, nullptr, 0);
+
+    return len > 0 ? static_cast<size_t>(len) : 0;
+}
+
+/**
+ * Adds a name, a name that is already present gets the new value
+ * @param name The name
+ * @param value Value returned by find
+ */
+void name_map::insert(const std::wstring_view name, std::wstring value)
+{
+    wchar_t folded[MAX_NAME_LEN];
+    const auto len = fold(name, folded);
+
+    if (len == 0)
+    {
+        SPDLOG_ERROR("invalid name {}", wstr_to_str_or_default(std::wstring(name)));
+        return;
+    }
+
+    const std::wstring_view key(folded, len);
+    const auto it = entries.find(key);
+
+    if (it != entries.end())
+    {
+        it->second = std::move(value);
+        return;
+    }
+
+    entries.emplace(storage.emplace_back(key), std::move(value));
+}
+
+/**
+ * @param name The name to look up, case-insensitive
+ * @return The value of the name, nullptr if the name isn't present
+ */
+const std::wstring* name_map::find(const std::wstring_view name) const
+{
+    if (entries.empty())
+        return nullptr;
+
+    wchar_t folded[MAX_NAME_LEN];
+    const auto len = fold(name, folded);
+
+    if (len == 0)
+        return nullptr;
+
+    const auto it = entries.find(std::wstring_view(folded, len));
+
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+/**
+ * Maps the bitmap file from the specified path and checks its headers
  * @param path Path to bitmap
- * @param target Target buffer
+ * @param target Target mapping
  * @return True on success
  */
-bool load_bitmap(const std::wstring& path, std::vector<uint8_t>& target)
+bool load_bitmap(const std::wstring& path, mapped_file& target)
 {
-    std::ifstream f(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!target.open(path))
+        return false;
+
+    if (target.size() < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) ||
+        reinterpret_cast<const BITMAPFILEHEADER*>(target.data())->bfType != 0x4D42)
+    {
+        SPDLOG_ERROR("{} is not a bitmap file", wstr_to_str_or_default(path));
+        target.close();
+        return false;
+    }
+
+    return true;
+}
 
-    if (!f.is_open())
+/**
+ * Converts the pixel data of a 24 or 32 bit bitmap file to top-down BGRA rows
+ * @param bitmap_file The complete bitmap file
+ * @param pixels Target buffer
+ * @param width Width of the bitmap
+ * @param height Height of the bitmap
+ * @return True on success
+ */
+bool bitmap_to_bgra(const byte_view_t& bitmap_file, std::vector<uint32_t>& pixels, uint32_t& width, uint32_t& height)
+{
+    if (bitmap_file.size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
     {
-        SPDLOG_ERROR("failed to open file {}", *wstr_to_str(path));
+        SPDLOG_ERROR("bitmap file too small");
         return false;
     }
 
-    const auto size = f.tellg();
-    f.seekg(0, std::ios::beg);
-    target.assign(size, '\0');
+    const auto file_header = reinterpret_cast<const BITMAPFILEHEADER*>(bitmap_file.data);
+    const auto info_header = reinterpret_cast<const BITMAPINFOHEADER*>(bitmap_file.data + sizeof(BITMAPFILEHEADER));
+    const uint32_t bytes_per_pixel = info_header->biBitCount / 8;
 
-    if (!f.read(reinterpret_cast<char*>(target.data()), size))
+    if (info_header->biCompression != BI_RGB || (bytes_per_pixel != 3 && bytes_per_pixel != 4) || info_header->biWidth <= 0 || info_header->biHeight == 0)
     {
-        SPDLOG_ERROR("failed to read file {}", *wstr_to_str(path));
+        SPDLOG_ERROR("unsupported bitmap format");
         return false;
     }
 
+    width = info_header->biWidth;
+    height = std::abs(info_header->biHeight);
+
+    const bool bottom_up = info_header->biHeight > 0;
+    const size_t stride = (width * info_header->biBitCount + 31) / 32 * 4;
+
+    if (file_header->bfOffBits + stride * height > bitmap_file.size)
+    {
+        SPDLOG_ERROR("bitmap pixel data truncated");
+        return false;
+    }
+
+    pixels.resize(static_cast<size_t>(width) * height);
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const auto row = &bitmap_file.data[file_header->bfOffBits + stride * (bottom_up ? height - 1 - y : y)];
+
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const auto px = &row[x * bytes_per_pixel];
+            pixels[static_cast<size_t>(y) * width + x] = 0xFF000000u | px[2] << 16 | px[1] << 8 | px[0];
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Fills the pixel buffer of a 24 or 32 bit DIB section with a single color
+ * @param bits Pixel buffer returned by CreateDIBSection
+ * @param header Header that was passed to CreateDIBSection
+ * @param color The fill color
+ * @return True if the format is supported and the buffer was filled
+ */
+bool fill_dib(void* bits, const BITMAPINFOHEADER& header, const COLORREF color)
+{
+    if (bits == nullptr || header.biCompression != BI_RGB || (header.biBitCount != 24 && header.biBitCount != 32))
+        return false;
+
+    const uint32_t width = header.biWidth;
+    const uint32_t height = std::abs(header.biHeight);
+    const size_t stride = (width * header.biBitCount + 31) / 32 * 4;
+    const uint8_t bgr[3] = {GetBValue(color), GetGValue(color), GetRValue(color)};
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const auto row = static_cast<uint8_t*>(bits) + stride * y;
+
+        if (header.biBitCount == 32)
+        {
+            std::fill_n(reinterpret_cast<uint32_t*>(row), width, static_cast<uint32_t>(bgr[2] << 16 | bgr[1] << 8 | bgr[0]));
+            continue;
+        }
+
+        for (uint32_t x = 0; x < width; ++x)
+            memcpy(&row[x * 3], bgr, 3);
+    }
+
     return true;
 }
 
@@ -279,8 +587,13 @@ std::optional<std::wstring> get_userprofile_path()
     return result;
 }
 
+// the only strong reference, the file is written by its thread until stop_async_logging
+static std::shared_ptr<spdlog::details::thread_pool> log_thread_pool;
+
 /**
- * Initializes logging library to log to a file
+ * Sets up the default logger, messages are formatted on the calling thread and written to the file by a background thread
+ * The queue is bounded, when it is full the oldest messages are dropped instead of blocking the hooks
+ * Repetitions of the same message within LOG_DUP_FILTER_SECONDS are collapsed into a single "Skipped n duplicate messages"
  */
 void setup_logging()
 {
@@ -298,7 +611,13 @@ void setup_logging()
 
     try
     {
-        const auto logger = spdlog::rotating_logger_mt("vmchroma_logger", log_file_path, 1048576 * 5, 1);
+        const auto file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(log_file_path, 1048576 * 5, 1);
+        const auto dup_filter = std::make_shared<spdlog::sinks::dup_filter_sink_mt>(std::chrono::seconds(LOG_DUP_FILTER_SECONDS));
+        dup_filter->add_sink(file_sink);
+
+        log_thread_pool = std::make_shared<spdlog::details::thread_pool>(LOG_QUEUE_SIZE, 1);
+        const auto logger = std::make_shared<spdlog::async_logger>("vmchroma_logger", dup_filter, log_thread_pool, spdlog::async_overflow_policy::overrun_oldest);
+
         spdlog::set_default_logger(logger);
         spdlog::set_pattern("[%d.%m.%Y %H:%M:%S] [%l] %s %!:%# %v");
         spdlog::set_level(spdlog::level::err);
@@ -310,6 +629,36 @@ void setup_logging()
     }
 }
 
+/**
+ * Sets the runtime log level, messages below SPDLOG_ACTIVE_LEVEL are compiled out regardless
+ * @param level One of trace, debug, info, warn, error, critical or off
+ */
+void set_log_level(const std::string& level)
+{
+    spdlog::set_level(spdlog::level::from_str(level));
+}
+
+/**
+ * Writes the queued messages and switches the default logger to write synchronously on the calling thread
+ * Must be called before the process exits and never from DllMain, the background thread is joined
+ */
+void stop_async_logging()
+{
+    if (!log_thread_pool)
+        return;
+
+    const auto async_logger = spdlog::default_logger();
+    const auto sync_logger = std::make_shared<spdlog::logger>(async_logger->name(), async_logger->sinks().begin(), async_logger->sinks().end());
+    sync_logger->set_level(async_logger->level());
+    sync_logger->flush_on(async_logger->flush_level());
+
+    spdlog::set_default_logger(sync_logger);
+    async_logger->flush();
+
+    // the pool drains its queue before its thread exits
+    log_thread_pool.reset();
+}
+
 std::optional<uint8_t*> find_code_cave(uint8_t* base_handle, const size_t size)
 {
     const auto dos_header = reinterpret_cast<PIMAGE_DOS_HEADER>(base_handle);
@@ -344,28 +693,39 @@ std::optional<uint8_t*> find_code_cave(uint8_t* base_handle, const size_t size)
     return ptr_text_end;
 }
 
-std::optional<std::wstring> get_path_for_pid(DWORD pid)
+/**
+ * @param process Process handle with at least PROCESS_QUERY_LIMITED_INFORMATION access
+ * @return Full path of the executable
+ */
+std::optional<std::wstring> get_path_for_process(HANDLE process)
 {
-    const auto proc = o_OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    std::wstring proc_name(MAX_PATH, '\0');
 
-    if (!proc)
+    DWORD bufferSize = MAX_PATH;
+    if (!QueryFullProcessImageName(process, 0, proc_name.data(), &bufferSize))
     {
-        SPDLOG_ERROR("error OpenProcess for pid {}", pid);
+        SPDLOG_ERROR("error QueryFullProcessImageName for pid {}", GetProcessId(process));
         return std::nullopt;
     }
 
-    std::wstring proc_name(MAX_PATH, '\0');
+    proc_name.resize(bufferSize);
+    return proc_name;
+}
 
-    DWORD bufferSize = MAX_PATH;
-    if (!QueryFullProcessImageName(proc, 0, proc_name.data(), &bufferSize))
+std::optional<std::wstring> get_path_for_pid(DWORD pid)
+{
+    const auto proc = o_OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+
+    if (!proc)
     {
-        SPDLOG_ERROR("error QueryFullProcessImageName for pid {}", pid);
+        SPDLOG_ERROR("error OpenProcess for pid {}", pid);
         return std::nullopt;
     }
 
+    auto proc_name = get_path_for_process(proc);
+
     CloseHandle(proc);
 
-    proc_name.resize(bufferSize);
     return proc_name;
 }
 
@@ -388,8 +748,18 @@ std::optional<std::wstring> get_exe_product_name_for_pid(DWORD pid)
     if (!proc_name)
         return std::nullopt;
 
+    return get_exe_product_name(*proc_name);
+}
+
+/**
+ * Reads the product name from the version info of an executable, aliases from the config are applied
+ * @param path Full path of the executable
+ * @return The product name
+ */
+std::optional<std::wstring> get_exe_product_name(const std::wstring& path)
+{
     DWORD dummy;
-    const auto version_info_size = GetFileVersionInfoSize(proc_name->c_str(), &dummy);
+    const auto version_info_size = GetFileVersionInfoSize(path.c_str(), &dummy);
 
     if (version_info_size == 0)
         return std::nullopt;
@@ -397,7 +767,7 @@ std::optional<std::wstring> get_exe_product_name_for_pid(DWORD pid)
     std::vector<char> version_info(version_info_size);
 
     // call the hooked function on purpose, so it can return a custom name, if set
-    if (!GetFileVersionInfoW(proc_name->c_str(), 0, version_info_size, version_info.data()))
+    if (!GetFileVersionInfoW(path.c_str(), 0, version_info_size, version_info.data()))
     {
         SPDLOG_ERROR("GetFileVersionInfo failed");
         return std::nullopt;
@@ -434,12 +804,185 @@ std::optional<std::wstring> get_exe_product_name_for_pid(DWORD pid)
     return std::nullopt;
 }
 
+/**
+ * @param path Path of the executable
+ * @return The file version from the fixed version info, major and minor in the upper 32 bits
+ */
+std::optional<uint64_t> get_exe_file_version(const std::wstring& path)
+{
+    DWORD dummy;
+    const auto version_info_size = GetFileVersionInfoSize(path.c_str(), &dummy);
+
+    if (version_info_size == 0)
+        return std::nullopt;
+
+    std::vector<char> version_info(version_info_size);
+
+    if (!o_GetFileVersionInfoW(path.c_str(), 0, version_info_size, version_info.data()))
+    {
+        SPDLOG_ERROR("GetFileVersionInfo failed");
+        return std::nullopt;
+    }
+
+    VS_FIXEDFILEINFO* file_info = nullptr;
+    UINT file_info_len = 0;
+
+    if (!o_VerQueryValueW(version_info.data(), L"\\", reinterpret_cast<LPVOID*>(&file_info), &file_info_len) || file_info_len < sizeof(VS_FIXEDFILEINFO))
+    {
+        SPDLOG_ERROR("VerQueryValue failed");
+        return std::nullopt;
+    }
+
+    return static_cast<uint64_t>(file_info->dwFileVersionMS) << 32 | file_info->dwFileVersionLS;
+}
+
+/**
+ * Fills the fields of a patch cache that identify the running executable
+ * @param base_handle Base address of the main module
+ * @param key Target, the patch sites are left untouched
+ * @return True on success
+ */
+static bool get_patch_cache_key(uint8_t* base_handle, patch_cache_t& key)
+{
+    const auto dos_header = reinterpret_cast<PIMAGE_DOS_HEADER>(base_handle);
+    const auto nt_headers = reinterpret_cast<PIMAGE_NT_HEADERS>(base_handle + dos_header->e_lfanew);
+
+    std::wstring executable_name(MAX_PATH, '\0');
+
+    if (!GetModuleFileName(nullptr, executable_name.data(), MAX_PATH))
+    {
+        SPDLOG_ERROR("GetModuleFileName failed");
+        return false;
+    }
+
+    const auto file_version = get_exe_file_version(executable_name.c_str());
+
+    if (!file_version)
+        return false;
+
+    key.version = PATCH_CACHE_VERSION;
+    key.time_date_stamp = nt_headers->FileHeader.TimeDateStamp;
+    key.checksum = nt_headers->OptionalHeader.CheckSum;
+    key.file_version = *file_version;
+
+    return true;
+}
+
+/**
+ * Checks that a patch cache belongs to the running executable and that every cached site still matches its signature
+ * @param base_handle Base address of the main module
+ * @param cache The cached patch sites
+ * @param sigs The signatures the sites were found with
+ * @param cave_size Number of free bytes needed at the code cave
+ * @return True if the cached sites can be patched without a scan
+ */
+static bool is_patch_cache_valid(uint8_t* base_handle, const patch_cache_t& cache, const std::vector<signature_t>& sigs, const size_t cave_size)
+{
+    patch_cache_t key{};
+
+    if (!get_patch_cache_key(base_handle, key))
+        return false;
+
+    if (cache.version != key.version || cache.time_date_stamp != key.time_date_stamp || cache.checksum != key.checksum || cache.file_version != key.file_version)
+        return false;
+
+    const auto nt_headers = reinterpret_cast<PIMAGE_NT_HEADERS>(base_handle + reinterpret_cast<PIMAGE_DOS_HEADER>(base_handle)->e_lfanew);
+    const size_t image_size = nt_headers->OptionalHeader.SizeOfImage;
+
+    if (cache.cave_rva > image_size || cave_size > image_size - cache.cave_rva)
+        return false;
+
+    for (size_t i = 0; i < cave_size; ++i)
+    {
+        if (base_handle[cache.cave_rva + i] != 0)
+            return false;
+    }
+
+    for (const auto& site : cache.sites)
+    {
+        if (site.signature >= sigs.size() || site.rva > image_size || sigs[site.signature].pattern.size() > image_size - site.rva)
+            return false;
+
+        if (!matches_signature(sigs[site.signature], base_handle + site.rva))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Finds the code cave and the patch sites with a full scan
+ * @param base_handle Base address of the main module
+ * @param sigs The signatures of the patch sites
+ * @param cave_size Number of free bytes needed at the code cave
+ * @param cache Target, filled on success
+ * @return True if the code cave and exactly one site per cache slot were found
+ */
+static bool resolve_patch_sites(uint8_t* base_handle, const std::vector<signature_t>& sigs, const size_t cave_size, patch_cache_t& cache)
+{
+    const auto ptr_text_end_opt = find_code_cave(base_handle, cave_size);
+
+    if (!ptr_text_end_opt)
+    {
+        SPDLOG_ERROR("failed to get address of .text section");
+        return false;
+    }
+
+    const auto occurrences = find_signatures(base_handle, sigs);
+
+    std::vector<patch_site_t> merged;
+
+    for (uint32_t s = 0; s < occurrences.size(); ++s)
+    {
+        for (const auto ptr : occurrences[s])
+            merged.push_back({static_cast<uint32_t>(ptr - base_handle), s});
+    }
+
+    if (merged.size() != std::size(cache.sites))
+    {
+        SPDLOG_ERROR("failed to find instructions to patch");
+        return false;
+    }
+
+    if (!get_patch_cache_key(base_handle, cache))
+        return false;
+
+    cache.cave_rva = static_cast<uint32_t>(*ptr_text_end_opt - base_handle);
+    std::copy(merged.begin(), merged.end(), cache.sites);
+
+    return true;
+}
+
+/**
+ * @return The signatures of the two mulss instructions that scale the mouse wheel step of the 64 bit executable
+ */
+std::vector<signature_t> get_scroll_signatures64()
+{
+    const signature_t sig_mulss1 = {{0xF3, 0x0F, 0x59, 0x05, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x28, 0xF2, 0xF3, 0x0F, 0x5C, 0xF0, 0x0F, 0x2F, 0xCE}, {"xxxx????xxxxxxxxxx"}};
+    const signature_t sig_mulss2 = {{0xF3, 0x0F, 0x59, 0x05, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x10, 0x94, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x28, 0xF2}, {"xxxx????xxxx?????xxx"}};
+
+    return {sig_mulss1, sig_mulss2};
+}
+
+/**
+ * @return The signatures of the two fmul instructions that scale the mouse wheel step of the 32 bit executable
+ */
+std::vector<signature_t> get_scroll_signatures32()
+{
+    const signature_t sig_fmul1 = {{0xD9, 0x0, 0x0, 0x0, 0xDB, 0x45, 0x00, 0xDC, 0x0D}, "x???xx?xx"};
+    const signature_t sig_fmul2 = {{0xD9, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0xDB, 0x45, 0x0, 0xDC, 0x0D}, "x??????xx?xx"};
+
+    return {sig_fmul1, sig_fmul2};
+}
+
 /**
  * Patches the mulss/fmul instructions to change the mouse wheel scroll dB value multiplier
  * @param ptr_scroll_value Pointer to the scroll step value
+ * @param cache Patch sites of a previous start, replaced with the resolved sites if a scan was needed
+ * @param cache_hit Set to true if the cached sites were used
  * @return True if patches successfully
  */
-bool apply_scroll_patch64(float* ptr_scroll_value)
+bool apply_scroll_patch64(float* ptr_scroll_value, patch_cache_t& cache, bool& cache_hit)
 {
     const auto base_handle = reinterpret_cast<uint8_t*>(GetModuleHandle(nullptr));
 
@@ -460,15 +1003,14 @@ bool apply_scroll_patch64(float* ptr_scroll_value)
 
     memcpy_s(&shellcode_multiply[3], 8, &ptr_scroll_value, 8);
 
-    const auto ptr_text_end_opt = find_code_cave(base_handle, sizeof(shellcode_multiply));
+    const auto sigs = get_scroll_signatures64();
 
-    if (!ptr_text_end_opt)
-    {
-        SPDLOG_ERROR("failed to get address of .text section");
+    cache_hit = is_patch_cache_valid(base_handle, cache, sigs, sizeof(shellcode_multiply));
+
+    if (!cache_hit && !resolve_patch_sites(base_handle, sigs, sizeof(shellcode_multiply), cache))
         return false;
-    }
 
-    const auto ptr_text_end = *ptr_text_end_opt;
+    const auto ptr_text_end = base_handle + cache.cave_rva;
 
     DWORD dummy;
 
@@ -486,25 +1028,8 @@ bool apply_scroll_patch64(float* ptr_scroll_value)
         return false;
     }
 
-    const signature_t sig_mulss1 = {{0xF3, 0x0F, 0x59, 0x05, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x28, 0xF2, 0xF3, 0x0F, 0x5C, 0xF0, 0x0F, 0x2F, 0xCE}, {"xxxx????xxxxxxxxxx"}};
-    const signature_t sig_mulss2 = {{0xF3, 0x0F, 0x59, 0x05, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x10, 0x94, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x28, 0xF2}, {"xxxx????xxxx?????xxx"}};
-
-    const auto mulss1_occurrences = find_signatures(sig_mulss1);
-    const auto mulss2_occurrences = find_signatures(sig_mulss2);
-
-    std::vector<uint8_t*> mulss_merged;
-
-    mulss_merged.insert(mulss_merged.end(), mulss1_occurrences.begin(), mulss1_occurrences.end());
-    mulss_merged.insert(mulss_merged.end(), mulss2_occurrences.begin(), mulss2_occurrences.end());
-
-    if (mulss_merged.size() != 2)
-    {
-        SPDLOG_ERROR("failed to find instructions to patch");
-        return false;
-    }
-
-    const auto mulss1 = mulss_merged[0];
-    const auto mulss2 = mulss_merged[1];
+    const auto mulss1 = base_handle + cache.sites[0].rva;
+    const auto mulss2 = base_handle + cache.sites[1].rva;
 
     uint8_t shellcode_call[] = {
         0xE8, 0x00, 0x00, 0x00, 0x00, // call <shellcode_multiply>
@@ -536,7 +1061,7 @@ bool apply_scroll_patch64(float* ptr_scroll_value)
     return true;
 }
 
-bool apply_scroll_patch32(float* ptr_scroll_value)
+bool apply_scroll_patch32(float* ptr_scroll_value, patch_cache_t& cache, bool& cache_hit)
 {
     const auto base_handle = reinterpret_cast<uint8_t*>(GetModuleHandle(nullptr));
 
@@ -556,15 +1081,14 @@ bool apply_scroll_patch32(float* ptr_scroll_value)
 
     memcpy_s(&shellcode_multiply[2], 4, &ptr_scroll_value, 4);
 
-    const auto ptr_text_end_opt = find_code_cave(base_handle, sizeof(shellcode_multiply));
+    const auto sigs = get_scroll_signatures32();
 
-    if (!ptr_text_end_opt)
-    {
-        SPDLOG_ERROR("failed to get address of .text section");
+    cache_hit = is_patch_cache_valid(base_handle, cache, sigs, sizeof(shellcode_multiply));
+
+    if (!cache_hit && !resolve_patch_sites(base_handle, sigs, sizeof(shellcode_multiply), cache))
         return false;
-    }
 
-    const auto ptr_text_end = *ptr_text_end_opt;
+    const auto ptr_text_end = base_handle + cache.cave_rva;
 
     DWORD dummy;
 
@@ -582,25 +1106,8 @@ bool apply_scroll_patch32(float* ptr_scroll_value)
         return false;
     }
 
-    const signature_t sig_fmul1 = {{0xD9, 0x0, 0x0, 0x0, 0xDB, 0x45, 0x00, 0xDC, 0x0D}, "x???xx?xx"};
-    const signature_t sig_fmul2 = {{0xD9, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0xDB, 0x45, 0x0, 0xDC, 0x0D}, "x??????xx?xx"};
-
-    const auto fmul1_occurrences = find_signatures(sig_fmul1);
-    const auto fmul2_occurrences = find_signatures(sig_fmul2);
-
-    std::vector<uint8_t*> fmul_merged;
-
-    fmul_merged.insert(fmul_merged.end(), fmul1_occurrences.begin(), fmul1_occurrences.end());
-    fmul_merged.insert(fmul_merged.end(), fmul2_occurrences.begin(), fmul2_occurrences.end());
-
-    if (fmul_merged.size() != 2)
-    {
-        SPDLOG_ERROR("failed to find instructions to patch");
-        return false;
-    }
-
-    const auto fmul1 = fmul_merged[0] + 7;
-    const auto fmul2 = fmul_merged[1] + 10;
+    const auto fmul1 = base_handle + cache.sites[0].rva + 7;
+    const auto fmul2 = base_handle + cache.sites[1].rva + 10;
 
     uint8_t shellcode_call[] = {
         0xE8, 0x00, 0x00, 0x00, 0x00, // call <shellcode_multiply>
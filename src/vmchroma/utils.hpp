@@ -18,8 +18,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 #include <windows.h>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <unordered_map>
 
 #include <spdlog/spdlog.h>
 
@@ -70,16 +73,107 @@ typedef struct dialogbox_initparam
     int32_t unk2;
 } dialogbox_initparam_t;
 
+typedef struct color_mapping
+{
+    COLORREF from;
+    COLORREF to;
+} color_mapping_t;
+
+typedef struct themed_dib
+{
+    HBITMAP bitmap;
+    void* bits;
+    BITMAPINFOHEADER header;
+} themed_dib_t;
+
+typedef struct byte_view
+{
+    const uint8_t* data;
+    size_t size;
+} byte_view_t;
+
 typedef struct signature
 {
     std::vector<uint8_t> pattern;
     std::string mask;
 } signature_t;
 
+typedef struct patch_site
+{
+    uint32_t rva;
+    // index of the signature the site was found with
+    uint32_t signature;
+} patch_site_t;
+
+constexpr uint32_t PATCH_CACHE_VERSION = 1;
+
+// messages the log queue holds before the oldest are dropped
+constexpr size_t LOG_QUEUE_SIZE = 8192;
+constexpr uint32_t LOG_DUP_FILTER_SECONDS = 5;
+
+// patch sites of the scroll patch, stored so the signature scan only runs after a Voicemeeter update
+typedef struct patch_cache
+{
+    uint32_t version;
+    // identify the executable the sites were resolved for
+    uint32_t time_date_stamp;
+    uint32_t checksum;
+    uint32_t cave_rva;
+    uint64_t file_version;
+    patch_site_t sites[2];
+} patch_cache_t;
+
 typedef LRESULT (WNDPROC_SUB_CALL *o_WndProc_chldwnd_t)(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam, uint64_t a5);
 
 namespace utils
 {
+/**
+ * Read-only view of a file mapped into memory, unmapped on destruction
+ */
+class mapped_file
+{
+    const uint8_t* view = nullptr;
+    size_t view_size = 0;
+
+public:
+    mapped_file() = default;
+    ~mapped_file();
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) noexcept;
+    mapped_file& operator=(mapped_file&& other) noexcept;
+    bool open(const std::wstring& path);
+    void close();
+    bool is_open() const { return view != nullptr; }
+    const uint8_t* data() const { return view; }
+    size_t size() const { return view_size; }
+    byte_view_t bytes() const { return {view, view_size}; }
+};
+
+/**
+ * Case-insensitive map of file names, names are folded to upper case once on insert
+ * Lookups fold the name into a stack buffer, so they don't allocate
+ */
+class name_map
+{
+    static constexpr size_t MAX_NAME_LEN = MAX_PATH;
+
+    // the keys point into storage, std::deque never moves its elements
+    std::deque<std::wstring> storage;
+    std::unordered_map<std::wstring_view, std::wstring> entries;
+
+    static size_t fold(std::wstring_view name, wchar_t* out);
+
+public:
+    name_map() = default;
+    name_map(const name_map&) = delete;
+    name_map& operator=(const name_map&) = delete;
+    void insert(std::wstring_view name, std::wstring value = {});
+    const std::wstring* find(std::wstring_view name) const;
+    bool contains(std::wstring_view name) const { return find(name) != nullptr; }
+    bool empty() const { return entries.empty(); }
+};
+
 void mbox(const std::wstring& msg);
 void mbox_error(const std::wstring& msg);
 void attach_console_debug();
@@ -92,12 +186,21 @@ std::optional<COLORREF> hex_to_colorref(const std::string& hex);
 std::optional<uint8_t*> find_code_cave(uint8_t* base_handle, size_t size);
 std::optional<std::wstring> get_exe_image_name_for_pid(DWORD pid);
 std::optional<std::wstring> get_exe_product_name_for_pid(DWORD pid);
-std::vector<uint8_t*> find_signatures(const signature_t& sig);
-bool load_bitmap(const std::wstring& path, std::vector<uint8_t>& target);
+std::optional<std::wstring> get_exe_product_name(const std::wstring& path);
+std::optional<std::wstring> get_path_for_process(HANDLE process);
+std::vector<std::vector<uint8_t*>> find_signatures(uint8_t* base_handle, const std::vector<signature_t>& sigs);
+bool load_bitmap(const std::wstring& path, mapped_file& target);
+bool bitmap_to_bgra(const byte_view_t& bitmap_file, std::vector<uint32_t>& pixels, uint32_t& width, uint32_t& height);
+bool fill_dib(void* bits, const BITMAPINFOHEADER& header, COLORREF color);
 std::optional<std::wstring> get_userprofile_path();
 void setup_logging();
-bool apply_scroll_patch64(float* ptr_scroll_value);
-bool apply_scroll_patch32(float* ptr_scroll_value);
+void set_log_level(const std::string& level);
+void stop_async_logging();
+std::optional<uint64_t> get_exe_file_version(const std::wstring& path);
+std::vector<signature_t> get_scroll_signatures64();
+std::vector<signature_t> get_scroll_signatures32();
+bool apply_scroll_patch64(float* ptr_scroll_value, patch_cache_t& cache, bool& cache_hit);
+bool apply_scroll_patch32(float* ptr_scroll_value, patch_cache_t& cache, bool& cache_hit);
 bool hook_single_fn(PVOID* o_fn, PVOID hk_fn);
 
 /**
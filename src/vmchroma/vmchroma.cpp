@@ -21,6 +21,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <string>
 #include <optional>
 #include <vector>
+#include <algorithm>
+#include <utility>
 #include <shlwapi.h>
 #include <filesystem>
 #include <shlobj.h>
@@ -34,37 +36,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "winapi_hook_defs.hpp"
 #include "window_manager.hpp"
 #include "config_manager.hpp"
+#include "frame_trace.hpp"
+#include "app_identity_cache.hpp"
+#include "session_monitor.hpp"
+#include "gdi_cache.hpp"
+#include "hook_registry.hpp"
+#include "perf_stats.hpp"
+#include "trace.hpp"
+#include "update_pacer.hpp"
 #include "spdlog/fmt/bundled/ranges.h"
 
-//******************//
-//      WINAPI      //
-//******************//
-
-HANDLE (WINAPI *o_CreateMutexA)(LPSECURITY_ATTRIBUTES lpMutexAttributes, BOOL bInitialOwner, LPCSTR lpName) = CreateMutexA;
-HFONT (WINAPI *o_CreateFontIndirectA)(const LOGFONTA* lplf) = CreateFontIndirectA;
-BOOL (WINAPI *o_AppendMenuA)(HMENU hMenu, UINT uFlags, UINT_PTR uIDNewItem, LPCSTR lpNewItem) = AppendMenuA;
-HPEN (WINAPI *o_CreatePen)(int iStyle, int cWidth, COLORREF color) = CreatePen;
-HBRUSH (WINAPI *o_CreateBrushIndirect)(const LOGBRUSH* plbrush) = CreateBrushIndirect;
-COLORREF (WINAPI *o_SetTextColor)(HDC hdc, COLORREF color) = SetTextColor;
-ATOM (WINAPI *o_RegisterClassA)(const WNDCLASSA* lpWndClass) = RegisterClassA;
-BOOL (WINAPI *o_Rectangle)(HDC hdc, int left, int top, int right, int bottom) = Rectangle;
-HBITMAP (WINAPI *o_CreateDIBSection)(HDC hdc, const BITMAPINFO* pbmi, UINT usage, void** ppvBits, HANDLE hSection, DWORD offset) = CreateDIBSection;
-HDC (WINAPI *o_BeginPaint)(HWND hWnd, LPPAINTSTRUCT lpPaint) = BeginPaint;
-UINT_PTR (WINAPI *o_SetTimer)(HWND hWnd, UINT_PTR nIDEvent, UINT uElapse, TIMERPROC lpTimerFunc) = SetTimer;
-HDC (WINAPI *o_GetDC)(HWND hWnd) = GetDC;
-int (WINAPI *o_ReleaseDC)(HWND hWnd, HDC hDC) = ReleaseDC;
-BOOL (WINAPI *o_SetWindowPos)(HWND hWnd, HWND hWndInsertAfter, int X, int Y, int cx, int cy, UINT uFlags) = SetWindowPos;
-BOOL (WINAPI *o_TrackPopupMenu)(HMENU hMenu, UINT uFlags, int x, int y, int nReserved, HWND hWnd, const RECT* prcRect) = TrackPopupMenu;
-BOOL (WINAPI *o_GetClientRect)(HWND hWnd, LPRECT lpRect) = GetClientRect;
-HWND (WINAPI *o_CreateWindowExA)(DWORD dwExStyle, LPCSTR lpClassName, LPCSTR lpWindowName, DWORD dwStyle, int X, int Y, int nWidth, int nHeight, HWND hWndParent, HMENU hMenu, HINSTANCE hInstance, LPVOID lpParam) = CreateWindowExA;
-INT_PTR (WINAPI *o_DialogBoxIndirectParamA)(HINSTANCE hInstance, LPCDLGTEMPLATEA hDialogTemplate, HWND hWndParent, DLGPROC lpDialogFunc, LPARAM dwInitParam) = DialogBoxIndirectParamA;
-HRESULT (WINAPI *o_CoCreateInstance)(REFCLSID rclsid, LPUNKNOWN pUnkOuter, DWORD dwClsContext, REFIID riid, LPVOID* ppv) = CoCreateInstance;
-int (WINAPI *o_InternalGetWindowText)(HWND hWnd, LPWSTR pString, int cchMaxCount) = InternalGetWindowText;
-BOOL (WINAPI *o_GetFileVersionInfoW)(LPCWSTR lptstrFilename, DWORD dwHandle, DWORD dwLen, LPVOID lpData) = GetFileVersionInfoW;
-BOOL (WINAPI *o_VerQueryValueW)(LPCVOID pBlock, LPCWSTR lpSubBlock, LPVOID* lplpBuffer, PUINT puLen) = VerQueryValueW;
-HANDLE (WINAPI *o_OpenProcess)(DWORD dwDesiredAccess, BOOL bInheritHandle, DWORD dwProcessId) = OpenProcess;
-DWORD (WINAPI *o_GetModuleFileNameA)(HMODULE hModule, LPSTR lpFilename, DWORD nSize) = GetModuleFileNameA;
-
 //******************//
 //       COM        //
 //******************//
@@ -89,9 +70,30 @@ static o_WndProc_chldwnd_t o_WndProc_comp = nullptr;
 static o_WndProc_chldwnd_t o_WndProc_denoiser = nullptr;
 static o_WndProc_chldwnd_t o_WndProc_wdb = nullptr;
 static HMENU tray_menu = nullptr;
+static HMENU perf_menu = nullptr;
 static std::wstring file_version_buffer;
+static std::vector<themed_dib_t> themed_dibs;
+static app_identity_cache app_cache;
+static std::unique_ptr<session_monitor> audio_sessions;
+static hook_registry hooks;
+static update_pacer pacer;
+static gdi_cache gdi_objects;
+static frame_recorder recorder;
+// the trace is recorded once per process, later erases must not truncate it
+static bool recording_started = false;
+
+// font heights of Voicemeeter that are replaced, all others are kept
+static constexpr std::pair<LONG, LONG> FONT_HEIGHT_MAP[] = {
+    {20, 18}, // input custom label
+    {16, 15}, // master section fader
+};
 
 bool apply_hooks();
+byte_view_t get_theme_pixels(const BITMAPINFOHEADER& header);
+void reload_theme();
+void apply_log_level();
+void set_main_visible(HWND hwnd, bool visible);
+void start_recording(const window_ctx_t& wctx, uint32_t frame_count);
 
 //*****************************//
 //      HOOKED FUNCTIONS       //
@@ -109,6 +111,7 @@ HANDLE WINAPI hk_CreateMutexA(LPSECURITY_ATTRIBUTES lpMutexAttributes, BOOL bIni
         init_entered = true;
 
         utils::setup_logging();
+        trace::register_provider();
 
         wm = std::make_unique<window_manager>();
         cm = std::make_unique<config_manager>();
@@ -120,6 +123,16 @@ HANDLE WINAPI hk_CreateMutexA(LPSECURITY_ATTRIBUTES lpMutexAttributes, BOOL bIni
             return o_CreateMutexA(lpMutexAttributes, bInitialOwner, lpName);
         }
 
+        wm->set_dirty_rect_rendering(cm->get_dirty_rect_rendering().value_or(false));
+        perf::set_enabled(cm->get_perf_counters().value_or(false));
+        apply_log_level();
+        pacer.set_enabled(cm->get_adaptive_update_interval().value_or(false));
+        wm->set_activity_tracking(pacer.is_enabled());
+        wm->set_scaling_filter(cm->get_scaling_filter().value_or("auto"));
+
+        if (cm->get_compositor_thread().value_or(false) && !wm->start_compositor())
+            SPDLOG_ERROR("failed to start the compositor thread, rendering on the UI thread");
+
         if (!cm->init_theme())
         {
             SPDLOG_ERROR("failed to init theme");
@@ -127,6 +140,17 @@ HANDLE WINAPI hk_CreateMutexA(LPSECURITY_ATTRIBUTES lpMutexAttributes, BOOL bIni
             return o_CreateMutexA(lpMutexAttributes, bInitialOwner, lpName);
         }
 
+        if (cm->get_theme_enabled() && cm->get_gpu_background().value_or(false))
+        {
+            if (wm->set_background(cm->get_bm_data_main()))
+                cm->release_bm_data_main();
+            else
+                SPDLOG_ERROR("failed to upload background to the GPU, falling back to GDI");
+        }
+
+        if (cm->get_theme_enabled() && cm->get_gpu_palette().value_or(false) && !wm->set_palette(cm->get_color_table(CATEGORY_SHAPES), cm->get_color_table(CATEGORY_TEXT)))
+            SPDLOG_ERROR("failed to set up the GPU palette, falling back to the GDI hooks");
+
         if (!apply_hooks())
         {
             SPDLOG_ERROR("hooking failed");
@@ -139,22 +163,42 @@ HANDLE WINAPI hk_CreateMutexA(LPSECURITY_ATTRIBUTES lpMutexAttributes, BOOL bIni
 
 /**
  * Creates a font object
- * We hook this function to change the font size and quality
+ * We hook this function to change the font size and quality, equal fonts are shared instead of created again
  * See https://learn.microsoft.com/en-us/windows/win32/api/wingdi/nf-wingdi-createfontindirecta
  */
 HFONT WINAPI hk_CreateFontIndirectA(const LOGFONTA* lplf)
 {
-    std::unordered_map<long, long> font_height_map = {
-        {20, 18}, // input custom label
-        {16, 15} // master section fader
-    };
+    if (lplf == nullptr)
+        return o_CreateFontIndirectA(lplf);
 
     LOGFONTA modified_log_font = *lplf;
-    const long new_size = font_height_map[lplf->lfHeight];
-    modified_log_font.lfHeight = new_size != 0 ? new_size : lplf->lfHeight;
+
+    for (const auto& [height, new_height] : FONT_HEIGHT_MAP)
+    {
+        if (lplf->lfHeight == height)
+            modified_log_font.lfHeight = new_height;
+    }
+
     modified_log_font.lfQuality = *cm->get_font_quality();
 
-    return o_CreateFontIndirectA(&modified_log_font);
+    // anti-aliased text would blend with the background key color, and its edge pixels match no palette color
+    if (wm->has_background() || wm->has_palette())
+        modified_log_font.lfQuality = NONANTIALIASED_QUALITY;
+
+    return gdi_objects.get_font(modified_log_font);
+}
+
+/**
+ * Deletes a GDI object
+ * We hook this function to keep shared objects alive, deleting one only releases the reference of the caller
+ * See https://learn.microsoft.com/en-us/windows/win32/api/wingdi/nf-wingdi-deleteobject
+ */
+BOOL WINAPI hk_DeleteObject(HGDIOBJ ho)
+{
+    if (gdi_objects.release(ho))
+        return TRUE;
+
+    return o_DeleteObject(ho);
 }
 
 /**
@@ -168,6 +212,12 @@ BOOL WINAPI hk_AppendMenuA(HMENU hMenu, UINT uFlags, UINT_PTR uIDNewItem, LPCSTR
     {
         o_AppendMenuA(hMenu, uFlags, uIDNewItem, lpNewItem);
 
+        if (perf::is_enabled())
+        {
+            perf_menu = hMenu;
+            o_AppendMenuA(hMenu, MF_STRING, 0x1338, "Performance Overlay");
+        }
+
         return o_AppendMenuA(hMenu, uFlags, 0x1337, VMCHROMA_VERSION);
     }
 
@@ -181,65 +231,67 @@ BOOL WINAPI hk_AppendMenuA(HMENU hMenu, UINT uFlags, UINT_PTR uIDNewItem, LPCSTR
 /**
  * GDI function used to draw lines
  * We hook this function to change the color of UI elements made up of lines
- * Color values are parsed from the colors.yaml
+ * Color values are looked up in the remap tables compiled from the colors.yaml, equal pens are shared instead of created again
  * See https://learn.microsoft.com/en-us/windows/win32/api/wingdi/nf-wingdi-createpen
  */
 HPEN WINAPI hk_CreatePen(int iStyle, int cWidth, COLORREF color)
 {
-    if (const auto new_col_opt = cm->cfg_get_color(utils::colorref_to_hex(color), CATEGORY_SHAPES))
-    {
-        if (const auto new_col = utils::hex_to_colorref(*new_col_opt))
-            color = *new_col;
-    }
+    perf::scope timing(PERF_COLOR_HOOKS);
+
+    if (const auto new_col = cm->cfg_get_color(color, CATEGORY_SHAPES))
+        color = *new_col;
 
-    return o_CreatePen(iStyle, cWidth, color);
+    return gdi_objects.get_pen(iStyle, cWidth, color);
 }
 
 /**
  * GDI function used to draw forms like filled rectangles
  * We hook this function to change the color of UI elements made up of such forms
- * Color values are parsed from the colors.yaml
+ * Color values are looked up in the remap tables compiled from the colors.yaml, equal brushes are shared instead of created again
  * See https://learn.microsoft.com/en-us/windows/win32/api/wingdi/nf-wingdi-createbrushindirect
  */
 HBRUSH WINAPI hk_CreateBrushIndirect(LOGBRUSH* plbrush)
 {
-    if (const auto new_col_opt = cm->cfg_get_color(utils::colorref_to_hex(plbrush->lbColor), CATEGORY_SHAPES))
-    {
-        if (const auto new_col = utils::hex_to_colorref(*new_col_opt))
-            plbrush->lbColor = *new_col;
-    }
+    perf::scope timing(PERF_COLOR_HOOKS);
 
-    return o_CreateBrushIndirect(plbrush);
+    if (const auto new_col = cm->cfg_get_color(plbrush->lbColor, CATEGORY_SHAPES))
+        plbrush->lbColor = *new_col;
+
+    return gdi_objects.get_brush(*plbrush);
 }
 
 /**
  * GDI function used to set the color of text
  * We hook this function to change text color
- * Color values are parsed from the colors.yaml
+ * Color values are looked up in the remap tables compiled from the colors.yaml
  * See https://learn.microsoft.com/en-us/windows/win32/api/wingdi/nf-wingdi-settextcolor
  */
 COLORREF WINAPI hk_SetTextColor(HDC hdc, COLORREF color)
 {
-    if (const auto new_col_opt = cm->cfg_get_color(utils::colorref_to_hex(color), CATEGORY_TEXT))
-    {
-        if (const auto new_col = utils::hex_to_colorref(*new_col_opt))
-            color = *new_col;
-    }
+    perf::scope timing(PERF_COLOR_HOOKS);
+
+    if (const auto new_col = cm->cfg_get_color(color, CATEGORY_TEXT))
+        color = *new_col;
 
     return o_SetTextColor(hdc, color);
 }
 
 /**
  * Sets the time interval for WM_TIMER messages, used to dynamically update UI elements without user interaction
- * Interval value is parsed from the vmchroma.yaml
+ * Interval value is parsed from the vmchroma.yaml, the timer of the main window is owned by the update pacer
  * See https://learn.microsoft.com/en-us/windows/win32/api/winuser/nf-winuser-settimer
  */
 UINT_PTR WINAPI hk_SetTimer(HWND hWnd, UINT_PTR nIDEvent, UINT uElapse, TIMERPROC lpTimerFunc)
 {
     if (nIDEvent == 12346)
     {
-        if (const auto interval = cm->get_ui_update_interval())
-            return o_SetTimer(hWnd, nIDEvent, *interval, lpTimerFunc);
+        const auto interval = cm->get_ui_update_interval().value_or(uElapse);
+
+        // child windows are rendered in the timer of the main window
+        if (hWnd == wm->get_hwnd_main())
+            return o_SetTimer(hWnd, nIDEvent, pacer.on_set_timer(hWnd, nIDEvent, lpTimerFunc, interval), lpTimerFunc);
+
+        return o_SetTimer(hWnd, nIDEvent, interval, lpTimerFunc);
     }
 
     return o_SetTimer(hWnd, nIDEvent, uElapse, lpTimerFunc);
@@ -281,22 +333,36 @@ BOOL WINAPI hk_Rectangle(HDC hdc, int left, int top, int right, int bottom)
  */
 HBITMAP WINAPI hk_CreateDIBSection(HDC hdc, BITMAPINFO* pbmi, UINT usage, void** ppvBits, HANDLE hSection, DWORD offset)
 {
+    perf::scope timing(PERF_CREATE_DIB);
+
     void* ppvBits_new = nullptr;
-    const uint8_t* bm_data = nullptr;
 
-    if (pbmi->bmiHeader.biWidth == cm->get_active_flavor().bitmap_width_main)
-        bm_data = cm->get_bm_data_main().data();
-    else if (pbmi->bmiHeader.biWidth == cm->get_active_flavor().bitmap_width_settings)
-        bm_data = cm->get_bm_data_settings().data();
-    else if (pbmi->bmiHeader.biWidth == cm->get_active_flavor().bitmap_width_cassette)
-        bm_data = cm->get_bm_data_cassette().data();
+    // the main background is composited on the GPU, Voicemeeter draws onto the key color instead
+    if (wm->has_background() && pbmi->bmiHeader.biWidth == cm->get_active_flavor().bitmap_width_main)
+    {
+        const auto bm_handle = o_CreateDIBSection(hdc, pbmi, usage, &ppvBits_new, hSection, offset);
+
+        if (!utils::fill_dib(ppvBits_new, pbmi->bmiHeader, window_manager::BACKGROUND_KEY))
+            SPDLOG_ERROR("unsupported DIB format for the GPU background");
+
+        return bm_handle;
+    }
+
+    const auto pixels = get_theme_pixels(pbmi->bmiHeader);
 
-    if (bm_data != nullptr)
+    if (pixels.data != nullptr)
     {
-        const auto bm_offset = reinterpret_cast<const BITMAPFILEHEADER*>(bm_data)->bfOffBits;
         const auto bm_handle = o_CreateDIBSection(hdc, pbmi, usage, &ppvBits_new, hSection, offset);
 
-        memcpy(ppvBits_new, &bm_data[bm_offset], pbmi->bmiHeader.biSizeImage);
+        if (ppvBits_new != nullptr)
+        {
+            memcpy(ppvBits_new, pixels.data, pixels.size);
+
+            // remember the DIB so a theme reload can copy the new bitmap into it
+            themed_dibs.push_back({bm_handle, ppvBits_new, pbmi->bmiHeader});
+        }
+
+        cm->unmap_bitmaps();
 
         return bm_handle;
     }
@@ -311,13 +377,13 @@ HBITMAP WINAPI hk_CreateDIBSection(HDC hdc, BITMAPINFO* pbmi, UINT usage, void**
  */
 HDC WINAPI hk_BeginPaint(HWND hWnd, LPPAINTSTRUCT lpPaint)
 {
-    if (wm->is_in_map(hWnd))
+    if (const auto wctx = wm->find_wctx(hWnd))
     {
         o_BeginPaint(hWnd, lpPaint);
 
-        const auto& wctx = wm->get_wctx(hWnd);
+        wm->add_damage_client(hWnd, lpPaint->rcPaint);
 
-        return wctx.mem_dc;
+        return wctx->mem_dc;
     }
 
     return o_BeginPaint(hWnd, lpPaint);
@@ -330,12 +396,8 @@ HDC WINAPI hk_BeginPaint(HWND hWnd, LPPAINTSTRUCT lpPaint)
  */
 HDC WINAPI hk_GetDC(HWND hWnd)
 {
-    if (wm->is_in_map(hWnd))
-    {
-        const auto& wctx = wm->get_wctx(hWnd);
-
-        return wctx.mem_dc;
-    }
+    if (const auto wctx = wm->find_wctx(hWnd))
+        return wctx->mem_dc;
 
     return o_GetDC(hWnd);
 }
@@ -441,18 +503,94 @@ BOOL WINAPI hk_TrackPopupMenu(HMENU hMenu, UINT uFlags, int x, int y, int nReser
  */
 LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
+    if (msg == config_manager::WM_CONFIG_RELOADED)
+    {
+        reload_theme();
+        return 0;
+    }
+
     if (msg == WM_COMMAND && LOWORD(wParam) == 0x1337)
         ShellExecuteW(nullptr, L"open", L"https://github.com/emkaix/voicemeeter-chroma", nullptr, nullptr, SW_SHOW);
 
+    if (msg == WM_COMMAND && LOWORD(wParam) == 0x1338)
+    {
+        wm->set_overlay_visible(!wm->is_overlay_visible());
+        CheckMenuItem(perf_menu, 0x1338, MF_BYCOMMAND | (wm->is_overlay_visible() ? MF_CHECKED : MF_UNCHECKED));
+        return 0;
+    }
+
+    if (msg == WM_TIMER && wParam == window_manager::FRAME_TIMER_ID)
+    {
+        wm->on_frame_timer(hwnd);
+        return 0;
+    }
+
     if (msg == WM_TIMER && wParam == 12346)
     {
         const auto ret = o_WndProc_main(hwnd, msg, wParam, lParam);
-        wm->render(hwnd);
+
+        // there is no message for DWM cloaking or DXGI occlusion, both are polled with the timer
+        const bool occluded = wm->is_occluded(hwnd);
+        set_main_visible(hwnd, IsWindowVisible(hwnd) && !occluded);
+
+        wm->render_all();
+        perf::log_if_due();
+
+        if (pacer.is_enabled())
+            pacer.on_tick(wm->consume_activity(), occluded);
+
         return ret;
     }
 
+    if ((msg >= WM_MOUSEFIRST && msg <= WM_MOUSELAST) || (msg >= WM_KEYFIRST && msg <= WM_KEYLAST))
+    {
+        if (pacer.is_enabled())
+            pacer.on_input();
+    }
+
+    if (msg == WM_ENTERSIZEMOVE)
+        wm->begin_live_resize();
+
+    if (msg == WM_EXITSIZEMOVE)
+    {
+        // the swap chains were stretched during the drag, they get their final size once
+        wm->end_live_resize();
+
+        if (pacer.is_enabled())
+            pacer.update_refresh_rate();
+
+        SendMessageA(hwnd, WM_TIMER, 12346, 0);
+    }
+
+    // only sent to the window if perMonitorDpi is enabled
+    if (msg == WM_DPICHANGED)
+    {
+        const UINT new_dpi = HIWORD(wParam);
+        const auto suggested = reinterpret_cast<const RECT*>(lParam);
+
+        // keep the size relative to the default size of the monitor, the suggested size only fits a window that was never resized
+        int w, h;
+        wm->get_cur_main_wnd_size(w, h);
+        w = MulDiv(w, new_dpi, wm->get_main_dpi());
+        h = MulDiv(h, new_dpi, wm->get_main_dpi());
+
+        wm->set_main_dpi(new_dpi);
+        wm->set_cur_main_wnd_size(w, h);
+
+        o_SetWindowPos(hwnd, nullptr, suggested->left, suggested->top, w, h, SWP_NOZORDER | SWP_NOACTIVATE);
+
+        wm->resize_child_windows();
+
+        SendMessageA(hwnd, WM_TIMER, 12346, 0);
+
+        return 0;
+    }
+
     if (msg == WM_DISPLAYCHANGE)
     {
+        if (pacer.is_enabled())
+            pacer.update_refresh_rate();
+
         const auto& wctx = wm->get_wctx(hwnd);
 
         SendMessageW(hwnd, WM_ERASEBKGND, reinterpret_cast<WPARAM>(wctx.mem_dc), lParam);
@@ -522,6 +660,10 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
 
         wm->set_default_main_wnd_size(cs->cx, cs->cy);
 
+        // without perMonitorDpi the window keeps the size it always had, whatever awareness Voicemeeter runs with
+        const UINT dpi = cm->get_per_monitor_dpi().value_or(false) ? GetDpiForWindow(hwnd) : USER_DEFAULT_SCREEN_DPI;
+        wm->set_main_dpi(dpi);
+
         uint32_t w, h;
         LRESULT ret;
 
@@ -532,7 +674,17 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
         if (restore_size_opt)
             restore_size = *restore_size_opt;
 
-        if (restore_size && cm->reg_get_wnd_size(w, h))
+        bool resize = true;
+
+        if (!restore_size || !cm->reg_get_wnd_size(w, h))
+        {
+            // start at the size Windows would have stretched the window to
+            w = MulDiv(cs->cx, dpi, USER_DEFAULT_SCREEN_DPI);
+            h = MulDiv(cs->cy, dpi, USER_DEFAULT_SCREEN_DPI);
+            resize = dpi != USER_DEFAULT_SCREEN_DPI;
+        }
+
+        if (resize)
         {
             wm->set_cur_main_wnd_size(w, h);
 
@@ -549,19 +701,29 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
             ret = o_WndProc_main(hwnd, msg, wParam, lParam);
         }
 
-        // patch mouse scroll instructions after integrity checks
+        // patch mouse scroll instructions after integrity checks, the sites are only searched again after a Voicemeeter update
+        patch_cache_t patch_cache{};
+        bool patch_cache_hit = false;
+        cm->reg_get_patch_cache(patch_cache);
+
 #if defined(_WIN64)
-        if (!utils::apply_scroll_patch64(&scroll_value))
+        if (!utils::apply_scroll_patch64(&scroll_value, patch_cache, patch_cache_hit))
 #else
-        if (!utils::apply_scroll_patch32(&scroll_value))
+        if (!utils::apply_scroll_patch32(&scroll_value, patch_cache, patch_cache_hit))
 #endif
         {
             SPDLOG_ERROR("unable to apply scroll patch");
             return ret;
         }
 
+        if (!patch_cache_hit)
+            cm->reg_save_patch_cache(patch_cache);
+
         wndproc_create_finished = true;
 
+        if (cm->get_hot_reload().value_or(false) && !cm->start_watching(hwnd))
+            SPDLOG_ERROR("failed to start watching the config files");
+
         return ret;
     }
 
@@ -573,7 +735,7 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
         RECT rc;
         o_GetClientRect(hwnd, &rc);
 
-        constexpr int area_size = 10;
+        const int area_size = MulDiv(10, wm->get_main_dpi(), USER_DEFAULT_SCREEN_DPI);
 
         if (pt.x > rc.right - area_size && pt.y > rc.bottom - area_size)
             return HTBOTTOMRIGHT;
@@ -597,11 +759,15 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
 
         const auto rect = reinterpret_cast<RECT*>(lParam);
 
+        // the default size is in 96 DPI pixels, the window can grow up to the default size of its monitor
+        const int max_width = MulDiv(wctx.default_cx, wm->get_main_dpi(), USER_DEFAULT_SCREEN_DPI);
+        const int max_height = MulDiv(wctx.default_cy, wm->get_main_dpi(), USER_DEFAULT_SCREEN_DPI);
+
         int new_width = rect->right - rect->left;
-        new_width = max(wctx.default_cx / 2, min(wctx.default_cx, new_width));
+        new_width = max(max_width / 2, min(max_width, new_width));
 
         int new_height = MulDiv(new_width, wctx.default_cy, wctx.default_cx);
-        new_height = max(wctx.default_cy / 2, min(wctx.default_cy, new_height));
+        new_height = max(max_height / 2, min(max_height, new_height));
 
         rect->right = rect->left + new_width;
         rect->bottom = rect->top + new_height;
@@ -610,20 +776,43 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
 
         wm->resize_child_windows();
 
-        SendMessageA(hwnd, WM_TIMER, 12346, 0);
+        // DXGI stretches the last frame while the drag goes on
+        if (!wm->is_live_resizing())
+            SendMessageA(hwnd, WM_TIMER, 12346, 0);
 
         return 1;
     }
 
     if (msg == WM_SIZE)
     {
+        if (wParam == SIZE_MINIMIZED)
+        {
+            set_main_visible(hwnd, false);
+            return o_WndProc_main(hwnd, msg, wParam, lParam);
+        }
+
         const D2D1_SIZE_U size = {LOWORD(lParam), HIWORD(lParam)};
 
         wm->resize_d2d(hwnd, size);
 
         wm->set_cur_main_wnd_size(LOWORD(lParam), HIWORD(lParam));
 
-        return o_WndProc_main(hwnd, msg, wParam, lParam);
+        const auto ret = o_WndProc_main(hwnd, msg, wParam, lParam);
+
+        if (wParam == SIZE_RESTORED || wParam == SIZE_MAXIMIZED)
+            set_main_visible(hwnd, IsWindowVisible(hwnd) && !wm->is_occluded(hwnd));
+
+        return ret;
+    }
+
+    // hiding to the tray, sent before the visibility changes
+    if (msg == WM_SHOWWINDOW)
+    {
+        const auto ret = o_WndProc_main(hwnd, msg, wParam, lParam);
+
+        set_main_visible(hwnd, wParam && !wm->is_occluded(hwnd));
+
+        return ret;
     }
 
     if (msg == WM_PAINT)
@@ -641,6 +830,12 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
     {
         const auto& wctx = wm->get_wctx(hwnd);
 
+        if (const auto record_frames = cm->get_record_frames().value_or(0); record_frames > 0 && !recording_started)
+        {
+            recording_started = true;
+            start_recording(wctx, record_frames);
+        }
+
         o_WndProc_main(hwnd, msg, reinterpret_cast<WPARAM>(wctx.mem_dc), lParam);
 
         return 1;
@@ -653,10 +848,22 @@ LRESULT ARCH_CALL hk_WndProc_main(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
 
         const auto& wctx = wm->get_wctx(hwnd);
 
-        if (rc.right > 0 && rc.right <= wctx.default_cx && rc.bottom > 0 && rc.bottom <= wctx.default_cy)
+        if (rc.right > 0 && rc.right <= MulDiv(wctx.default_cx, wm->get_main_dpi(), USER_DEFAULT_SCREEN_DPI) && rc.bottom > 0 && rc.bottom <= MulDiv(wctx.default_cy, wm->get_main_dpi(), USER_DEFAULT_SCREEN_DPI))
             cm->reg_save_wnd_size(rc.right, rc.bottom);
 
+        cm->stop_watching();
+
+        if (audio_sessions)
+            audio_sessions->stop();
+
+        wm->set_frame_recorder(nullptr);
+        recorder.stop();
+
+        wm->stop_compositor();
         wm->destroy_window(hwnd);
+
+        // the process exits without unloading the DLL, nothing queued must be lost
+        utils::stop_async_logging();
     }
 
     return o_WndProc_main(hwnd, msg, wParam, lParam);
@@ -673,8 +880,6 @@ LRESULT WNDPROC_SUB_CALL hk_WndProc_comp(HWND hwnd, UINT msg, WPARAM wParam, LPA
         const auto cs = reinterpret_cast<CREATESTRUCTA*>(lParam);
         wm->init_window(hwnd, WND_TYPE_COMP_DENOISE, cs);
 
-        o_SetTimer(hwnd, 12346, 15, nullptr);
-
         wm->scale_to_main_wnd(cs->x, cs->y, cs->cx, cs->cy);
 
         MoveWindow(hwnd, cs->x, cs->y, cs->cx, cs->cy, false);
@@ -693,9 +898,13 @@ LRESULT WNDPROC_SUB_CALL hk_WndProc_comp(HWND hwnd, UINT msg, WPARAM wParam, LPA
         return ret;
     }
 
+    // child windows are rendered together with the main window in its UI update timer
     if (msg == WM_TIMER && wParam == 12346)
+        return 0;
+
+    if (msg == WM_TIMER && wParam == window_manager::FRAME_TIMER_ID)
     {
-        wm->render(hwnd);
+        wm->on_frame_timer(hwnd);
 
         return 0;
     }
@@ -757,8 +966,6 @@ LRESULT WNDPROC_SUB_CALL hk_WndProc_denoiser(HWND hwnd, UINT msg, WPARAM wParam,
         const auto cs = reinterpret_cast<CREATESTRUCTA*>(lParam);
         wm->init_window(hwnd, WND_TYPE_COMP_DENOISE, cs);
 
-        o_SetTimer(hwnd, 12346, 15, nullptr);
-
         wm->scale_to_main_wnd(cs->x, cs->y, cs->cx, cs->cy);
 
         MoveWindow(hwnd, cs->x, cs->y, cs->cx, cs->cy, false);
@@ -768,9 +975,13 @@ LRESULT WNDPROC_SUB_CALL hk_WndProc_denoiser(HWND hwnd, UINT msg, WPARAM wParam,
         return o_WndProc_denoiser(hwnd, msg, wParam, lParam, a5);
     }
 
+    // child windows are rendered together with the main window in its UI update timer
     if (msg == WM_TIMER && wParam == 12346)
+        return 0;
+
+    if (msg == WM_TIMER && wParam == window_manager::FRAME_TIMER_ID)
     {
-        wm->render(hwnd);
+        wm->on_frame_timer(hwnd);
 
         return 0;
     }
@@ -851,8 +1062,6 @@ LRESULT WNDPROC_SUB_CALL hk_WndProc_wdb(HWND hwnd, UINT msg, WPARAM wParam, LPAR
 
         wm->init_window(hwnd, WND_TYPE_WDB, cs);
 
-        o_SetTimer(hwnd, 12346, 15, nullptr);
-
         wm->scale_to_main_wnd(cs->x, cs->y, cs->cx, cs->cy);
 
         // fix pixel gap for wdb
@@ -868,9 +1077,13 @@ LRESULT WNDPROC_SUB_CALL hk_WndProc_wdb(HWND hwnd, UINT msg, WPARAM wParam, LPAR
         return o_WndProc_wdb(hwnd, msg, wParam, lParam, a5);
     }
 
+    // child windows are rendered together with the main window in its UI update timer
     if (msg == WM_TIMER && wParam == 12346)
+        return 0;
+
+    if (msg == WM_TIMER && wParam == window_manager::FRAME_TIMER_ID)
     {
-        wm->render(hwnd);
+        wm->on_frame_timer(hwnd);
 
         return 0;
     }
@@ -928,9 +1141,14 @@ ATOM WINAPI hk_RegisterClassA(const WNDCLASSA* lpWndClass)
 {
     if (lpWndClass->lpszClassName == window_manager::MAINWINDOW_CLASSNAME)
     {
-        o_WndProc_main = lpWndClass->lpfnWndProc;
+        const auto install_window_hooks = [lpWndClass]
+        {
+            o_WndProc_main = lpWndClass->lpfnWndProc;
+            return std::vector<hook_entry_t>{{&reinterpret_cast<PVOID&>(o_WndProc_main), reinterpret_cast<PVOID>(hk_WndProc_main)}};
+        };
 
-        if (!utils::hook_single_fn(&reinterpret_cast<PVOID&>(o_WndProc_main), reinterpret_cast<PVOID>(hk_WndProc_main)))
+        // the window hooks are attached together with the main wndproc
+        if (!hooks.install(HOOK_PHASE_FIRST_WINDOW, install_window_hooks))
         {
             SPDLOG_ERROR("failed to hook main wndproc");
         }
@@ -945,6 +1163,18 @@ ATOM WINAPI hk_RegisterClassA(const WNDCLASSA* lpWndClass)
  */
 HWND WINAPI hk_CreateWindowExA(DWORD dwExStyle, LPCSTR lpClassName, LPCSTR lpWindowName, DWORD dwStyle, int X, int Y, int nWidth, int nHeight, HWND hWndParent, HMENU hMenu, HINSTANCE hInstance, LPVOID lpParam)
 {
+    // the child windows inherit the awareness of the main window, dialogs and menus are still scaled by Windows
+    if (cm->get_per_monitor_dpi().value_or(false) && !IS_INTRESOURCE(lpClassName) && window_manager::MAINWINDOW_CLASSNAME == lpClassName)
+    {
+        const auto previous_context = SetThreadDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+        const auto hwnd = o_CreateWindowExA(dwExStyle, lpClassName, lpWindowName, dwStyle, X, Y, nWidth, nHeight, hWndParent, hMenu, hInstance, lpParam);
+
+        if (previous_context != nullptr)
+            SetThreadDpiAwarenessContext(previous_context);
+
+        return hwnd;
+    }
+
     if (lpParam == nullptr)
         return o_CreateWindowExA(dwExStyle, lpClassName, lpWindowName, dwStyle, X, Y, nWidth, nHeight, hWndParent, hMenu, hInstance, lpParam);
 
@@ -1028,38 +1258,21 @@ BOOL WINAPI hk_VerQueryValueW(LPCVOID pBlock, LPCWSTR lpSubBlock, LPVOID* lplpBu
 
 BOOL WINAPI hk_GetFileVersionInfoW(LPCWSTR lptstrFilename, DWORD dwHandle, DWORD dwLen, LPVOID lpData)
 {
-    file_version_buffer.clear();
-
-    const auto alias_map = cm->get_app_aliases();
-
-    if (!alias_map)
-        return o_GetFileVersionInfoW(lptstrFilename, dwHandle, dwLen, lpData);
-
-    const auto file_name = std::wstring(PathFindFileName(lptstrFilename));
-
-    for (const auto& [k, v] : *alias_map)
-    {
-        const auto k_wstr = utils::str_to_wstr(k);
-        const auto v_wstr = utils::str_to_wstr(v);
-
-        if (!k_wstr || !v_wstr)
-        {
-            SPDLOG_ERROR("failed to convert string to wstring: {}, {}", k, v);
-            return o_GetFileVersionInfoW(lptstrFilename, dwHandle, dwLen, lpData);
-        }
+    perf::scope timing(PERF_SESSION_HOOKS);
 
-        if (lstrcmpiW(k_wstr->c_str(), file_name.c_str()) != 0)
-            continue;
+    file_version_buffer.clear();
 
-        // alias should be applied in the next call to VerQueryValueW
-        file_version_buffer = *v_wstr;
-    }
+    // alias should be applied in the next call to VerQueryValueW
+    if (const auto alias = cm->get_app_alias(PathFindFileName(lptstrFilename)))
+        file_version_buffer = *alias;
 
     return o_GetFileVersionInfoW(lptstrFilename, dwHandle, dwLen, lpData);
 }
 
 int WINAPI hk_InternalGetWindowText(HWND hWnd, LPWSTR pString, int cchMaxCount)
 {
+    perf::scope timing(PERF_SESSION_HOOKS);
+
     if (const auto use_app_name = cm->get_always_use_appname())
     {
         if (!*use_app_name)
@@ -1069,7 +1282,7 @@ int WINAPI hk_InternalGetWindowText(HWND hWnd, LPWSTR pString, int cchMaxCount)
         if (!GetWindowThreadProcessId(hWnd, &pid))
             return o_InternalGetWindowText(hWnd, pString, cchMaxCount);
 
-        const auto app_name = utils::get_exe_product_name_for_pid(pid);
+        const auto app_name = app_cache.get_display_name(pid, cm->get_config_generation());
 
         if (!app_name)
             return o_InternalGetWindowText(hWnd, pString, cchMaxCount);
@@ -1088,42 +1301,29 @@ HRESULT STDMETHODCALLTYPE hk_IsSystemSoundsSession(IAudioSessionControl2* this_p
 
 HRESULT STDMETHODCALLTYPE hk_GetProcessId(IAudioSessionControl2* this_ptr, DWORD* pRetVal)
 {
+    perf::scope timing(PERF_SESSION_HOOKS);
+
     const auto hr = o_GetProcessId(this_ptr, pRetVal);
 
     if (hr != S_OK)
         return hr;
 
-    const auto app_name = utils::get_exe_image_name_for_pid(*pRetVal);
+    // resolved once per process and config generation
+    const auto blacklisted = app_cache.is_blacklisted(*pRetVal, cm->get_config_generation(), [](const std::wstring& app_name) { return cm->is_app_blacklisted(app_name); });
 
-    if (!app_name)
+    if (!blacklisted)
     {
         SPDLOG_ERROR("failed to get app name for pid {}", *pRetVal);
         return S_OK;
     }
 
-    const auto blacklist_opt = cm->get_app_blacklist();
-
-    if (!blacklist_opt)
-        return S_OK;
-
-    const auto& blacklist = *blacklist_opt;
+    trace::session_filtered(*pRetVal, *blacklisted);
 
     // app is blacklisted
-    for (const auto& s : blacklist)
+    if (*blacklisted)
     {
-        const auto wstr = utils::str_to_wstr(s);
-
-        if (!wstr)
-        {
-            SPDLOG_ERROR("failed to convert to wstr");
-            return S_OK;
-        }
-
-        if (lstrcmpiW(wstr->c_str(), app_name->c_str()) == 0)
-        {
-            *pRetVal = 0;
-            return S_FALSE;
-        }
+        *pRetVal = 0;
+        return S_FALSE;
     }
 
     return S_OK;
@@ -1131,7 +1331,7 @@ HRESULT STDMETHODCALLTYPE hk_GetProcessId(IAudioSessionControl2* this_ptr, DWORD
 
 HRESULT STDMETHODCALLTYPE hk_GetSession(IAudioSessionEnumerator* this_ptr, int SessionCount, IAudioSessionControl** Session)
 {
-    if (o_GetProcessId || o_IsSystemSoundsSession)
+    if (hooks.is_installed(HOOK_PHASE_FIRST_SESSION))
         return o_GetSession(this_ptr, SessionCount, Session);
 
     winrt::com_ptr<IAudioSessionControl> session_control;
@@ -1167,15 +1367,25 @@ HRESULT STDMETHODCALLTYPE hk_GetSession(IAudioSessionEnumerator* this_ptr, int S
     // 14: GetProcessId
     // 15: IsSystemSoundsSession
 
+    if (!session_control2)
+        return o_GetSession(this_ptr, SessionCount, Session);
+
     void** session2_control_vtable = *reinterpret_cast<void***>(session_control2.get());
 
-    // GetProcessId has index 14
-    o_GetProcessId = reinterpret_cast<HRESULT(STDMETHODCALLTYPE*)(IAudioSessionControl2* this_ptr, DWORD* pRetVal)>(session2_control_vtable[14]);
-    utils::hook_single_fn(&reinterpret_cast<PVOID&>(o_GetProcessId), reinterpret_cast<PVOID>(hk_GetProcessId));
+    // attached together with the other session hooks, the monitor thread can get here at the same time as Voicemeeter
+    hooks.install(HOOK_PHASE_FIRST_SESSION, [session2_control_vtable]
+    {
+        // GetProcessId has index 14
+        o_GetProcessId = reinterpret_cast<HRESULT(STDMETHODCALLTYPE*)(IAudioSessionControl2* this_ptr, DWORD* pRetVal)>(session2_control_vtable[14]);
+
+        // IsSystemSoundsSession has index 15
+        o_IsSystemSoundsSession = reinterpret_cast<HRESULT(STDMETHODCALLTYPE*)(IAudioSessionControl2* this_ptr)>(session2_control_vtable[15]);
 
-    // IsSystemSoundsSession has index 15
-    o_IsSystemSoundsSession = reinterpret_cast<HRESULT(STDMETHODCALLTYPE*)(IAudioSessionControl2* this_ptr)>(session2_control_vtable[15]);
-    utils::hook_single_fn(&reinterpret_cast<PVOID&>(o_IsSystemSoundsSession), reinterpret_cast<PVOID>(hk_IsSystemSoundsSession));
+        return std::vector<hook_entry_t>{
+            {&reinterpret_cast<PVOID&>(o_GetProcessId), reinterpret_cast<PVOID>(hk_GetProcessId)},
+            {&reinterpret_cast<PVOID&>(o_IsSystemSoundsSession), reinterpret_cast<PVOID>(hk_IsSystemSoundsSession)},
+        };
+    });
 
     return o_GetSession(this_ptr, SessionCount, Session);
 }
@@ -1212,6 +1422,36 @@ HRESULT STDMETHODCALLTYPE hk_GetSessionEnumerator(IAudioSessionManager2* this_pt
     return o_GetSessionEnumerator(this_ptr, SessionEnum);
 }
 
+/**
+ * Keeps the app identity cache in sync with the audio sessions, so the blacklist check in hk_GetProcessId
+ * is resolved when a session is created instead of when Potato enumerates it the first time
+ */
+static void start_session_monitor()
+{
+    audio_sessions = std::make_unique<session_monitor>();
+
+    const auto get_pid = [](IAudioSessionControl2* control, DWORD* pid)
+    {
+        // the hook would report pid 0 for blacklisted apps
+        return o_GetProcessId ? o_GetProcessId(control, pid) : control->GetProcessId(pid);
+    };
+
+    const auto on_added = [](const DWORD pid)
+    {
+        trace::session_changed(pid, true);
+        app_cache.is_blacklisted(pid, cm->get_config_generation(), [](const std::wstring& app_name) { return cm->is_app_blacklisted(app_name); });
+    };
+
+    const auto on_removed = [](const DWORD pid)
+    {
+        trace::session_changed(pid, false);
+        app_cache.evict(pid);
+    };
+
+    if (!audio_sessions->start(get_pid, on_added, on_removed))
+        SPDLOG_ERROR("failed to start the audio session monitor");
+}
+
 HRESULT WINAPI hk_CoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter, DWORD dwClsContext, REFIID riid, LPVOID* ppv)
 {
     if (!IsEqualCLSID(rclsid, __uuidof(MMDeviceEnumerator)) || !IsEqualIID(riid, __uuidof(IMMDeviceEnumerator)) || o_GetSessionEnumerator)
@@ -1253,6 +1493,8 @@ HRESULT WINAPI hk_CoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter, DWORD d
     o_GetSessionEnumerator = reinterpret_cast<HRESULT(STDMETHODCALLTYPE*)(IAudioSessionManager2* this_ptr, IAudioSessionEnumerator** SessionEnum)>(session_manager_vtable[5]);
     utils::hook_single_fn(&reinterpret_cast<PVOID&>(o_GetSessionEnumerator), reinterpret_cast<PVOID>(hk_GetSessionEnumerator));
 
+    start_session_monitor();
+
     return o_CoCreateInstance(rclsid, pUnkOuter, dwClsContext, riid, ppv);
 }
 
@@ -1299,72 +1541,203 @@ DWORD WINAPI hk_GetModuleFileNameA(HMODULE hModule, LPSTR lpFilename, DWORD nSiz
 //        DETOURS SETUP        //
 //*****************************//
 
-static std::vector<std::pair<PVOID*, PVOID>> hooks_base = {
-    {&reinterpret_cast<PVOID&>(o_AppendMenuA), hk_AppendMenuA},
-    {&reinterpret_cast<PVOID&>(o_RegisterClassA), hk_RegisterClassA},
-    {&reinterpret_cast<PVOID&>(o_Rectangle), hk_Rectangle},
-    {&reinterpret_cast<PVOID&>(o_BeginPaint), hk_BeginPaint},
-    {&reinterpret_cast<PVOID&>(o_SetTimer), hk_SetTimer},
-    {&reinterpret_cast<PVOID&>(o_GetDC), hk_GetDC},
-    {&reinterpret_cast<PVOID&>(o_ReleaseDC), hk_ReleaseDC},
-    {&reinterpret_cast<PVOID&>(o_SetWindowPos), hk_SetWindowPos},
-    {&reinterpret_cast<PVOID&>(o_CreateWindowExA), hk_CreateWindowExA},
-    {&reinterpret_cast<PVOID&>(o_DialogBoxIndirectParamA), hk_DialogBoxIndirectParamA},
-    {&reinterpret_cast<PVOID&>(o_TrackPopupMenu), hk_TrackPopupMenu},
-    {&reinterpret_cast<PVOID&>(o_GetClientRect), hk_GetClientRect},
-    {&reinterpret_cast<PVOID&>(o_CoCreateInstance), hk_CoCreateInstance},
-    {&reinterpret_cast<PVOID&>(o_InternalGetWindowText), hk_InternalGetWindowText},
-    {&reinterpret_cast<PVOID&>(o_GetFileVersionInfoW), hk_GetFileVersionInfoW},
-    {&reinterpret_cast<PVOID&>(o_VerQueryValueW), hk_VerQueryValueW},
-    {&reinterpret_cast<PVOID&>(o_OpenProcess), hk_OpenProcess},
-    {&reinterpret_cast<PVOID&>(o_GetModuleFileNameA), hk_GetModuleFileNameA},
-};
-
-static std::vector<std::pair<PVOID*, PVOID>> hooks_theme = {
-    {&reinterpret_cast<PVOID&>(o_CreateFontIndirectA), hk_CreateFontIndirectA},
-    {&reinterpret_cast<PVOID&>(o_CreatePen), hk_CreatePen},
-    {&reinterpret_cast<PVOID&>(o_CreateBrushIndirect), hk_CreateBrushIndirect},
-    {&reinterpret_cast<PVOID&>(o_SetTextColor), hk_SetTextColor},
-    {&reinterpret_cast<PVOID&>(o_CreateDIBSection), hk_CreateDIBSection},
-};
-
 /**
- * Initializes Detours hooks
- * @return True if hooks are attached successfully, false otherwise
+ * Registers all hooks by the phase they are needed in and attaches the startup phase
+ * Theme hooks aren't registered at all if the theme is disabled
+ * @return True if the startup hooks are attached successfully, false otherwise
  */
 bool apply_hooks()
 {
-    if (DetourTransactionBegin() != NO_ERROR)
-        return false;
-
-    if (DetourUpdateThread(GetCurrentThread()) != NO_ERROR)
-        return false;
+    hooks.add(HOOK_PHASE_STARTUP, {
+        {&reinterpret_cast<PVOID&>(o_AppendMenuA), hk_AppendMenuA},
+        {&reinterpret_cast<PVOID&>(o_RegisterClassA), hk_RegisterClassA},
+        {&reinterpret_cast<PVOID&>(o_CoCreateInstance), hk_CoCreateInstance},
+        {&reinterpret_cast<PVOID&>(o_GetModuleFileNameA), hk_GetModuleFileNameA},
+    });
+
+    hooks.add(HOOK_PHASE_FIRST_WINDOW, {
+        {&reinterpret_cast<PVOID&>(o_BeginPaint), hk_BeginPaint},
+        {&reinterpret_cast<PVOID&>(o_SetTimer), hk_SetTimer},
+        {&reinterpret_cast<PVOID&>(o_GetDC), hk_GetDC},
+        {&reinterpret_cast<PVOID&>(o_ReleaseDC), hk_ReleaseDC},
+        {&reinterpret_cast<PVOID&>(o_SetWindowPos), hk_SetWindowPos},
+        {&reinterpret_cast<PVOID&>(o_CreateWindowExA), hk_CreateWindowExA},
+        {&reinterpret_cast<PVOID&>(o_DialogBoxIndirectParamA), hk_DialogBoxIndirectParamA},
+        {&reinterpret_cast<PVOID&>(o_TrackPopupMenu), hk_TrackPopupMenu},
+        {&reinterpret_cast<PVOID&>(o_GetClientRect), hk_GetClientRect},
+        {&reinterpret_cast<PVOID&>(o_Rectangle), hk_Rectangle},
+    });
+
+    // only queried for the processes behind audio sessions
+    hooks.add(HOOK_PHASE_FIRST_SESSION, {
+        {&reinterpret_cast<PVOID&>(o_InternalGetWindowText), hk_InternalGetWindowText},
+        {&reinterpret_cast<PVOID&>(o_GetFileVersionInfoW), hk_GetFileVersionInfoW},
+        {&reinterpret_cast<PVOID&>(o_VerQueryValueW), hk_VerQueryValueW},
+        {&reinterpret_cast<PVOID&>(o_OpenProcess), hk_OpenProcess},
+    });
 
-    for (const auto& [original, hook] : hooks_base)
+    if (cm->get_theme_enabled())
     {
-        if (*original != nullptr && DetourAttach(original, hook) != NO_ERROR)
+        // GDI objects can be created before the first window
+        hooks.add(HOOK_PHASE_STARTUP, {
+            {&reinterpret_cast<PVOID&>(o_CreateFontIndirectA), hk_CreateFontIndirectA},
+            {&reinterpret_cast<PVOID&>(o_DeleteObject), hk_DeleteObject},
+            {&reinterpret_cast<PVOID&>(o_CreateDIBSection), hk_CreateDIBSection},
+        });
+
+        // the palette effect remaps the colors of the finished frame instead
+        if (!wm->has_palette())
         {
-            SPDLOG_ERROR("unable to hook functions");
-            return false;
+            hooks.add(HOOK_PHASE_STARTUP, {
+                {&reinterpret_cast<PVOID&>(o_CreatePen), hk_CreatePen},
+                {&reinterpret_cast<PVOID&>(o_CreateBrushIndirect), hk_CreateBrushIndirect},
+                {&reinterpret_cast<PVOID&>(o_SetTextColor), hk_SetTextColor},
+            });
         }
     }
 
-    if (cm->get_theme_enabled())
+    return hooks.install(HOOK_PHASE_STARTUP);
+}
+
+/**
+ * Looks up the theme bitmap for a DIB section by its width
+ * @param header Header the DIB section is created with
+ * @return Pixel data of the theme bitmap, empty if there is none or it doesn't fit the DIB section
+ */
+byte_view_t get_theme_pixels(const BITMAPINFOHEADER& header)
+{
+    byte_view_t bm_file{nullptr, 0};
+
+    if (header.biWidth == cm->get_active_flavor().bitmap_width_main)
+        bm_file = cm->get_bm_data_main();
+    else if (header.biWidth == cm->get_active_flavor().bitmap_width_settings)
+        bm_file = cm->get_bm_data_settings();
+    else if (header.biWidth == cm->get_active_flavor().bitmap_width_cassette)
+        bm_file = cm->get_bm_data_cassette();
+
+    if (bm_file.data == nullptr || bm_file.size < sizeof(BITMAPFILEHEADER))
+        return {nullptr, 0};
+
+    const auto bm_offset = reinterpret_cast<const BITMAPFILEHEADER*>(bm_file.data)->bfOffBits;
+
+    if (static_cast<uint64_t>(bm_offset) + header.biSizeImage > bm_file.size)
     {
-        for (const auto& [original, hook] : hooks_theme)
-        {
-            if (*original != nullptr && DetourAttach(original, hook) != NO_ERROR)
-            {
-                SPDLOG_ERROR("unable to hook functions");
-                return false;
-            }
-        }
+        SPDLOG_ERROR("theme bitmap is smaller than the requested DIB section");
+        return {nullptr, 0};
     }
 
-    if (DetourTransactionCommit() != NO_ERROR)
-        return false;
+    return {bm_file.data + bm_offset, header.biSizeImage};
+}
+
+/**
+ * Applies logLevel, with perfCounters enabled it is lowered to info so the statistics reach the log with the default config
+ */
+void apply_log_level()
+{
+    std::string level = cm->get_log_level().value_or("error");
+
+    if (perf::is_enabled() && spdlog::level::from_str(level) > spdlog::level::info)
+        level = "info";
 
-    return true;
+    utils::set_log_level(level);
+}
+
+/**
+ * Publishes the state built by the config watcher and repaints all windows with it
+ * Runs on the UI thread in response to WM_CONFIG_RELOADED
+ */
+void reload_theme()
+{
+    if (!cm->publish_pending_state())
+        return;
+
+    apply_log_level();
+
+    // blacklist verdicts of the live sessions are due again for the new generation
+    if (audio_sessions)
+        audio_sessions->refresh();
+
+    if (wm->has_background())
+    {
+        if (wm->set_background(cm->get_bm_data_main()))
+            cm->release_bm_data_main();
+        else
+            SPDLOG_ERROR("failed to upload reloaded background to the GPU");
+    }
+
+    if (wm->has_palette())
+        wm->set_palette(cm->get_color_table(CATEGORY_SHAPES), cm->get_color_table(CATEGORY_TEXT));
+
+    GdiFlush();
+
+    // Voicemeeter loads its backgrounds once, write the new bitmaps into the DIB sections that are still alive
+    const auto dead = std::remove_if(themed_dibs.begin(), themed_dibs.end(), [](const themed_dib_t& dib)
+    {
+        DIBSECTION ds;
+        return GetObject(dib.bitmap, sizeof(ds), &ds) != sizeof(ds) || ds.dsBm.bmBits != dib.bits;
+    });
+    themed_dibs.erase(dead, themed_dibs.end());
+
+    for (const auto& dib : themed_dibs)
+    {
+        const auto pixels = get_theme_pixels(dib.header);
+
+        if (pixels.data != nullptr)
+            memcpy(dib.bits, pixels.data, pixels.size);
+    }
+
+    cm->unmap_bitmaps();
+
+    wm->repaint_all();
+}
+
+/**
+ * Suspends drawing and stretches the UI update timer while the main window can't be seen
+ * When it becomes visible again one full frame is rendered right away, so the window never shows stale content
+ * @param hwnd The hwnd of the main window
+ * @param visible True if the window can be seen
+ */
+void set_main_visible(HWND hwnd, const bool visible)
+{
+    if (!wm->set_suspended(!visible))
+        return;
+
+    SPDLOG_DEBUG("rendering {}", visible ? "resumed" : "suspended");
+
+    pacer.set_suspended(!visible);
+
+    if (visible)
+        PostMessageA(hwnd, WM_TIMER, 12346, 0);
+}
+
+/**
+ * Starts the frame trace of the main window, together with the GPU background and palette so the replay draws the frames the same way
+ * @param wctx The context of the main window
+ * @param frame_count Number of frames to record
+ */
+void start_recording(const window_ctx_t& wctx, const uint32_t frame_count)
+{
+    const auto userprofile_path = utils::get_userprofile_path();
+
+    if (!userprofile_path)
+    {
+        SPDLOG_ERROR("can't get userprofile path for the frame trace");
+        return;
+    }
+
+    const auto& flavor = cm->get_active_flavor();
+    const auto path = std::filesystem::path(*userprofile_path) / (L"vmchroma_" + utils::str_to_wstr_or_default(flavor.name) + L".vmctrace");
+    const std::vector<color_mapping_t> no_colors;
+    const bool gpu_background = wm->has_background();
+    const auto background = gpu_background ? cm->get_bm_data_main() : byte_view_t{};
+
+    if (recorder.start(path.wstring(), frame_count, flavor.id, static_cast<uint32_t>(wctx.default_cx), static_cast<uint32_t>(wctx.default_cy), background,
+                       wm->has_palette() ? cm->get_color_table(CATEGORY_SHAPES) : no_colors,
+                       wm->has_palette() ? cm->get_color_table(CATEGORY_TEXT) : no_colors))
+        wm->set_frame_recorder(&recorder);
+
+    if (gpu_background)
+        cm->release_bm_data_main();
 }
 
 /**
@@ -1386,5 +1759,8 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
         return utils::hook_single_fn(&reinterpret_cast<PVOID&>(o_CreateMutexA), reinterpret_cast<PVOID>(hk_CreateMutexA));
     }
 
+    if (fdwReason == DLL_PROCESS_DETACH)
+        trace::unregister_provider();
+
     return TRUE;
 }
@@ -20,6 +20,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 extern HANDLE (WINAPI *o_CreateMutexA)(LPSECURITY_ATTRIBUTES lpMutexAttributes, BOOL bInitialOwner, LPCSTR lpName);
 extern HFONT (WINAPI *o_CreateFontIndirectA)(const LOGFONTA* lplf);
+extern BOOL (WINAPI *o_DeleteObject)(HGDIOBJ ho);
 extern BOOL (WINAPI *o_AppendMenuA)(HMENU hMenu, UINT uFlags, UINT_PTR uIDNewItem, LPCSTR lpNewItem);
 extern HPEN (WINAPI *o_CreatePen)(int iStyle, int cWidth, COLORREF color);
 extern HBRUSH (WINAPI *o_CreateBrushIndirect)(const LOGBRUSH* plbrush);
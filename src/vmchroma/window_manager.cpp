@@ -17,23 +17,55 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "window_manager.hpp"
 
+#include <algorithm>
+#include <cmath>
+
+#include "frame_trace.hpp"
+#include "palette_effect.hpp"
+#include "perf_stats.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 #include "winapi_hook_defs.hpp"
 #include "spdlog/spdlog.h"
 
-using namespace winrt::Windows;
-using namespace winrt::Windows::Graphics::Display;
-
 /**
  * Initializes the Direct2D context
  */
 window_manager::window_manager()
 {
+    init_device(false);
+}
+
+window_manager::~window_manager()
+{
+    stop_compositor();
+}
+
+/**
+ * Creates the D3D device and the Direct2D context drawing to it
+ * @param threaded True if the device is shared with the compositor thread
+ * @return True if the device was created
+ */
+bool window_manager::init_device(const bool threaded)
+{
+    gpu_queries = {};
+    gpu_query_next = 0;
+    d2d_multithread = nullptr;
+    d2d_context = nullptr;
+    d2d_device = nullptr;
+    dxgi_factory = nullptr;
+    adapter = nullptr;
+    dxgi_device = nullptr;
+    d3d_context = nullptr;
+    d3d_device = nullptr;
+    d2d_factory = nullptr;
+
     try
     {
-        winrt::check_hresult(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, d2d_factory.put()));
+        winrt::check_hresult(D2D1CreateFactory(threaded ? D2D1_FACTORY_TYPE_MULTI_THREADED : D2D1_FACTORY_TYPE_SINGLE_THREADED, d2d_factory.put()));
 
-        const UINT creation_flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT | D3D11_CREATE_DEVICE_SINGLETHREADED;
+        // with the compositor thread every use of the immediate context is serialized by the Direct2D lock
+        const UINT creation_flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT | (threaded ? 0 : D3D11_CREATE_DEVICE_SINGLETHREADED);
 
         const D3D_FEATURE_LEVEL feature_levels[] = {
             D3D_FEATURE_LEVEL_11_1,
@@ -59,11 +91,19 @@ window_manager::window_manager()
         winrt::check_hresult(dxgi_device->GetAdapter(adapter.put()));
         dxgi_factory.capture(adapter, &IDXGIAdapter::GetParent);
         winrt::check_hresult(d2d_factory->CreateDevice(dxgi_device.get(), d2d_device.put()));
+        winrt::check_hresult(d2d_device->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, d2d_context.put()));
+        d3d_device->GetImmediateContext(d3d_context.put());
+
+        if (threaded)
+            d2d_multithread = d2d_factory.as<ID2D1Multithread>();
     }
     catch (const winrt::hresult_error& ex)
     {
         SPDLOG_ERROR("failed to init directx context: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+        return false;
     }
+
+    return true;
 }
 
 HWND window_manager::get_hwnd_main() const
@@ -76,9 +116,44 @@ void window_manager::set_hwnd_main(HWND hwnd)
     hwnd_main = hwnd;
 }
 
+/**
+ * @param hwnd The hwnd of the window
+ * @return The context of the window, an empty context if the window isn't managed
+ */
 window_ctx_t& window_manager::get_wctx(HWND hwnd)
 {
-    return wctx_map[hwnd];
+    if (const auto wctx = find_wctx(hwnd))
+        return *wctx;
+
+    static window_ctx_t empty_wctx;
+    empty_wctx = {};
+
+    return empty_wctx;
+}
+
+/**
+ * Input messages usually come in bursts for the same window, so the last hit is checked first
+ * @param hwnd The hwnd of the window
+ * @return The context of the window, nullptr if the window isn't managed
+ */
+window_ctx_t* window_manager::find_wctx(HWND hwnd)
+{
+    if (hwnd == nullptr)
+        return nullptr;
+
+    if (last_wctx != nullptr && last_wctx->hwnd == hwnd)
+        return last_wctx;
+
+    for (size_t i = 0; i < window_count; ++i)
+    {
+        if (windows[i].hwnd == hwnd)
+        {
+            last_wctx = &windows[i];
+            return last_wctx;
+        }
+    }
+
+    return nullptr;
 }
 
 /**
@@ -90,6 +165,8 @@ window_ctx_t& window_manager::get_wctx(HWND hwnd)
  */
 bool window_manager::init_window(HWND hwnd, const WND_TYPE type, const CREATESTRUCTA* cs)
 {
+    const auto lock = lock_compositor();
+
     window_ctx_t wctx = {};
     wctx.default_cx = cs->cx;
     wctx.default_cy = cs->cy;
@@ -97,6 +174,9 @@ bool window_manager::init_window(HWND hwnd, const WND_TYPE type, const CREATESTR
     wctx.default_y = cs->y;
     wctx.hwnd = hwnd;
     wctx.type = type;
+    wctx.full_damage = true;
+    set_client_size(wctx, cs->cx, cs->cy);
+    set_buffer_size(wctx, cs->cx, cs->cy);
 
     D3D11_TEXTURE2D_DESC tex_desc = {};
     tex_desc.Width = cs->cx;
@@ -117,24 +197,63 @@ bool window_manager::init_window(HWND hwnd, const WND_TYPE type, const CREATESTR
     swap_chain_desc.SampleDesc.Count = 1;
     swap_chain_desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
     swap_chain_desc.BufferCount = 2;
-    swap_chain_desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    // partial presents need the back buffers to keep their content
+    swap_chain_desc.SwapEffect = dirty_rect_rendering ? DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL : DXGI_SWAP_EFFECT_FLIP_DISCARD;
     swap_chain_desc.Scaling = DXGI_SCALING_STRETCH;
     swap_chain_desc.AlphaMode = DXGI_ALPHA_MODE_IGNORE;
+    swap_chain_desc.Flags = SWAP_CHAIN_FLAGS;
 
     try
     {
         winrt::check_hresult(d3d_device->CreateTexture2D(&tex_desc, nullptr, wctx.source_texture.put()));
         winrt::check_hresult(wctx.source_texture->QueryInterface(__uuidof(IDXGISurface1), wctx.source_surface.put_void()));
-        winrt::check_hresult(d2d_device->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, wctx.d2d_context.put()));
 
-        winrt::check_hresult(wctx.d2d_context->CreateBitmapFromDxgiSurface(
+        // the bitmap shares the texture with the GDI DC and stays alive for the lifetime of the window
+        winrt::check_hresult(d2d_context->CreateBitmapFromDxgiSurface(
             wctx.source_surface.get(),
             &source_bitmap_props,
             wctx.source_bitmap.put()
         ));
+        wctx.bitmap_allocations++;
+        wctx.frame_source = wctx.source_bitmap;
+
+        if (d2d_multithread)
+            init_handoff(wctx, tex_desc);
+
+        if (!palette_table.empty())
+        {
+            winrt::check_hresult(d2d_context->CreateEffect(CLSID_VMChromaPalette, wctx.palette.put()));
+            wctx.palette->SetInput(0, wctx.source_bitmap.get());
+            winrt::check_hresult(wctx.palette->SetValue(PALETTE_PROP_TABLE, palette_table.data(), static_cast<UINT32>(palette_table.size())));
+
+            wctx.palette->GetOutput(wctx.paletted_source.put());
+        }
+
+        // pixels of the key color are left over from the main background and show the GPU copy of it
+        if (background_bitmap)
+        {
+            winrt::check_hresult(d2d_context->CreateEffect(CLSID_D2D1ChromaKey, wctx.chroma_key.put()));
+
+            if (wctx.palette)
+                wctx.chroma_key->SetInputEffect(0, wctx.palette.get());
+            else
+                wctx.chroma_key->SetInput(0, wctx.source_bitmap.get());
+
+            winrt::check_hresult(wctx.chroma_key->SetValue(D2D1_CHROMAKEY_PROP_COLOR, D2D1::Vector3F(
+                GetRValue(BACKGROUND_KEY) / 255.0f,
+                GetGValue(BACKGROUND_KEY) / 255.0f,
+                GetBValue(BACKGROUND_KEY) / 255.0f
+            )));
+            winrt::check_hresult(wctx.chroma_key->SetValue(D2D1_CHROMAKEY_PROP_TOLERANCE, 0.01f));
+
+            wctx.chroma_key->GetOutput(wctx.keyed_source.put());
+        }
 
         winrt::check_hresult(wctx.source_surface->GetDC(FALSE, &wctx.mem_dc));
 
+        if (tracks_bounds())
+            SetBoundsRect(wctx.mem_dc, nullptr, DCB_ENABLE | DCB_RESET);
+
         winrt::check_hresult(dxgi_factory->CreateSwapChainForHwnd(
             d3d_device.get(),
             hwnd,
@@ -146,16 +265,27 @@ bool window_manager::init_window(HWND hwnd, const WND_TYPE type, const CREATESTR
 
         winrt::check_hresult(dxgi_factory->MakeWindowAssociation(hwnd, DXGI_MWA_NO_ALT_ENTER));
 
+        // allow a single queued frame, render() checks the waitable object instead of blocking in Present
+        const auto swap_chain2 = wctx.swap_chain.as<IDXGISwapChain2>();
+        winrt::check_hresult(swap_chain2->SetMaximumFrameLatency(1));
+        wctx.frame_latency_waitable = swap_chain2->GetFrameLatencyWaitableObject();
+
+        if (wctx.handoff && wctx.frame_latency_waitable)
+        {
+            HANDLE waitable;
+            winrt::check_bool(DuplicateHandle(GetCurrentProcess(), wctx.frame_latency_waitable, GetCurrentProcess(), &waitable, 0, FALSE, DUPLICATE_SAME_ACCESS));
+            wctx.handoff->waitable = std::shared_ptr<void>(waitable, CloseHandle);
+        }
+
         winrt::com_ptr<IDXGISurface1> swap_chain_surface;
         winrt::check_hresult(wctx.swap_chain->GetBuffer(0, __uuidof(IDXGISurface1), swap_chain_surface.put_void()));
 
-        winrt::check_hresult(wctx.d2d_context->CreateBitmapFromDxgiSurface(
+        winrt::check_hresult(d2d_context->CreateBitmapFromDxgiSurface(
             swap_chain_surface.get(),
             &target_bitmap_props,
             wctx.target_bitmap.put()
         ));
-
-        wctx.d2d_context->SetTarget(wctx.target_bitmap.get());
+        wctx.bitmap_allocations++;
     }
     catch (const winrt::hresult_error& ex)
     {
@@ -163,7 +293,21 @@ bool window_manager::init_window(HWND hwnd, const WND_TYPE type, const CREATESTR
         return false;
     }
 
-    wctx_map[hwnd] = wctx;
+    auto slot = std::find_if(windows.begin(), windows.begin() + window_count, [](const window_ctx_t& w) { return w.hwnd == nullptr; });
+
+    if (slot == windows.begin() + window_count)
+    {
+        if (window_count == MAX_WINDOWS)
+        {
+            SPDLOG_ERROR("failed to initialize window: more than {} windows", MAX_WINDOWS);
+            CloseHandle(wctx.frame_latency_waitable);
+            return false;
+        }
+
+        ++window_count;
+    }
+
+    *slot = std::move(wctx);
 
     return true;
 }
@@ -174,7 +318,13 @@ bool window_manager::init_window(HWND hwnd, const WND_TYPE type, const CREATESTR
  */
 void window_manager::destroy_window(HWND hwnd)
 {
-    const auto& wctx = wctx_map[hwnd];
+    const auto lock = lock_compositor();
+    const auto wctx_ptr = find_wctx(hwnd);
+
+    if (wctx_ptr == nullptr)
+        return;
+
+    auto& wctx = *wctx_ptr;
 
     try
     {
@@ -185,56 +335,101 @@ void window_manager::destroy_window(HWND hwnd)
         SPDLOG_ERROR("failed to destroy window: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
     }
 
+    SPDLOG_INFO("window type {} destroyed, frames presented: {}, bitmap allocations: {}", static_cast<int>(wctx.type), wctx.frames_presented, wctx.bitmap_allocations);
+
+    if (wctx.frame_pending)
+        KillTimer(hwnd, FRAME_TIMER_ID);
+
+    if (wctx.frame_latency_waitable)
+        CloseHandle(wctx.frame_latency_waitable);
+
     DeleteDC(wctx.mem_dc);
-    wctx_map.erase(hwnd);
+    wctx = {};
+
+    if (last_wctx == &wctx)
+        last_wctx = nullptr;
+
+    while (window_count > 0 && windows[window_count - 1].hwnd == nullptr)
+        --window_count;
 }
 
 /**
  * Draws the content of the memory DC to the window
+ * Requests are coalesced to at most one present per vblank, if the swap chain still has a frame queued the frame is deferred
  * @param hwnd The hwnd of the window
  */
 void window_manager::render(HWND hwnd)
 {
-    auto& wctx = wctx_map[hwnd];
+    if (suspended)
+        return;
+
+    frame_batch.clear();
 
     try
     {
-        GdiFlush();
-
-        winrt::check_hresult(wctx.source_surface->ReleaseDC(nullptr));
+        {
+            perf::scope timing(PERF_GDI_FLUSH);
+            GdiFlush();
+        }
 
-        RECT rc;
-        o_GetClientRect(wctx.hwnd, &rc);
+        const auto wctx = find_wctx(hwnd);
 
-        const float scaleX = rc.right / static_cast<float>(wctx.default_cx);
-        const float scaleY = rc.bottom / static_cast<float>(wctx.default_cy);
+        if (wctx != nullptr && wctx->handoff)
+        {
+            publish_frame(*wctx);
+            SetEvent(compositor_wake);
+            return;
+        }
 
-        wctx.d2d_context->BeginDraw();
+        if (wctx != nullptr && begin_frame(*wctx))
+            frame_batch.push_back(wctx);
 
-        wctx.d2d_context->SetTransform(D2D1::Matrix3x2F::Scale(scaleX, scaleY));
+        submit_frames();
+    }
+    catch (const winrt::hresult_error& ex)
+    {
+        SPDLOG_ERROR("render error: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+        utils::mbox_error(L"D2D render error");
+    }
+}
 
-        wctx.d2d_context->DrawImage(
-            wctx.source_bitmap.get(),
-            D2D1::Point2F(0, 0),
-            D2D1::RectF(0, 0, static_cast<float>(wctx.default_cx), static_cast<float>(wctx.default_cy)),
-            D2D1_INTERPOLATION_MODE_HIGH_QUALITY_CUBIC,
-            D2D1_COMPOSITE_MODE_SOURCE_COPY
-        );
+/**
+ * Draws all windows in one batch, called from the UI update timer of the main window
+ * All windows share one device context, so every window of a tick is drawn within one BeginDraw / EndDraw and flushed to the GPU once
+ */
+void window_manager::render_all()
+{
+    if (suspended)
+        return;
 
-        winrt::check_hresult(wctx.d2d_context->EndDraw());
+    frame_batch.clear();
 
-        winrt::check_hresult(wctx.swap_chain->Present(1, 0));
+    try
+    {
+        {
+            perf::scope timing(PERF_GDI_FLUSH);
+            GdiFlush();
+        }
 
-        wctx.mem_dc = nullptr;
-        wctx.source_bitmap = nullptr;
+        if (d2d_multithread)
+        {
+            for (size_t i = 0; i < window_count; ++i)
+            {
+                if (windows[i].hwnd != nullptr && windows[i].handoff)
+                    publish_frame(windows[i]);
+            }
+
+            SetEvent(compositor_wake);
+            return;
+        }
 
-        winrt::check_hresult(wctx.d2d_context->CreateBitmapFromDxgiSurface(
-            wctx.source_surface.get(),
-            &source_bitmap_props,
-            wctx.source_bitmap.put()
-        ));
+        for (size_t i = 0; i < window_count; ++i)
+        {
+            if (windows[i].hwnd != nullptr && begin_frame(windows[i]))
+                frame_batch.push_back(&windows[i]);
+        }
 
-        winrt::check_hresult(wctx.source_surface->GetDC(FALSE, &wctx.mem_dc));
+        submit_frames();
     }
     catch (const winrt::hresult_error& ex)
     {
@@ -243,124 +438,1341 @@ void window_manager::render(HWND hwnd)
     }
 }
 
-void window_manager::set_cur_main_wnd_size(int w, int h)
+/**
+ * Checks whether the window needs a new frame and the swap chain can take it, then releases the GDI DC so D2D can read the texture
+ * GdiFlush must have been called before
+ * @param wctx The window context
+ * @return True if the window takes part in the current frame
+ */
+bool window_manager::begin_frame(window_ctx_t& wctx)
 {
-    cur_main_width = w;
-    cur_main_height = h;
-}
+    if (tracks_bounds())
+    {
+        RECT bounds;
 
-void window_manager::get_cur_main_wnd_size(int& w, int& h) const
-{
-    w = cur_main_width;
-    h = cur_main_height;
+        if (GetBoundsRect(wctx.mem_dc, &bounds, DCB_RESET) & DCB_SET)
+        {
+            activity = true;
+
+            if (dirty_rect_rendering)
+                add_damage(wctx, bounds);
+        }
+    }
+
+    if (dirty_rect_rendering)
+    {
+        // nothing was drawn since the last frame, the window content is still up to date
+        if (wctx.damage.empty() && !wctx.full_damage)
+            return false;
+
+        activity = true;
+    }
+
+    // a frame is still queued, present with the next vblank instead of blocking the UI thread in Present
+    if (wctx.frame_latency_waitable && !wctx.frame_acquired && WaitForSingleObject(wctx.frame_latency_waitable, 0) != WAIT_OBJECT_0)
+    {
+        defer_frame(wctx);
+        return false;
+    }
+
+    wctx.frame_acquired = false;
+
+    if (wctx.frame_pending)
+    {
+        KillTimer(wctx.hwnd, FRAME_TIMER_ID);
+        wctx.frame_pending = false;
+    }
+
+    if (recorder != nullptr && wctx.type == WND_TYPE_MAIN)
+        recorder->capture(wctx.mem_dc);
+
+    winrt::check_hresult(wctx.source_surface->ReleaseDC(nullptr));
+    wctx.mem_dc = nullptr;
+
+    return true;
 }
 
-void window_manager::set_default_main_wnd_size(int w, int h)
+/**
+ * Draws all windows of the current batch with the shared device context, presents them and gives the DCs back to GDI
+ */
+void window_manager::submit_frames()
 {
-    default_main_width = w;
-    default_main_height = h;
+    if (frame_batch.empty())
+        return;
+
+    const auto draw_start = perf::is_enabled() ? perf::now() : 0;
+
+    const auto gpu_query = begin_gpu_timing();
+
+    trace::frame_begin(static_cast<uint32_t>(frame_batch.size()));
+    d2d_context->BeginDraw();
+
+    for (const auto wctx : frame_batch)
+    {
+        d2d_context->SetTarget(wctx->target_bitmap.get());
+
+        if (dirty_rect_rendering)
+            draw_damage(*wctx, wctx->scale_x, wctx->scale_y);
+        else
+            draw_full(*wctx, wctx->scale_x, wctx->scale_y);
+
+        if (overlay_visible && wctx->type == WND_TYPE_MAIN)
+            draw_overlay(*wctx);
+    }
+
+    const auto draw_result = d2d_context->EndDraw();
+    end_gpu_timing(gpu_query);
+    trace::frame_end(draw_result);
+    winrt::check_hresult(draw_result);
+
+    if (draw_start != 0)
+        perf::record(PERF_DRAW, perf::now() - draw_start);
+
+    for (const auto wctx : frame_batch)
+    {
+        perf::scope timing(PERF_PRESENT);
+
+        if (dirty_rect_rendering)
+        {
+            DXGI_PRESENT_PARAMETERS present_params = {};
+            present_params.DirtyRectsCount = static_cast<UINT>(wctx->present_rects.size());
+            present_params.pDirtyRects = wctx->present_rects.empty() ? nullptr : wctx->present_rects.data();
+
+            const auto hr = wctx->swap_chain->Present1(1, 0, &present_params);
+            trace::present(wctx->hwnd, present_params.DirtyRectsCount, hr);
+            winrt::check_hresult(hr);
+            wctx->occluded = hr == DXGI_STATUS_OCCLUDED;
+        }
+        else
+        {
+            const auto hr = wctx->swap_chain->Present(1, 0);
+            trace::present(wctx->hwnd, 0, hr);
+            winrt::check_hresult(hr);
+            wctx->occluded = hr == DXGI_STATUS_OCCLUDED;
+        }
+
+        wctx->frames_presented++;
+
+        winrt::check_hresult(wctx->source_surface->GetDC(FALSE, &wctx->mem_dc));
+
+        if (tracks_bounds())
+            SetBoundsRect(wctx->mem_dc, nullptr, DCB_ENABLE | DCB_RESET);
+    }
+
+    frame_batch.clear();
 }
 
-void window_manager::get_default_main_wnd_size(int& w, int& h) const
+/**
+ * Creates the DirectWrite objects of the overlay on first use
+ * @return True if the overlay can be drawn
+ */
+bool window_manager::init_overlay()
 {
-    w = default_main_width;
-    h = default_main_height;
+    if (overlay_format)
+        return true;
+
+    try
+    {
+        winrt::check_hresult(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(dwrite_factory.put())));
+        winrt::check_hresult(dwrite_factory->CreateTextFormat(L"Consolas", nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 13.0f, L"", overlay_format.put()));
+        winrt::check_hresult(d2d_context->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White), overlay_text_brush.put()));
+        winrt::check_hresult(d2d_context->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Black), overlay_bg_brush.put()));
+    }
+    catch (const winrt::hresult_error& ex)
+    {
+        SPDLOG_ERROR("failed to init overlay: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+        overlay_format = nullptr;
+        return false;
+    }
+
+    return true;
 }
 
 /**
- * Called when window size changes, recreates the Direct2D context for the new window dimensions
- * @param hwnd The hwnd of the window
- * @param pixelSize The new dimensions of the window
+ * Draws the percentiles of the perf counters on top of the frame, must be called between BeginDraw and EndDraw
+ * The overlay is redrawn in every frame, so it is added to the presented area as well, its text is rebuilt every OVERLAY_REFRESH_MS
  */
-void window_manager::resize_d2d(HWND hwnd, const D2D1_SIZE_U& pixelSize)
+void window_manager::draw_overlay(window_ctx_t& wctx)
 {
-    auto& wctx = wctx_map[hwnd];
+    if (!init_overlay())
+        return;
 
-    wctx.d2d_context->SetTarget(nullptr);
-    wctx.target_bitmap = nullptr;
+    const auto rect = D2D1::RectF(OVERLAY_RECT.left, OVERLAY_RECT.top, OVERLAY_RECT.right, OVERLAY_RECT.bottom);
+    const auto t = perf::now();
 
-    try
+    if (overlay_text.empty() || (t - overlay_text_time) * 1000 / perf::get_frequency() >= OVERLAY_REFRESH_MS)
     {
-        winrt::check_hresult(wctx.swap_chain->ResizeBuffers(
-            0, pixelSize.width, pixelSize.height, DXGI_FORMAT_B8G8R8A8_UNORM, 0
-        ));
+        overlay_text = perf::format_overlay();
+        overlay_text_time = t;
+    }
 
-        winrt::com_ptr<IDXGISurface1> swap_chain_surface;
-        winrt::check_hresult(wctx.swap_chain->GetBuffer(0, __uuidof(IDXGISurface1), swap_chain_surface.put_void()));
+    // opaque, in flip sequential mode the area still holds the overlay of an older frame
+    d2d_context->SetTransform(D2D1::Matrix3x2F::Identity());
+    d2d_context->FillRectangle(rect, overlay_bg_brush.get());
+    d2d_context->DrawText(overlay_text.c_str(), static_cast<UINT32>(overlay_text.length()), overlay_format.get(), D2D1::RectF(rect.left + 6, rect.top + 4, rect.right - 6, rect.bottom - 4), overlay_text_brush.get());
 
-        winrt::check_hresult(wctx.d2d_context->CreateBitmapFromDxgiSurface(
-            swap_chain_surface.get(),
-            &target_bitmap_props,
-            wctx.target_bitmap.put()
-        ));
+    // an empty list presents the whole frame anyway
+    if (dirty_rect_rendering && !wctx.present_rects.empty())
+    {
+        const auto target_size = wctx.target_bitmap->GetPixelSize();
+        const RECT target_bounds = {0, 0, static_cast<LONG>(target_size.width), static_cast<LONG>(target_size.height)};
+        RECT dst;
+
+        if (IntersectRect(&dst, &OVERLAY_RECT, &target_bounds))
+            wctx.present_rects.push_back(dst);
     }
-    catch (const winrt::hresult_error& ex)
+}
+
+/**
+ * Shows or hides the perf overlay, all windows are repainted so no stale overlay is left in the back buffers
+ * @param visible True to draw the overlay
+ */
+void window_manager::set_overlay_visible(const bool visible)
+{
     {
-        SPDLOG_ERROR("failed to resize window: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+        const auto lock = lock_compositor();
+        overlay_visible = visible;
     }
 
-    wctx.d2d_context->SetTarget(wctx.target_bitmap.get());
+    repaint_all();
 }
 
-bool window_manager::is_in_map(HWND hwnd)
+bool window_manager::is_overlay_visible() const
 {
-    return wctx_map.find(hwnd) != wctx_map.end();
+    return overlay_visible;
 }
 
-void window_manager::scale_coords(HWND hwnd, POINT& pt)
+/**
+ * Called for FRAME_TIMER_ID, retries a deferred frame
+ * @param hwnd The hwnd of the window
+ */
+void window_manager::on_frame_timer(HWND hwnd)
 {
-    RECT cur_rc;
-    o_GetClientRect(hwnd, &cur_rc);
+    const auto wctx = find_wctx(hwnd);
+
+    if (wctx == nullptr)
+    {
+        KillTimer(hwnd, FRAME_TIMER_ID);
+        return;
+    }
 
-    const auto& wctx = wctx_map[hwnd];
+    // the catch-up frame after resuming covers the deferred one
+    if (suspended)
+    {
+        KillTimer(hwnd, FRAME_TIMER_ID);
+        wctx->frame_pending = false;
+        return;
+    }
 
-    pt.x = MulDiv(pt.x, wctx.default_cx, cur_rc.right);
-    pt.y = MulDiv(pt.y, wctx.default_cy, cur_rc.bottom);
+    render(hwnd);
 }
 
-void window_manager::scale_coords_inverse(HWND hwnd, POINT& pt)
+/**
+ * Blocks until the swap chain of a window can take the next frame, which render then presents without checking again
+ * Only meant for callers without a message loop that runs the frame timer, the UI thread never blocks on the swap chain
+ * @param hwnd The hwnd of the window
+ * @param timeout_ms The maximum time to wait
+ * @return True if the next frame can be presented
+ */
+bool window_manager::wait_for_frame(HWND hwnd, const DWORD timeout_ms)
 {
-    RECT cur_rc;
-    o_GetClientRect(hwnd, &cur_rc);
+    const auto wctx = find_wctx(hwnd);
+
+    if (wctx == nullptr || wctx->handoff)
+        return false;
 
-    const auto& wctx = wctx_map[hwnd];
+    if (wctx->frame_latency_waitable && !wctx->frame_acquired)
+        wctx->frame_acquired = WaitForSingleObject(wctx->frame_latency_waitable, timeout_ms) == WAIT_OBJECT_0;
 
-    pt.x = MulDiv(pt.x, cur_rc.right, wctx.default_cx);
-    pt.y = MulDiv(pt.y, cur_rc.bottom, wctx.default_cy);
+    return wctx->frame_acquired || !wctx->frame_latency_waitable;
 }
 
-void window_manager::scale_to_main_wnd(int& x, int& y, int& cx, int& cy)
+/**
+ * Moves drawing and presenting to an own thread, must be called before the first window is created and before any GPU resources
+ * The device is recreated with Direct2D multithread protection, afterwards the UI thread only copies the GDI surfaces
+ * @return True if the compositor thread is running
+ */
+bool window_manager::start_compositor()
 {
-    x = MulDiv(x, cur_main_width, default_main_width);
-    y = MulDiv(y, cur_main_height, default_main_height);
-    cx = MulDiv(cx, cur_main_width, default_main_width);
-    cy = MulDiv(cy, cur_main_height, default_main_height);
+    if (compositor.joinable())
+        return true;
+
+    if (window_count > 0 || background_bitmap || palette_registered)
+    {
+        SPDLOG_ERROR("the compositor thread has to be started before the first window");
+        return false;
+    }
+
+    if (!init_device(true))
+    {
+        init_device(false);
+        return false;
+    }
+
+    compositor_stop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    compositor_wake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    if (compositor_stop == nullptr || compositor_wake == nullptr)
+    {
+        SPDLOG_ERROR("failed to create compositor events");
+        stop_compositor();
+        init_device(false);
+        return false;
+    }
+
+    // the compositor only sees the latest of several published frames, the damage of the ones in between would be lost
+    dirty_rect_rendering = false;
+    compositor = std::thread(&window_manager::run_compositor, this);
+
+    return true;
 }
 
-void window_manager::resize_child_windows()
+/**
+ * Stops the compositor thread, frames published afterwards are not presented anymore
+ */
+void window_manager::stop_compositor()
 {
-    for (const auto& [hwnd, wctx] : wctx_map)
+    if (compositor.joinable())
     {
-        if (hwnd == hwnd_main)
-            continue;
+        SetEvent(compositor_stop);
+        compositor.join();
+    }
 
-        int x = wctx.default_x;
-        int y = wctx.default_y;
-        int cx = wctx.default_cx;
-        int cy = wctx.default_cy;
+    if (compositor_stop != nullptr)
+        CloseHandle(compositor_stop);
 
-        scale_to_main_wnd(x, y, cx, cy);
+    if (compositor_wake != nullptr)
+        CloseHandle(compositor_wake);
 
-        if (wctx.type == WND_TYPE_WDB)
-        {
-            // fix pixel gap for wdb
-            x -= 1;
-            y -= 1;
-            cx += 2;
-            cy += 2;
-        }
+    compositor_stop = nullptr;
+    compositor_wake = nullptr;
+}
 
-        MoveWindow(hwnd, x, y, cx, cy, false);
-        resize_d2d(hwnd, D2D1::SizeU(cx, cy));
-    }
+/**
+ * @return A lock that keeps the compositor thread out, an empty lock if there is no compositor thread
+ */
+std::unique_lock<std::mutex> window_manager::lock_compositor()
+{
+    if (!d2d_multithread)
+        return {};
+
+    return std::unique_lock(compositor_mtx);
+}
+
+/**
+ * Creates the slots the GDI surface of a window is copied into for the compositor thread
+ * @param wctx The window context
+ * @param tex_desc The description of the GDI surface
+ */
+void window_manager::init_handoff(window_ctx_t& wctx, const D3D11_TEXTURE2D_DESC& tex_desc)
+{
+    auto handoff = std::make_unique<frame_handoff_t>();
+
+    // the slots are only sampled by Direct2D
+    auto slot_desc = tex_desc;
+    slot_desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    slot_desc.MiscFlags = 0;
+
+    for (size_t i = 0; i < frame_ring::SLOT_COUNT; ++i)
+    {
+        winrt::check_hresult(d3d_device->CreateTexture2D(&slot_desc, nullptr, handoff->textures[i].put()));
+
+        const auto surface = handoff->textures[i].as<IDXGISurface>();
+        winrt::check_hresult(d2d_context->CreateBitmapFromDxgiSurface(surface.get(), &source_bitmap_props, handoff->bitmaps[i].put()));
+        wctx.bitmap_allocations++;
+    }
+
+    wctx.handoff = std::move(handoff);
+}
+
+/**
+ * Copies the GDI surface into the free slot of the window and hands it to the compositor thread
+ * Only the copy runs on the UI thread, it never waits for the GPU or the vertical blank
+ * GdiFlush must have been called before
+ * @param wctx The window context
+ */
+void window_manager::publish_frame(window_ctx_t& wctx)
+{
+    if (tracks_bounds())
+    {
+        RECT bounds;
+
+        // nothing was drawn since the last frame, the published one is still up to date
+        if (GetBoundsRect(wctx.mem_dc, &bounds, DCB_RESET) & DCB_SET)
+            activity = true;
+        else if (!wctx.full_damage)
+            return;
+    }
+
+    if (recorder != nullptr && wctx.type == WND_TYPE_MAIN)
+        recorder->capture(wctx.mem_dc);
+
+    const auto slot = wctx.handoff->textures[wctx.handoff->ring.write_index()].get();
+
+    // the immediate context is shared with the compositor thread
+    d2d_multithread->Enter();
+
+    auto hr = wctx.source_surface->ReleaseDC(nullptr);
+
+    if (SUCCEEDED(hr))
+    {
+        d3d_context->CopyResource(slot, wctx.source_texture.get());
+        hr = wctx.source_surface->GetDC(FALSE, &wctx.mem_dc);
+    }
+
+    d2d_multithread->Leave();
+
+    winrt::check_hresult(hr);
+
+    if (tracks_bounds())
+        SetBoundsRect(wctx.mem_dc, nullptr, DCB_ENABLE | DCB_RESET);
+
+    wctx.handoff->ring.publish();
+    wctx.full_damage = false;
+}
+
+void window_manager::run_compositor()
+{
+    const HANDLE handles[] = {compositor_stop, compositor_wake};
+
+    while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        // the UI thread isn't blocked by the waits for the vertical blank
+        const bool retry = !wait_for_swap_chains();
+
+        {
+            std::lock_guard lock(compositor_mtx);
+
+            try
+            {
+                compose();
+            }
+            catch (const winrt::hresult_error& ex)
+            {
+                SPDLOG_ERROR("compositor error: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+            }
+        }
+
+        if (retry)
+            SetEvent(compositor_wake);
+    }
+}
+
+/**
+ * Waits for the swap chains of all windows with a fresh frame, the lock is only held while the windows are collected
+ * @return False if a swap chain didn't take a frame within FRAME_WAIT_TIMEOUT_MS
+ */
+bool window_manager::wait_for_swap_chains()
+{
+    compositor_waits.clear();
+
+    {
+        std::lock_guard lock(compositor_mtx);
+
+        for (size_t i = 0; i < window_count; ++i)
+        {
+            const auto& wctx = windows[i];
+
+            if (wctx.hwnd != nullptr && wctx.handoff && wctx.handoff->ring.has_fresh())
+                compositor_waits.push_back({wctx.hwnd, wctx.handoff->waitable, wctx.handoff->acquired});
+        }
+    }
+
+    bool all_ready = true;
+
+    for (auto& wait : compositor_waits)
+    {
+        if (!wait.ready)
+            wait.ready = !wait.waitable || WaitForSingleObject(wait.waitable.get(), FRAME_WAIT_TIMEOUT_MS) == WAIT_OBJECT_0;
+        all_ready = all_ready && wait.ready;
+    }
+
+    return all_ready;
+}
+
+/**
+ * Draws the latest published frame of every window whose swap chain is ready and presents them, runs on the compositor thread
+ * wait_for_swap_chains must have been called before, so Present never blocks while it holds the lock
+ */
+void window_manager::compose()
+{
+    compositor_batch.clear();
+
+    for (size_t i = 0; i < window_count; ++i)
+    {
+        auto& wctx = windows[i];
+
+        if (wctx.hwnd == nullptr || !wctx.handoff || !wctx.handoff->ring.has_fresh())
+            continue;
+
+        // windows created during the wait or whose swap chain timed out are left for the next round
+        const auto wait = std::find_if(compositor_waits.begin(), compositor_waits.end(), [&wctx](const compositor_wait_t& w) { return w.hwnd == wctx.hwnd && w.waitable == wctx.handoff->waitable; });
+
+        if (wait == compositor_waits.end() || !wait->ready)
+            continue;
+
+        // kept until the frame is presented, so a failed draw doesn't lose the count of the waitable
+        wctx.handoff->acquired = true;
+
+        // frames published during the wait are picked up as well
+        wctx.handoff->ring.acquire();
+        bind_source(wctx, wctx.handoff->bitmaps[wctx.handoff->ring.read_index()].get());
+        compositor_batch.push_back(&wctx);
+    }
+
+    if (compositor_batch.empty())
+        return;
+
+    const auto draw_start = perf::is_enabled() ? perf::now() : 0;
+
+    gpu_timing_query_t* gpu_query = nullptr;
+
+    // the queries use the immediate context, which is shared with the UI thread
+    if (perf::is_enabled())
+    {
+        d2d_multithread->Enter();
+        gpu_query = begin_gpu_timing();
+        d2d_multithread->Leave();
+    }
+
+    trace::frame_begin(static_cast<uint32_t>(compositor_batch.size()));
+    d2d_context->BeginDraw();
+
+    for (const auto wctx : compositor_batch)
+    {
+        d2d_context->SetTarget(wctx->target_bitmap.get());
+
+        draw_full(*wctx, wctx->scale_x, wctx->scale_y);
+
+        if (overlay_visible && wctx->type == WND_TYPE_MAIN)
+            draw_overlay(*wctx);
+    }
+
+    const auto draw_result = d2d_context->EndDraw();
+
+    if (gpu_query != nullptr)
+    {
+        d2d_multithread->Enter();
+        end_gpu_timing(gpu_query);
+        d2d_multithread->Leave();
+    }
+
+    trace::frame_end(draw_result);
+    winrt::check_hresult(draw_result);
+
+    if (draw_start != 0)
+        perf::record(PERF_DRAW, perf::now() - draw_start);
+
+    for (const auto wctx : compositor_batch)
+    {
+        perf::scope timing(PERF_PRESENT);
+
+        d2d_multithread->Enter();
+        const auto hr = wctx->swap_chain->Present(1, 0);
+        d2d_multithread->Leave();
+        wctx->handoff->acquired = false;
+
+        trace::present(wctx->hwnd, 0, hr);
+        winrt::check_hresult(hr);
+        wctx->handoff->occluded.store(hr == DXGI_STATUS_OCCLUDED, std::memory_order_relaxed);
+        wctx->frames_presented++;
+    }
+
+    compositor_batch.clear();
+}
+
+/**
+ * Starts the GPU timing of a draw batch, the immediate context must not be used by another thread meanwhile
+ * @return The queries of the batch, nullptr if perf counters are disabled or all queries are still in flight
+ */
+gpu_timing_query_t* window_manager::begin_gpu_timing()
+{
+    if (!perf::is_enabled())
+        return nullptr;
+
+    collect_gpu_timings();
+
+    auto& query = gpu_queries[gpu_query_next];
+
+    if (query.pending)
+        return nullptr;
+
+    if (!query.disjoint)
+    {
+        D3D11_QUERY_DESC desc = {D3D11_QUERY_TIMESTAMP_DISJOINT, 0};
+        auto hr = d3d_device->CreateQuery(&desc, query.disjoint.put());
+
+        desc.Query = D3D11_QUERY_TIMESTAMP;
+
+        if (SUCCEEDED(hr))
+            hr = d3d_device->CreateQuery(&desc, query.begin.put());
+
+        if (SUCCEEDED(hr))
+            hr = d3d_device->CreateQuery(&desc, query.end.put());
+
+        if (FAILED(hr))
+        {
+            SPDLOG_ERROR("failed to create GPU timing queries: {}", static_cast<uint32_t>(hr));
+            query = {};
+            return nullptr;
+        }
+    }
+
+    d3d_context->Begin(query.disjoint.get());
+    d3d_context->End(query.begin.get());
+    gpu_query_next = (gpu_query_next + 1) % GPU_QUERY_COUNT;
+
+    return &query;
+}
+
+/**
+ * Ends the GPU timing of a draw batch, must follow EndDraw so the commands of the batch were handed to the GPU
+ * @param query The queries returned by begin_gpu_timing, may be nullptr
+ */
+void window_manager::end_gpu_timing(gpu_timing_query_t* query)
+{
+    if (query == nullptr)
+        return;
+
+    d3d_context->End(query->end.get());
+    d3d_context->End(query->disjoint.get());
+    query->pending = true;
+}
+
+/**
+ * Records the GPU time of every batch the GPU has finished, never flushes or waits
+ */
+void window_manager::collect_gpu_timings()
+{
+    for (auto& query : gpu_queries)
+    {
+        if (!query.pending)
+            continue;
+
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        UINT64 begin;
+        UINT64 end;
+
+        if (d3d_context->GetData(query.disjoint.get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            d3d_context->GetData(query.begin.get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            d3d_context->GetData(query.end.get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+            continue;
+
+        query.pending = false;
+
+        // the timestamps are unreliable if the GPU clock changed in between
+        if (!disjoint.Disjoint && disjoint.Frequency != 0 && end >= begin)
+            perf::record(PERF_GPU_DRAW, static_cast<int64_t>((end - begin) * perf::get_frequency() / disjoint.Frequency));
+    }
+}
+
+/**
+ * Makes a bitmap the input of the effect chain of the window
+ * @param wctx The window context
+ * @param bitmap The bitmap the next frame is drawn from
+ */
+void window_manager::bind_source(window_ctx_t& wctx, ID2D1Bitmap1* bitmap)
+{
+    if (wctx.frame_source.get() == bitmap)
+        return;
+
+    wctx.frame_source.copy_from(bitmap);
+
+    if (wctx.palette)
+        wctx.palette->SetInput(0, bitmap);
+    else if (wctx.chroma_key)
+        wctx.chroma_key->SetInput(0, bitmap);
+}
+
+/**
+ * Marks the window as having a pending frame and arms a short timer that retries it
+ */
+void window_manager::defer_frame(window_ctx_t& wctx)
+{
+    if (wctx.frame_pending)
+        return;
+
+    wctx.frame_pending = true;
+    o_SetTimer(wctx.hwnd, FRAME_TIMER_ID, USER_TIMER_MINIMUM, nullptr);
+}
+
+/**
+ * Draws a part of the window content with the current transform
+ * If the background lives on the GPU, it is drawn first and the keyed GDI layer on top of it
+ * @param wctx The window context
+ * @param rect The area in source coordinates
+ */
+void window_manager::draw_source(const window_ctx_t& wctx, const D2D1_RECT_F& rect)
+{
+    const auto offset = D2D1::Point2F(rect.left, rect.top);
+
+    if (!wctx.keyed_source)
+    {
+        if (wctx.paletted_source)
+            d2d_context->DrawImage(wctx.paletted_source.get(), offset, rect, wctx.interpolation, D2D1_COMPOSITE_MODE_SOURCE_COPY);
+        else
+            d2d_context->DrawImage(wctx.frame_source.get(), offset, rect, wctx.interpolation, D2D1_COMPOSITE_MODE_SOURCE_COPY);
+
+        return;
+    }
+
+    // child windows show the part of the main background at their position
+    const float bg_x = wctx.type == WND_TYPE_MAIN ? 0.0f : static_cast<float>(wctx.default_x);
+    const float bg_y = wctx.type == WND_TYPE_MAIN ? 0.0f : static_cast<float>(wctx.default_y);
+    const auto bg_rect = D2D1::RectF(rect.left + bg_x, rect.top + bg_y, rect.right + bg_x, rect.bottom + bg_y);
+
+    d2d_context->DrawImage(background_bitmap.get(), offset, bg_rect, wctx.interpolation, D2D1_COMPOSITE_MODE_SOURCE_COPY);
+    d2d_context->DrawImage(wctx.keyed_source.get(), offset, rect, wctx.interpolation, D2D1_COMPOSITE_MODE_SOURCE_OVER);
+}
+
+/**
+ * Scales the whole source bitmap to the window
+ */
+void window_manager::draw_full(window_ctx_t& wctx, const float scale_x, const float scale_y)
+{
+    d2d_context->SetTransform(D2D1::Matrix3x2F::Scale(scale_x, scale_y));
+
+    draw_source(wctx, D2D1::RectF(0, 0, static_cast<float>(wctx.default_cx), static_cast<float>(wctx.default_cy)));
+}
+
+/**
+ * Scales only the damaged areas of the source bitmap to the window
+ * The flip model back buffer holds the frame before the last one, so the damage of the previous frame is redrawn as well
+ * Fills present_rects with the changed areas in back buffer coordinates
+ */
+void window_manager::draw_damage(window_ctx_t& wctx, const float scale_x, const float scale_y)
+{
+    wctx.redraw_rects.clear();
+    wctx.present_rects.clear();
+
+    const bool full = wctx.full_damage || wctx.prev_full_damage;
+
+    if (full)
+    {
+        wctx.redraw_rects.push_back({0, 0, wctx.default_cx, wctx.default_cy});
+    }
+    else
+    {
+        wctx.redraw_rects.insert(wctx.redraw_rects.end(), wctx.damage.begin(), wctx.damage.end());
+        wctx.redraw_rects.insert(wctx.redraw_rects.end(), wctx.prev_damage.begin(), wctx.prev_damage.end());
+    }
+
+    const auto target_size = wctx.target_bitmap->GetPixelSize();
+    const RECT target_bounds = {0, 0, static_cast<LONG>(target_size.width), static_cast<LONG>(target_size.height)};
+    const RECT source_bounds = {0, 0, wctx.default_cx, wctx.default_cy};
+
+    // maps a source rectangle to the back buffer pixels it affects, including the interpolation footprint
+    const auto to_target = [&](const RECT& src)
+    {
+        RECT dst = {
+            static_cast<LONG>(floorf(static_cast<float>(src.left - DAMAGE_MARGIN) * scale_x)),
+            static_cast<LONG>(floorf(static_cast<float>(src.top - DAMAGE_MARGIN) * scale_y)),
+            static_cast<LONG>(ceilf(static_cast<float>(src.right + DAMAGE_MARGIN) * scale_x)),
+            static_cast<LONG>(ceilf(static_cast<float>(src.bottom + DAMAGE_MARGIN) * scale_y))
+        };
+
+        IntersectRect(&dst, &dst, &target_bounds);
+        return dst;
+    };
+
+    for (const auto& src : wctx.redraw_rects)
+    {
+        const RECT dst = to_target(src);
+
+        if (IsRectEmpty(&dst))
+            continue;
+
+        // sample a bit more than needed so the clip edge is filtered like a full frame
+        RECT sample = {src.left - 2 * DAMAGE_MARGIN, src.top - 2 * DAMAGE_MARGIN, src.right + 2 * DAMAGE_MARGIN, src.bottom + 2 * DAMAGE_MARGIN};
+        IntersectRect(&sample, &sample, &source_bounds);
+
+        d2d_context->SetTransform(D2D1::Matrix3x2F::Identity());
+        d2d_context->PushAxisAlignedClip(
+            D2D1::RectF(static_cast<float>(dst.left), static_cast<float>(dst.top), static_cast<float>(dst.right), static_cast<float>(dst.bottom)),
+            D2D1_ANTIALIAS_MODE_ALIASED
+        );
+
+        d2d_context->SetTransform(D2D1::Matrix3x2F::Scale(scale_x, scale_y));
+
+        draw_source(wctx, D2D1::RectF(static_cast<float>(sample.left), static_cast<float>(sample.top), static_cast<float>(sample.right), static_cast<float>(sample.bottom)));
+
+        d2d_context->PopAxisAlignedClip();
+    }
+
+    // only the current damage differs from what is on screen
+    if (!wctx.full_damage)
+    {
+        for (const auto& src : wctx.damage)
+        {
+            const RECT dst = to_target(src);
+
+            if (!IsRectEmpty(&dst))
+                wctx.present_rects.push_back(dst);
+        }
+    }
+
+    wctx.prev_damage.swap(wctx.damage);
+    wctx.damage.clear();
+    wctx.prev_full_damage = wctx.full_damage;
+    wctx.full_damage = false;
+}
+
+/**
+ * Adds a rectangle in source coordinates to the damaged area of the window
+ * Rectangles are merged into their bounding box once there are too many of them
+ */
+void window_manager::add_damage(window_ctx_t& wctx, const RECT& rc)
+{
+    const RECT source_bounds = {0, 0, wctx.default_cx, wctx.default_cy};
+    RECT clipped;
+
+    if (!IntersectRect(&clipped, &rc, &source_bounds))
+        return;
+
+    if (wctx.damage.size() < MAX_DAMAGE_RECTS)
+    {
+        wctx.damage.push_back(clipped);
+        return;
+    }
+
+    for (const auto& r : wctx.damage)
+        UnionRect(&clipped, &clipped, &r);
+
+    wctx.damage.clear();
+    wctx.damage.push_back(clipped);
+}
+
+/**
+ * Marks an area of the window as damaged, e.g. the update region of WM_PAINT
+ * @param hwnd The hwnd of the window
+ * @param rc The area in client coordinates of the scaled window
+ */
+void window_manager::add_damage_client(HWND hwnd, const RECT& rc)
+{
+    if (!dirty_rect_rendering)
+        return;
+
+    const auto wctx = find_wctx(hwnd);
+
+    if (wctx == nullptr)
+        return;
+
+    const RECT src = {
+        MulDiv(rc.left, wctx->default_cx, wctx->client_cx),
+        MulDiv(rc.top, wctx->default_cy, wctx->client_cy),
+        MulDiv(rc.right, wctx->default_cx, wctx->client_cx),
+        MulDiv(rc.bottom, wctx->default_cy, wctx->client_cy)
+    };
+
+    add_damage(*wctx, src);
+}
+
+void window_manager::set_dirty_rect_rendering(bool enabled)
+{
+    dirty_rect_rendering = enabled;
+}
+
+/**
+ * Lets GDI record the bounds of everything drawn into the memory DCs, so consume_activity can tell static frames apart
+ * @param enabled True to track drawing, must be set before the first window is created
+ */
+void window_manager::set_activity_tracking(const bool enabled)
+{
+    activity_tracking = enabled;
+}
+
+/**
+ * @return True if any window drew something since the last call
+ */
+bool window_manager::consume_activity()
+{
+    const bool result = activity;
+    activity = false;
+    return result;
+}
+
+/**
+ * @param hwnd The hwnd of the window
+ * @return True if the window is minimized, cloaked by DWM or DXGI reports it as occluded
+ */
+bool window_manager::is_occluded(HWND hwnd)
+{
+    if (IsIconic(hwnd))
+        return true;
+
+    BOOL cloaked = FALSE;
+
+    if (SUCCEEDED(DwmGetWindowAttribute(hwnd, DWMWA_CLOAKED, &cloaked, sizeof(cloaked))) && cloaked)
+        return true;
+
+    const auto wctx = find_wctx(hwnd);
+
+    if (wctx == nullptr)
+        return false;
+
+    if (wctx->handoff)
+    {
+        if (!wctx->handoff->occluded.load(std::memory_order_relaxed))
+            return false;
+
+        // nothing is published while the window is occluded, so the compositor thread is idle and the lock is free
+        const auto lock = lock_compositor();
+        const bool occluded = wctx->swap_chain->Present(0, DXGI_PRESENT_TEST) == DXGI_STATUS_OCCLUDED;
+        wctx->handoff->occluded.store(occluded, std::memory_order_relaxed);
+
+        return occluded;
+    }
+
+    // the flag is only updated by Present, while nothing is presented DXGI is asked without showing a frame
+    if (wctx->occluded && wctx->swap_chain)
+        wctx->occluded = wctx->swap_chain->Present(0, DXGI_PRESENT_TEST) == DXGI_STATUS_OCCLUDED;
+
+    return wctx->occluded;
+}
+
+/**
+ * Stops or resumes drawing and presenting of all windows, Voicemeeter keeps drawing to the memory DCs in the meantime
+ * On resume every window is presented in full with the next frame
+ * @param suspend True while the main window can't be seen
+ * @return True if the state changed
+ */
+bool window_manager::set_suspended(const bool suspend)
+{
+    if (suspended == suspend)
+        return false;
+
+    suspended = suspend;
+
+    if (!suspended)
+    {
+        for (size_t i = 0; i < window_count; ++i)
+            windows[i].full_damage = true;
+    }
+
+    return true;
+}
+
+bool window_manager::is_suspended() const
+{
+    return suspended;
+}
+
+bool window_manager::tracks_bounds() const
+{
+    return dirty_rect_rendering || activity_tracking;
+}
+
+/**
+ * Stores the client size input is mapped with, a minimized window keeps its last size
+ * @param wctx The window context
+ * @param cx The client width of the scaled window
+ * @param cy The client height of the scaled window
+ */
+void window_manager::set_client_size(window_ctx_t& wctx, const int32_t cx, const int32_t cy)
+{
+    if (cx <= 0 || cy <= 0)
+        return;
+
+    wctx.client_cx = cx;
+    wctx.client_cy = cy;
+}
+
+/**
+ * Stores the scale factors frames are drawn with and picks the interpolation mode for them
+ * @param wctx The window context
+ * @param cx The width of the back buffers
+ * @param cy The height of the back buffers
+ */
+void window_manager::set_buffer_size(window_ctx_t& wctx, const int32_t cx, const int32_t cy) const
+{
+    if (cx <= 0 || cy <= 0)
+        return;
+
+    wctx.scale_x = cx / static_cast<float>(wctx.default_cx);
+    wctx.scale_y = cy / static_cast<float>(wctx.default_cy);
+
+    switch (filter)
+    {
+    case SCALING_FILTER_NEAREST:
+        wctx.interpolation = D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR;
+        break;
+    case SCALING_FILTER_LINEAR:
+        wctx.interpolation = D2D1_INTERPOLATION_MODE_LINEAR;
+        break;
+    case SCALING_FILTER_CUBIC:
+        wctx.interpolation = D2D1_INTERPOLATION_MODE_HIGH_QUALITY_CUBIC;
+        break;
+    case SCALING_FILTER_AUTO:
+        {
+            // every source pixel covers whole target pixels, filtering would only blur
+            const bool integer_scale = cx % wctx.default_cx == 0 && cy % wctx.default_cy == 0;
+            wctx.interpolation = integer_scale ? D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR : D2D1_INTERPOLATION_MODE_HIGH_QUALITY_CUBIC;
+            break;
+        }
+    }
+}
+
+/**
+ * Sets how the GDI surface is scaled to the back buffers, must be called before the first window is created
+ * @param name One of auto, nearest, linear or cubic
+ */
+void window_manager::set_scaling_filter(const std::string_view name)
+{
+    if (name == "nearest")
+        filter = SCALING_FILTER_NEAREST;
+    else if (name == "linear")
+        filter = SCALING_FILTER_LINEAR;
+    else if (name == "cubic")
+        filter = SCALING_FILTER_CUBIC;
+    else
+        filter = SCALING_FILTER_AUTO;
+}
+
+/**
+ * @param new_recorder Records the frames of the main window, nullptr to stop capturing
+ */
+void window_manager::set_frame_recorder(frame_recorder* new_recorder)
+{
+    recorder = new_recorder;
+}
+
+/**
+ * Uploads the main theme background to the GPU, render() composites it under the GDI layer
+ * Must be called before the first window is created, later calls replace the background
+ * @param bitmap_file The complete bitmap file
+ * @return True on success
+ */
+bool window_manager::set_background(const byte_view_t& bitmap_file)
+{
+    std::vector<uint32_t> pixels;
+    uint32_t width, height;
+
+    if (!utils::bitmap_to_bgra(bitmap_file, pixels, width, height))
+    {
+        SPDLOG_ERROR("failed to decode background bitmap");
+        return false;
+    }
+
+    const auto lock = lock_compositor();
+
+    // on reload the current background stays in use until the new one is uploaded
+    winrt::com_ptr<ID2D1Bitmap1> bitmap;
+
+    try
+    {
+        winrt::check_hresult(d2d_context->CreateBitmap(
+            D2D1::SizeU(width, height),
+            pixels.data(),
+            width * sizeof(uint32_t),
+            &source_bitmap_props,
+            bitmap.put()
+        ));
+    }
+    catch (const winrt::hresult_error& ex)
+    {
+        SPDLOG_ERROR("failed to upload background bitmap: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+        return false;
+    }
+
+    background_bitmap = bitmap;
+
+    for (size_t i = 0; i < window_count; ++i)
+        windows[i].full_damage = true;
+
+    return true;
+}
+
+/**
+ * Remaps the colors of the color tables on the GPU instead of in the GDI hooks
+ * Must be called before the first window is created to take effect, later calls replace the palette of all windows
+ * @param shapes The shapes table of the theme
+ * @param text The text table of the theme
+ * @return True if the palette effect is available
+ */
+bool window_manager::set_palette(const std::vector<color_mapping_t>& shapes, const std::vector<color_mapping_t>& text)
+{
+    const auto lock = lock_compositor();
+
+    if (!palette_registered)
+    {
+        palette_registered = palette_effect::register_effect(d2d_factory.get());
+
+        if (!palette_registered)
+            return false;
+    }
+
+    palette_table = palette_effect::build_table(shapes, text, BACKGROUND_KEY);
+
+    for (size_t i = 0; i < window_count; ++i)
+    {
+        if (!windows[i].palette)
+            continue;
+
+        if (FAILED(windows[i].palette->SetValue(PALETTE_PROP_TABLE, palette_table.data(), static_cast<UINT32>(palette_table.size()))))
+            SPDLOG_ERROR("failed to update the palette of a window");
+
+        windows[i].full_damage = true;
+    }
+
+    return true;
+}
+
+bool window_manager::has_palette() const
+{
+    return !palette_table.empty();
+}
+
+/**
+ * Invalidates every window, Voicemeeter repaints them once and the next frame is presented in full
+ */
+void window_manager::repaint_all()
+{
+    for (size_t i = 0; i < window_count; ++i)
+    {
+        if (windows[i].hwnd == nullptr)
+            continue;
+
+        windows[i].full_damage = true;
+        InvalidateRect(windows[i].hwnd, nullptr, TRUE);
+    }
+}
+
+bool window_manager::has_background() const
+{
+    return background_bitmap != nullptr;
+}
+
+void window_manager::set_cur_main_wnd_size(int w, int h)
+{
+    cur_main_width = w;
+    cur_main_height = h;
+}
+
+void window_manager::get_cur_main_wnd_size(int& w, int& h) const
+{
+    w = cur_main_width;
+    h = cur_main_height;
+}
+
+void window_manager::set_default_main_wnd_size(int w, int h)
+{
+    default_main_width = w;
+    default_main_height = h;
+}
+
+void window_manager::get_default_main_wnd_size(int& w, int& h) const
+{
+    w = default_main_width;
+    h = default_main_height;
+}
+
+void window_manager::set_main_dpi(const UINT dpi)
+{
+    main_dpi = dpi;
+}
+
+/**
+ * @return The DPI of the monitor the main window is on, 96 if the window isn't per monitor aware
+ */
+UINT window_manager::get_main_dpi() const
+{
+    return main_dpi;
+}
+
+/**
+ * Called when window size changes, recreates the Direct2D context for the new window dimensions
+ * During a live resize only the client size is stored, DXGI stretches the old back buffers until end_live_resize
+ * @param hwnd The hwnd of the window
+ * @param pixelSize The new dimensions of the window
+ */
+void window_manager::resize_d2d(HWND hwnd, const D2D1_SIZE_U& pixelSize)
+{
+    trace::resize(hwnd, pixelSize.width, pixelSize.height);
+
+    // minimizing reports an empty client area, the buffers are kept for the restore
+    if (pixelSize.width == 0 || pixelSize.height == 0)
+        return;
+
+    const auto wctx_ptr = find_wctx(hwnd);
+
+    if (wctx_ptr == nullptr)
+        return;
+
+    auto& wctx = *wctx_ptr;
+    set_client_size(wctx, static_cast<int32_t>(pixelSize.width), static_cast<int32_t>(pixelSize.height));
+
+    if (live_resize)
+    {
+        wctx.resize_pending = true;
+        return;
+    }
+
+    resize_buffers(wctx);
+}
+
+/**
+ * Resizes the back buffers to the client size and recreates the target bitmap
+ * @param wctx The window context
+ */
+void window_manager::resize_buffers(window_ctx_t& wctx)
+{
+    const auto lock = lock_compositor();
+
+    // the shared context may still reference the old back buffer
+    d2d_context->SetTarget(nullptr);
+    wctx.target_bitmap = nullptr;
+    wctx.full_damage = true;
+    wctx.resize_pending = false;
+
+    try
+    {
+        winrt::check_hresult(wctx.swap_chain->ResizeBuffers(
+            0, wctx.client_cx, wctx.client_cy, DXGI_FORMAT_B8G8R8A8_UNORM, SWAP_CHAIN_FLAGS
+        ));
+
+        winrt::com_ptr<IDXGISurface1> swap_chain_surface;
+        winrt::check_hresult(wctx.swap_chain->GetBuffer(0, __uuidof(IDXGISurface1), swap_chain_surface.put_void()));
+
+        winrt::check_hresult(d2d_context->CreateBitmapFromDxgiSurface(
+            swap_chain_surface.get(),
+            &target_bitmap_props,
+            wctx.target_bitmap.put()
+        ));
+        wctx.bitmap_allocations++;
+
+        set_buffer_size(wctx, wctx.client_cx, wctx.client_cy);
+    }
+    catch (const winrt::hresult_error& ex)
+    {
+        SPDLOG_ERROR("failed to resize window: {}, {}", static_cast<uint32_t>(ex.code()), winrt::to_string(ex.message()));
+    }
+}
+
+/**
+ * Called on WM_ENTERSIZEMOVE of the main window, resizes are deferred until the drag ends
+ */
+void window_manager::begin_live_resize()
+{
+    live_resize = true;
+}
+
+/**
+ * Called on WM_EXITSIZEMOVE of the main window, every window that changed size during the drag is resized once
+ */
+void window_manager::end_live_resize()
+{
+    live_resize = false;
+
+    for (size_t i = 0; i < window_count; ++i)
+    {
+        if (windows[i].hwnd != nullptr && windows[i].resize_pending)
+            resize_buffers(windows[i]);
+    }
+}
+
+bool window_manager::is_live_resizing() const
+{
+    return live_resize;
+}
+
+bool window_manager::is_in_map(HWND hwnd)
+{
+    return find_wctx(hwnd) != nullptr;
+}
+
+void window_manager::scale_coords(HWND hwnd, POINT& pt)
+{
+    const auto wctx = find_wctx(hwnd);
+
+    if (wctx == nullptr)
+        return;
+
+    pt.x = MulDiv(pt.x, wctx->default_cx, wctx->client_cx);
+    pt.y = MulDiv(pt.y, wctx->default_cy, wctx->client_cy);
+}
+
+void window_manager::scale_coords_inverse(HWND hwnd, POINT& pt)
+{
+    const auto wctx = find_wctx(hwnd);
+
+    if (wctx == nullptr)
+        return;
+
+    pt.x = MulDiv(pt.x, wctx->client_cx, wctx->default_cx);
+    pt.y = MulDiv(pt.y, wctx->client_cy, wctx->default_cy);
+}
+
+void window_manager::scale_to_main_wnd(int& x, int& y, int& cx, int& cy)
+{
+    x = MulDiv(x, cur_main_width, default_main_width);
+    y = MulDiv(y, cur_main_height, default_main_height);
+    cx = MulDiv(cx, cur_main_width, default_main_width);
+    cy = MulDiv(cy, cur_main_height, default_main_height);
+}
+
+/**
+ * Moves every child window to its place in the scaled main window, all moves are applied in one DeferWindowPos batch
+ * If the batch fails, every window is moved one by one instead
+ */
+void window_manager::resize_child_windows()
+{
+    trace::resize_child_windows(static_cast<uint32_t>(window_count));
+
+    struct child_move
+    {
+        HWND hwnd;
+        int x;
+        int y;
+        int cx;
+        int cy;
+    };
+
+    std::vector<child_move> moves;
+    moves.reserve(window_count);
+
+    for (size_t i = 0; i < window_count; ++i)
+    {
+        const auto& wctx = windows[i];
+
+        if (wctx.hwnd == nullptr || wctx.hwnd == hwnd_main)
+            continue;
+
+        int x = wctx.default_x;
+        int y = wctx.default_y;
+        int cx = wctx.default_cx;
+        int cy = wctx.default_cy;
+
+        scale_to_main_wnd(x, y, cx, cy);
+
+        if (wctx.type == WND_TYPE_WDB)
+        {
+            // fix pixel gap for wdb
+            x -= 1;
+            y -= 1;
+            cx += 2;
+            cy += 2;
+        }
+
+        moves.push_back({wctx.hwnd, x, y, cx, cy});
+    }
+
+    HDWP hdwp = BeginDeferWindowPos(static_cast<int>(moves.size()));
+
+    for (const auto& move : moves)
+    {
+        if (hdwp == nullptr)
+            break;
+
+        hdwp = DeferWindowPos(hdwp, move.hwnd, nullptr, move.x, move.y, move.cx, move.cy, SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOREDRAW);
+    }
+
+    // a failed DeferWindowPos frees the whole batch, the windows queued before it are lost as well
+    if (hdwp == nullptr || !EndDeferWindowPos(hdwp))
+    {
+        for (const auto& move : moves)
+            MoveWindow(move.hwnd, move.x, move.y, move.cx, move.cy, false);
+    }
+
+    for (const auto& move : moves)
+        resize_d2d(move.hwnd, D2D1::SizeU(move.cx, move.cy));
 }
@@ -18,50 +18,187 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string_view>
-#include <unordered_map>
+#include <thread>
+#include <vector>
 #include <windows.h>
 #include <d2d1_1.h>
+#include <d2d1effects_2.h>
 #include <d3d11.h>
 #include <dxgi1_2.h>
-#include <winrt/Windows.Graphics.Display.h>
+#include <dxgi1_3.h>
+#include <dwmapi.h>
+#include <dwrite.h>
+#include <winrt/base.h>
+#include "frame_ring.hpp"
+#include "utils.hpp"
 
 
+class frame_recorder;
+
 const enum WND_TYPE { WND_TYPE_MAIN, WND_TYPE_COMP_DENOISE, WND_TYPE_WDB };
 
+enum scaling_filter
+{
+    // nearest neighbor at 1:1 and integer scales, cubic otherwise
+    SCALING_FILTER_AUTO,
+    SCALING_FILTER_NEAREST,
+    SCALING_FILTER_LINEAR,
+    SCALING_FILTER_CUBIC,
+};
+
+/**
+ * Copies of the GDI surface of a window on their way to the compositor thread
+ */
+typedef struct frame_handoff
+{
+    std::array<winrt::com_ptr<ID3D11Texture2D>, frame_ring::SLOT_COUNT> textures;
+    std::array<winrt::com_ptr<ID2D1Bitmap1>, frame_ring::SLOT_COUNT> bitmaps;
+    frame_ring ring;
+    // written by the compositor thread, the UI thread polls it for the suspension
+    std::atomic<bool> occluded{false};
+    // duplicate of the frame latency waitable, the compositor thread keeps it open while it waits without the lock
+    std::shared_ptr<void> waitable;
+    // the compositor thread took the waitable but hasn't presented yet, e.g. because the draw failed, it isn't waited for again
+    bool acquired = false;
+} frame_handoff_t;
+
+/**
+ * A window with a fresh frame, the compositor thread waits for its swap chain before it takes the lock
+ */
+typedef struct compositor_wait
+{
+    HWND hwnd;
+    std::shared_ptr<void> waitable;
+    // the swap chain can take a frame, windows that timed out are retried with the next wake up
+    bool ready;
+} compositor_wait_t;
+
+/**
+ * Timestamp queries around one draw batch, read back without stalling once the GPU got to them
+ */
+typedef struct gpu_timing_query
+{
+    winrt::com_ptr<ID3D11Query> disjoint;
+    winrt::com_ptr<ID3D11Query> begin;
+    winrt::com_ptr<ID3D11Query> end;
+    bool pending;
+} gpu_timing_query_t;
+
 typedef struct window_ctx
 {
     int32_t default_cx;
     int32_t default_cy;
     int32_t default_x;
     int32_t default_y;
+    // client size of the scaled window, kept up to date by resize_d2d so input mapping needs no GetClientRect
+    int32_t client_cx;
+    int32_t client_cy;
+    // back buffer size to default size, differs from the client size while a live resize is stretched by DXGI
+    float scale_x;
+    float scale_y;
+    // picked from the scale factors by the scaling filter
+    D2D1_INTERPOLATION_MODE interpolation;
+    // the back buffers still have the size from before the live resize
+    bool resize_pending;
     HDC mem_dc;
     HWND hwnd;
     WND_TYPE type;
     winrt::com_ptr<IDXGISwapChain1> swap_chain;
-    winrt::com_ptr<ID2D1DeviceContext> d2d_context;
     winrt::com_ptr<ID2D1Bitmap1> target_bitmap;
     winrt::com_ptr<ID2D1Bitmap1> source_bitmap;
     winrt::com_ptr<ID3D11Texture2D> source_texture;
     winrt::com_ptr<IDXGISurface1> source_surface;
+    // the bitmap frames are drawn from, the GDI surface itself or the slot the compositor thread picked up
+    winrt::com_ptr<ID2D1Bitmap1> frame_source;
+    // only set with the compositor thread
+    std::unique_ptr<frame_handoff_t> handoff;
+    winrt::com_ptr<ID2D1Effect> palette;
+    winrt::com_ptr<ID2D1Image> paletted_source;
+    winrt::com_ptr<ID2D1Effect> chroma_key;
+    winrt::com_ptr<ID2D1Image> keyed_source;
+    std::vector<RECT> damage;
+    std::vector<RECT> prev_damage;
+    std::vector<RECT> redraw_rects;
+    std::vector<RECT> present_rects;
+    bool full_damage;
+    bool prev_full_damage;
+    HANDLE frame_latency_waitable;
+    // wait_for_frame already took the waitable, the next frame doesn't check it again
+    bool frame_acquired;
+    bool frame_pending;
+    // the last Present returned DXGI_STATUS_OCCLUDED
+    bool occluded;
+    uint64_t frames_presented;
+    uint64_t bitmap_allocations;
 } window_ctx_t;
 
 class window_manager
 {
 private:
+    // enough for the main window and all child windows of Potato
+    static constexpr size_t MAX_WINDOWS = 64;
+    // draw batches whose GPU time can be in flight at once
+    static constexpr size_t GPU_QUERY_COUNT = 4;
+
     HWND hwnd_main = nullptr;
     uint32_t ui_update_timer = 0;
-    std::unordered_map<HWND, window_ctx_t> wctx_map;
+    bool dirty_rect_rendering = false;
+    bool activity_tracking = false;
+    bool activity = false;
+    bool live_resize = false;
+    // the main window can't be seen, nothing is drawn or presented until it can
+    bool suspended = false;
+    scaling_filter filter = SCALING_FILTER_AUTO;
+    // slots keep their address for the lifetime of the window, free slots have no hwnd
+    std::array<window_ctx_t, MAX_WINDOWS> windows{};
+    size_t window_count = 0;
+    window_ctx_t* last_wctx = nullptr;
+    std::vector<window_ctx_t*> frame_batch;
+    // captures the GDI surface of the main window before every frame while a trace is recorded
+    frame_recorder* recorder = nullptr;
+    // the compositor thread draws and presents, the UI thread only copies the GDI surfaces and publishes them
+    std::thread compositor;
+    HANDLE compositor_stop = nullptr;
+    HANDLE compositor_wake = nullptr;
+    // held by the compositor thread while it draws and by the UI thread while it changes windows or shared D2D resources
+    std::mutex compositor_mtx;
+    std::vector<window_ctx_t*> compositor_batch;
+    // only touched by the compositor thread
+    std::vector<compositor_wait_t> compositor_waits;
     int32_t cur_main_width = 0;
     int32_t cur_main_height = 0;
     int32_t default_main_height = 0;
     int32_t default_main_width = 0;
+    UINT main_dpi = USER_DEFAULT_SCREEN_DPI;
     winrt::com_ptr<ID2D1Factory1> d2d_factory;
     winrt::com_ptr<ID2D1Device> d2d_device;
+    winrt::com_ptr<ID2D1DeviceContext> d2d_context;
     winrt::com_ptr<ID3D11Device> d3d_device = nullptr;
+    winrt::com_ptr<ID3D11DeviceContext> d3d_context;
+    winrt::com_ptr<ID2D1Multithread> d2d_multithread;
+    // only used while perf counters are enabled
+    std::array<gpu_timing_query_t, GPU_QUERY_COUNT> gpu_queries{};
+    size_t gpu_query_next = 0;
     winrt::com_ptr<IDXGIDevice> dxgi_device;
     winrt::com_ptr<IDXGIAdapter> adapter;
     winrt::com_ptr<IDXGIFactory2> dxgi_factory;
+    winrt::com_ptr<ID2D1Bitmap1> background_bitmap;
+    winrt::com_ptr<IDWriteFactory> dwrite_factory;
+    winrt::com_ptr<IDWriteTextFormat> overlay_format;
+    winrt::com_ptr<ID2D1SolidColorBrush> overlay_text_brush;
+    winrt::com_ptr<ID2D1SolidColorBrush> overlay_bg_brush;
+    bool overlay_visible = false;
+    // summarizing the counters sorts every ring, the text is only rebuilt every OVERLAY_REFRESH_MS
+    std::wstring overlay_text;
+    int64_t overlay_text_time = 0;
+    bool palette_registered = false;
+    // constant buffer of the palette effect, empty if the colors are remapped by the GDI hooks
+    std::vector<uint8_t> palette_table;
     D2D1_BITMAP_PROPERTIES1 target_bitmap_props = {
         {DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE},
         96.0f, 96.0f,
@@ -75,25 +212,92 @@ private:
         nullptr
     };
 
+    static constexpr UINT SWAP_CHAIN_FLAGS = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+    static constexpr size_t MAX_DAMAGE_RECTS = 8;
+    static constexpr LONG DAMAGE_MARGIN = 4;
+    // in back buffer pixels, the overlay isn't scaled with the window
+    static constexpr RECT OVERLAY_RECT = {8, 48, 440, 200};
+    static constexpr int64_t OVERLAY_REFRESH_MS = 250;
+    // the compositor thread never waits longer than this for a swap chain, e.g. while DWM doesn't compose the window
+    static constexpr DWORD FRAME_WAIT_TIMEOUT_MS = 100;
+
+    bool init_device(bool threaded);
+    std::unique_lock<std::mutex> lock_compositor();
+    void init_handoff(window_ctx_t& wctx, const D3D11_TEXTURE2D_DESC& tex_desc);
+    void publish_frame(window_ctx_t& wctx);
+    void run_compositor();
+    bool wait_for_swap_chains();
+    void compose();
+    static void bind_source(window_ctx_t& wctx, ID2D1Bitmap1* bitmap);
+    gpu_timing_query_t* begin_gpu_timing();
+    void end_gpu_timing(gpu_timing_query_t* query);
+    void collect_gpu_timings();
+
+    void add_damage(window_ctx_t& wctx, const RECT& rc);
+    void defer_frame(window_ctx_t& wctx);
+    bool begin_frame(window_ctx_t& wctx);
+    void submit_frames();
+    void draw_source(const window_ctx_t& wctx, const D2D1_RECT_F& rect);
+    void draw_full(window_ctx_t& wctx, float scale_x, float scale_y);
+    void draw_damage(window_ctx_t& wctx, float scale_x, float scale_y);
+    bool init_overlay();
+    void draw_overlay(window_ctx_t& wctx);
+    bool tracks_bounds() const;
+    static void set_client_size(window_ctx_t& wctx, int32_t cx, int32_t cy);
+    void set_buffer_size(window_ctx_t& wctx, int32_t cx, int32_t cy) const;
+    void resize_buffers(window_ctx_t& wctx);
+
 public:
     window_manager();
+    ~window_manager();
+    window_manager(const window_manager&) = delete;
+    window_manager& operator=(const window_manager&) = delete;
     static constexpr std::string_view MAINWINDOW_CLASSNAME = "VBCABLE0Voicemeeter0MainWindow0";
     static constexpr std::wstring_view MAINWINDOW_CLASSNAME_UNICODE = L"VBCABLE0Voicemeeter0MainWindow0";
     static constexpr std::string_view COMPDENOISE_CLASSNAME_ANSI = "C_VB2CTL_Free_00\xA9VBurel";
     static constexpr std::wstring_view COMPDENOISE_CLASSNAME_UNICODE = L"C_VB2CTL_Free_00©VBurel";
     static constexpr std::string_view WDB_CLASSNAME_ANSI = "C_VB2CTL_Free_00_wdb\xA9VBurel";
     static constexpr std::wstring_view WDB_CLASSNAME_UNICODE = L"C_VB2CTL_Free_00_wdb©VBurel";
+    static constexpr UINT_PTR FRAME_TIMER_ID = 0x1337;
+    static constexpr COLORREF BACKGROUND_KEY = RGB(255, 0, 254);
     HWND get_hwnd_main() const;
     void set_hwnd_main(HWND);
     window_ctx_t& get_wctx(HWND hwnd);
+    window_ctx_t* find_wctx(HWND hwnd);
     bool init_window(HWND hwnd, WND_TYPE type, const CREATESTRUCTA* cs);
     void destroy_window(HWND);
     void render(HWND hwnd);
+    void render_all();
+    void on_frame_timer(HWND hwnd);
+    bool wait_for_frame(HWND hwnd, DWORD timeout_ms);
+    bool start_compositor();
+    void stop_compositor();
+    void set_dirty_rect_rendering(bool enabled);
+    void set_activity_tracking(bool enabled);
+    void set_scaling_filter(std::string_view name);
+    void set_frame_recorder(frame_recorder* new_recorder);
+    bool consume_activity();
+    bool is_occluded(HWND hwnd);
+    bool set_suspended(bool suspend);
+    bool is_suspended() const;
+    bool set_background(const byte_view_t& bitmap_file);
+    bool set_palette(const std::vector<color_mapping_t>& shapes, const std::vector<color_mapping_t>& text);
+    bool has_palette() const;
+    void repaint_all();
+    void set_overlay_visible(bool visible);
+    bool is_overlay_visible() const;
+    bool has_background() const;
+    void add_damage_client(HWND hwnd, const RECT& rc);
     void set_cur_main_wnd_size(int w, int h);
     void get_cur_main_wnd_size(int& w, int& h) const;
     void set_default_main_wnd_size(int w, int h);
     void get_default_main_wnd_size(int& w, int& h) const;
+    void set_main_dpi(UINT dpi);
+    UINT get_main_dpi() const;
     void resize_d2d(HWND hwnd, const D2D1_SIZE_U& pixelSize);
+    void begin_live_resize();
+    void end_live_resize();
+    bool is_live_resizing() const;
     bool is_in_map(HWND hwnd);
     void scale_coords(HWND hwnd, POINT& pt);
     void scale_coords_inverse(HWND hwnd, POINT& pt);
@@ -113,35 +113,53 @@ foreach ($exe in $vmNamesExist32 + $vmNamesExist64)
     Write-Host "Created duplicate: $modExePath" -ForegroundColor Green
 }
 
-# Run addimport.exe for both 64-bit and 32-bit
-foreach ($exe in $vmNamesExist32)
+# Run addimport.exe in batch mode for both 64-bit and 32-bit, each run patches all copies concurrently
+function Invoke-AddImport([string]$AddImport, [string]$Dll, [string[]]$Exes)
 {
+    if ($Exes.Count -eq 0)
+    {
+        return
+    }
+
     Write-Host
-    Write-Host "Patching 32bit target: $( $exe -replace '\.exe$', '_vmchroma.exe' )" -ForegroundColor Yellow
-    $process = Start-Process -FilePath "$scriptDir\addimport32.exe" -ArgumentList "vmchroma32.dll", "`"$voicemeeterPath\$exe`"", "`"$voicemeeterPath\$( $exe -replace '\.exe$', '_vmchroma.exe' )`"" -Wait -NoNewWindow -PassThru
-    if ($process.ExitCode -ne 0)
+    Write-Host "Patching with $( $AddImport ): $( $Exes -join ', ' )" -ForegroundColor Yellow
+
+    $exePaths = $Exes | ForEach-Object { Join-Path $voicemeeterPath ($_ -replace '\.exe$', '_vmchroma.exe') }
+    $output = & "$scriptDir\$AddImport" --batch $Dll @exePaths
+    $exitCode = $LASTEXITCODE
+
+    try
+    {
+        $result = $output | ConvertFrom-Json
+    }
+    catch
     {
-        Write-Host "addimport32.exe failed for $exe with exit code $($process.ExitCode). Exiting..." -ForegroundColor Red
+        Write-Host "$AddImport returned an unreadable result (exit code $exitCode). Exiting..." -ForegroundColor Red
         Pause
-        if ($process.ExitCode) { exit $process.ExitCode } else { exit 1 }
+        exit 1
     }
-    Write-Host "Successfully patched: $( $exe -replace '\.exe$', '_vmchroma.exe' )" -ForegroundColor Green
-}
 
-foreach ($exe in $vmNamesExist64)
-{
-    Write-Host
-    Write-Host "Patching 64bit target: $( $exe -replace '\.exe$', '_vmchroma.exe' )" -ForegroundColor Yellow
-    $process = Start-Process -FilePath "$scriptDir\addimport64.exe" -ArgumentList "vmchroma64.dll", "`"$voicemeeterPath\$exe`"", "`"$voicemeeterPath\$( $exe -replace '\.exe$', '_vmchroma.exe' )`"" -Wait -NoNewWindow -PassThru
-    if ($process.ExitCode -ne 0)
+    foreach ($entry in $result.results)
     {
-        Write-Host "addimport64.exe failed for $exe with exit code $($process.ExitCode). Exiting..." -ForegroundColor Red
+        switch ($entry.status)
+        {
+            "patched" { Write-Host "Successfully patched: $( $entry.path )" -ForegroundColor Green }
+            "skipped" { Write-Host "Already patched: $( $entry.path )" -ForegroundColor Green }
+            default { Write-Host "Failed to patch $( $entry.path ) at $( $entry.step ), error $( $entry.error )" -ForegroundColor Red }
+        }
+    }
+
+    if ($exitCode -ne 0)
+    {
+        Write-Host "$AddImport failed with exit code $exitCode. Exiting..." -ForegroundColor Red
         Pause
-        if ($process.ExitCode) { exit $process.ExitCode } else { exit 1 }
+        exit $exitCode
     }
-    Write-Host "Successfully patched: $( $exe -replace '\.exe$', '_vmchroma.exe' )" -ForegroundColor Green
 }
 
+Invoke-AddImport "addimport32.exe" "vmchroma32.dll" $vmNamesExist32
+Invoke-AddImport "addimport64.exe" "vmchroma64.dll" $vmNamesExist64
+
 # Copy DLLs to Voicemeeter folder
 foreach ($dll in @("vmchroma32.dll", "vmchroma64.dll"))
 {